@@ -0,0 +1,175 @@
+/******************************************************************************
+* Header:
+*   Accum
+* Desc:
+*   Contains the AccumBuffer class used by progressive rendering. Every pixel
+*   keeps the sum of the samples traced through it so far, so passes can
+*   keep adding samples and the image can be written at any point. The
+*   buffer, the pixels the current pass refines and how far the render got
+*   can be saved to a checkpoint file and loaded again to resume an
+*   interrupted render. Sums are kept in floats, 16 bytes a pixel, and every
+*   row is padded to whole cache lines, so with tiles a multiple of 4 pixels
+*   wide no two threads ever write the same line.
+******************************************************************************/
+#ifndef ACCUM_H
+#define ACCUM_H
+
+// bump whenever the checkpoint layout or what its key covers changes
+const unsigned int checkpointVersion = 3;
+
+/******************************************************************************
+ * ACCUM PIXEL STRUCT - the samples of one pixel added together
+ *****************************************************************************/
+struct AccumPixel
+{
+   float r, g, b;
+   int samples;
+};
+
+/******************************************************************************
+ * CHECKPOINT HEADER STRUCT - the start of a checkpoint file
+ *****************************************************************************/
+struct CheckpointHeader
+{
+   char magic[8];           // "RTACCUM"
+   unsigned int version;    // checkpointVersion
+   int width, height;
+   int pass;                // the pass in progress
+   int nextRow;             // first row of that pass still to render
+   int padding;
+   unsigned long long key;  // identifies the scene and settings rendered
+};
+
+/******************************************************************************
+ * ACCUM BUFFER CLASS - running sums of every pixel and the render progress
+ *****************************************************************************/
+class AccumBuffer
+{
+private:
+   int width;
+   int height;
+   int stride;                    // pixels from one row to the next
+   std::vector<CacheLine> lines;  // the rows, cache line aligned
+   AccumPixel *pixels;
+
+public:
+   int pass;                 // the pass in progress
+   int nextRow;              // first row of that pass still to render
+   std::vector<char> refine; // pixels the pass adds a sample to
+
+   AccumBuffer(int w, int h) : width(w), height(h), pass(0), nextRow(0)
+   {
+      const int perLine = cacheLineBytes / sizeof(AccumPixel);
+      stride = (w + perLine - 1) / perLine * perLine;
+      lines.assign((size_t)stride * h / perLine, CacheLine()); // all zero
+      pixels = lines.empty() ? NULL : (AccumPixel *)&lines[0];
+      refine.assign((size_t)w * h, 0);
+   }
+
+   // the buffer points into its own storage, so it is never copied
+   AccumBuffer(const AccumBuffer &) = delete;
+   AccumBuffer &operator=(const AccumBuffer &) = delete;
+
+   int getWidth() const  { return width;  }
+   int getHeight() const { return height; }
+
+   AccumPixel &at(int x, int y)             { return pixels[(size_t)y * stride + x]; }
+   const AccumPixel &at(int x, int y) const { return pixels[(size_t)y * stride + x]; }
+
+   void add(int x, int y, Color color)
+   {
+      AccumPixel &p = at(x, y);
+      p.r += color.getColorRed();
+      p.g += color.getColorGreen();
+      p.b += color.getColorBlue();
+      p.samples++;
+   }
+
+   // the average of a pixel's samples. a pixel with none borrows the
+   // color of the first pixel of its previewStep block
+   RGBType average(int x, int y, int previewStep) const
+   {
+      const AccumPixel *p = &at(x, y);
+      if (p->samples == 0)
+         p = &at(x - x % previewStep, y - y % previewStep);
+
+      RGBType color = { 0, 0, 0 };
+      if (p->samples > 0)
+      {
+         color.r = p->r / p->samples;
+         color.g = p->g / p->samples;
+         color.b = p->b / p->samples;
+      }
+      return color;
+   }
+
+   // writes to a temporary file renamed over path, so a crash while saving
+   // leaves the previous checkpoint intact
+   bool save(const std::string &path, unsigned long long key) const
+   {
+      CheckpointHeader header;
+      memset(&header, 0, sizeof(header));
+      memcpy(header.magic, "RTACCUM", 8);
+      header.version = checkpointVersion;
+      header.width = width;
+      header.height = height;
+      header.pass = pass;
+      header.nextRow = nextRow;
+      header.key = key;
+
+      std::string temp = path + ".tmp";
+      FILE *file = fopen(temp.c_str(), "wb");
+      if (file == NULL)
+         return false;
+
+      bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                fwrite(&lines[0], sizeof(CacheLine), lines.size(), file) == lines.size() &&
+                fwrite(&refine[0], 1, refine.size(), file) == refine.size();
+      if (fclose(file) != 0)
+         ok = false;
+      if (ok && rename(temp.c_str(), path.c_str()) == 0)
+         return true;
+
+      remove(temp.c_str());
+      return false;
+   }
+
+   // false, leaving the buffer untouched, unless path is a checkpoint of
+   // this size made with the same key
+   bool load(const std::string &path, unsigned long long key)
+   {
+      FILE *file = fopen(path.c_str(), "rb");
+      if (file == NULL)
+         return false;
+
+      CheckpointHeader header;
+      bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+                memcmp(header.magic, "RTACCUM", 8) == 0 &&
+                header.version == checkpointVersion && header.key == key &&
+                header.width == width && header.height == height &&
+                header.pass >= 0 && header.nextRow >= 0 && header.nextRow <= height;
+
+      std::vector<CacheLine> loaded;
+      std::vector<char> loadedRefine;
+      if (ok)
+      {
+         loaded.resize(lines.size());
+         loadedRefine.resize(refine.size());
+         ok = fread(&loaded[0], sizeof(CacheLine), loaded.size(), file) == loaded.size() &&
+              fread(&loadedRefine[0], 1, loadedRefine.size(), file) == loadedRefine.size();
+      }
+      fclose(file);
+
+      if (!ok)
+         return false;
+
+      lines.swap(loaded);
+      pixels = (AccumPixel *)&lines[0];
+      refine.swap(loadedRefine);
+      pass = header.pass;
+      nextRow = header.nextRow;
+      return true;
+   }
+};
+
+#endif
@@ -0,0 +1,40 @@
+/******************************************************************************
+* Header:
+*   AllocCount
+* Desc:
+*   Replaces the global operator new and delete with versions that count
+*   every heap allocation made by the calling thread. The renderer reads the
+*   count around each tile to prove the trace path never touches the heap.
+*   Must only be included by one source file (main.cpp).
+******************************************************************************/
+#ifndef ALLOCCOUNT_H
+#define ALLOCCOUNT_H
+
+/******************************************************************************
+ * THREAD ALLOCATIONS - heap allocations made so far by the calling thread
+ *****************************************************************************/
+inline long long &threadAllocations()
+{
+   static thread_local long long count = 0;
+   return count;
+}
+
+void *operator new(std::size_t size)
+{
+   threadAllocations()++;
+
+   void *block = malloc(size ? size : 1);
+   if (block == NULL)
+      throw std::bad_alloc();
+   return block;
+}
+
+// once these are inlined gcc sees free called on memory from operator new
+// and takes it for a mismatch, though new above got it from malloc
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void *block) noexcept              { free(block); }
+void operator delete(void *block, std::size_t) noexcept { free(block); }
+#pragma GCC diagnostic pop
+
+#endif
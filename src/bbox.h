@@ -0,0 +1,113 @@
+/******************************************************************************
+* Header:
+*   BBox
+* Desc:
+*   Contains the BBox class, an axis aligned bounding box. Used by the BVH to
+*   skip whole groups of objects a ray can not hit.
+******************************************************************************/
+#ifndef BBOX_H
+#define BBOX_H
+
+/******************************************************************************
+ * BBOX CLASS - an axis aligned box from lo to hi
+ *****************************************************************************/
+class BBox
+{
+private:
+   Real lo[3], hi[3]; // min and max corner, indexed by axis
+
+public:
+   BBox() // default const, an empty box
+   {
+      for (int a = 0; a < 3; a++)
+      {
+         lo[a] =  std::numeric_limits<Real>::infinity();
+         hi[a] = -std::numeric_limits<Real>::infinity();
+      }
+   }
+
+   BBox(Vect a, Vect b) // secondary const, the box around two points
+   {
+      lo[0] = hi[0] = a.getVectX();
+      lo[1] = hi[1] = a.getVectY();
+      lo[2] = hi[2] = a.getVectZ();
+      expand(b);
+   }
+
+   Real getMin(int axis) const { return lo[axis]; }
+   Real getMax(int axis) const { return hi[axis]; }
+   Real getCenter(int axis) const { return (lo[axis] + hi[axis]) / 2; }
+   bool isEmpty() const { return lo[0] > hi[0]; }
+
+   void expand(Vect p)
+   {
+      Real c[3] = { p.getVectX(), p.getVectY(), p.getVectZ() };
+      for (int a = 0; a < 3; a++)
+      {
+         lo[a] = std::min(lo[a], c[a]);
+         hi[a] = std::max(hi[a], c[a]);
+      }
+   }
+
+   void expand(const BBox &box)
+   {
+      for (int a = 0; a < 3; a++)
+      {
+         lo[a] = std::min(lo[a], box.lo[a]);
+         hi[a] = std::max(hi[a], box.hi[a]);
+      }
+   }
+
+   // grow every side so hits that were nudged by an epsilon stay inside
+   void pad(Real amount)
+   {
+      for (int a = 0; a < 3; a++)
+      {
+         Real slack = amount * (1 + std::max(std::fabs(lo[a]), std::fabs(hi[a])));
+         lo[a] -= slack;
+         hi[a] += slack;
+      }
+   }
+
+   int longestAxis() const
+   {
+      Real dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+      if (dx >= dy && dx >= dz)
+         return 0;
+      return (dy >= dz) ? 1 : 2;
+   }
+
+   Real surfaceArea() const
+   {
+      if (isEmpty())
+         return 0;
+      Real dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+      return 2 * (dx*dy + dy*dz + dz*dx);
+   }
+
+   // slab test. org and invDir are the ray origin and 1/direction per axis.
+   // true when the ray is inside the box somewhere along [0, tMax]
+   bool intersect(const Real org[3], const Real invDir[3], Real tMax) const
+   {
+      Real tNear = 0;
+      Real tFar  = tMax;
+
+      for (int a = 0; a < 3; a++)
+      {
+         Real t0 = (lo[a] - org[a]) * invDir[a];
+         Real t1 = (hi[a] - org[a]) * invDir[a];
+         if (t0 > t1)
+            std::swap(t0, t1);
+
+         // written so a NaN (ray in the slab plane) never rejects the box
+         tNear = t0 > tNear ? t0 : tNear;
+         tFar  = t1 < tFar  ? t1 : tFar;
+         if (tNear > tFar)
+            return false;
+      }
+
+      return true;
+   }
+};
+
+#endif
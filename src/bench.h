@@ -0,0 +1,263 @@
+/******************************************************************************
+* Header:
+*   Bench
+* Desc:
+*   The render benchmark suite. Holds the timing of a rendered frame, the
+*   standard benchmark scenes and the JSON report. The scenes are made as
+*   scene text, so loading them goes through the same parser as a scene
+*   file. The suite itself is run by runBench in main.cpp.
+******************************************************************************/
+#ifndef BENCH_H
+#define BENCH_H
+
+// bump whenever the fields of the JSON report change
+const int benchReportVersion = 2;
+
+// wall clock seconds from start until now
+inline double secondsSince(std::chrono::steady_clock::time_point start)
+{
+   return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/******************************************************************************
+ * FRAME STATS STRUCT - what rendering one frame took. trace and shade split
+ *    the wall time of the frame, less writing, by how long the threads spent
+ *    on each: trace is finding what camera rays hit, shade is everything
+ *    else, shadow and reflection rays included. only the benchmark suite
+ *    times the split, other renders leave both 0
+ *****************************************************************************/
+struct FrameStats
+{
+   int tiles;
+   int bands;
+   int bandHeight;                   // rows in a band, the last may be shorter
+   std::vector<WorkerStats> workers; // one per render thread
+   double renderSeconds;             // wall time of the frame, writing included
+   double traceSeconds;
+   double shadeSeconds;
+   double writeSeconds;              // encoding and writing the image
+   TraversalStats traversal;
+   long long samples;                // camera samples traced
+   long long allocations;            // heap allocations while tracing
+   ProfileCounters profile;          // only counted in a profiling build
+
+   FrameStats() : tiles(0), bands(0), bandHeight(0), renderSeconds(0), traceSeconds(0)
+                , shadeSeconds(0), writeSeconds(0), samples(0), allocations(0) {}
+};
+
+/******************************************************************************
+ * BENCH RUN STRUCT - the phases of one run of a benchmark scene, in seconds
+ *****************************************************************************/
+struct BenchRun
+{
+   double load;  // parsing the scene text
+   double build; // building the BVH
+   double trace;
+   double shade;
+   double write;
+   double wall;  // all of the above, end to end
+   long long rays;
+   long long samples;
+
+   // every BVH query of the frame over the time spent tracing and shading
+   double raysPerSecond() const
+   {
+      return trace + shade > 0 ? rays / (trace + shade) : 0;
+   }
+};
+
+/******************************************************************************
+ * BENCH SCENE STRUCT - the runs of one benchmark scene
+ *****************************************************************************/
+struct BenchScene
+{
+   std::string name;
+   int objects;
+   int triangles; // mesh triangles, counted apart from objects
+   int lights;
+   int width;
+   int height;
+   std::vector<BenchRun> runs;
+
+   // the run with the median wall time, so one slow run does not count
+   const BenchRun &median() const
+   {
+      std::vector<int> order (runs.size());
+      for (int i = 0; i < (int)order.size(); i++)
+         order[i] = i;
+      std::sort(order.begin(), order.end(),
+                [&](int a, int b) { return runs[a].wall < runs[b].wall; });
+      return runs[order[order.size() / 2]];
+   }
+};
+
+// the standard scenes, in the order the suite runs them
+const char *const benchSceneNames[] = { "spheres", "sphere-grid", "mesh", "many-lights" };
+const int benchSceneCount = sizeof(benchSceneNames) / sizeof(benchSceneNames[0]);
+
+/******************************************************************************
+ * BENCH SCENE TEXT - the scene file text of a standard scene, empty for an
+ *    unknown name
+ *    spheres     - the default scene, three shiny spheres on a checkered floor
+ *    sphere-grid - 1024 small spheres in a grid, half of them reflective
+ *    mesh        - a torus of 262144 triangles in one mesh
+ *    many-lights - the default scene lit by 64 lights
+ *****************************************************************************/
+inline std::string benchSceneText(const std::string &name)
+{
+   std::ostringstream text;
+   text << "size 640 480\n"
+        << "color white       1.0  1.0  1.0  0\n"
+        << "color orange      0.94 0.75 0.31 0\n"
+        << "color greenShine  0.5  1.0  0.5  0.3\n"
+        << "color maroonShine 0.5  0.25 0.25 0.3\n"
+        << "color orangeShine 0.94 0.75 0.31 0.3\n"
+        << "color tile        1    1    1    2\n"
+        << "plane 0 1 0 -1 tile\n";
+
+   if (name == "spheres" || name == "many-lights")
+   {
+      text << "camera 3 1.5 -4  0 0 0\n"
+           << "sphere  0     0    0  1     greenShine\n"
+           << "sphere  1.75 -0.25 0  0.75  maroonShine\n"
+           << "sphere -1.75 -0.25 0  0.75  orangeShine\n";
+
+      if (name == "spheres")
+         text << "light -7 10 -10 white\n";
+      else
+      {
+         // a ring of dim lights in four tints, adding up to about one white light
+         text << "color dimRed   0.025  0.0125 0.0125 0\n"
+              << "color dimGreen 0.0125 0.025  0.0125 0\n"
+              << "color dimBlue  0.0125 0.0125 0.025  0\n"
+              << "color dimWhite 0.02   0.02   0.02   0\n";
+         const char *tints[] = { "dimRed", "dimGreen", "dimBlue", "dimWhite" };
+         for (int i = 0; i < 64; i++)
+         {
+            double angle = 2 * M_PI * i / 64;
+            text << "light " << 12 * cos(angle) << " " << 8 + 4 * (i % 3) << " "
+                 << 12 * sin(angle) << " " << tints[i % 4] << "\n";
+         }
+      }
+   }
+   else if (name == "sphere-grid")
+   {
+      text << "camera 0 6 -14  0 -1 4\n";
+      for (int i = 0; i < 32; i++)
+         for (int j = 0; j < 32; j++)
+            text << "sphere " << -7.75 + i * 0.5 << " -0.8 " << j * 0.5 << " 0.2 "
+                 << ((i + j) % 2 ? "orangeShine" : "orange") << "\n";
+      text << "light -7 10 -10 white\n";
+   }
+   else if (name == "mesh")
+   {
+      // a torus lying flat above the floor, counter clockwise seen from outside
+      const int rings = 512, sides = 256;
+      const double R = 2, r = 0.8;
+      text << "camera 3 3 -5  0 0 0\n"
+           << "mesh orangeShine\n";
+      for (int i = 0; i < rings; i++)
+         for (int j = 0; j < sides; j++)
+         {
+            double u = 2 * M_PI * i / rings;
+            double v = 2 * M_PI * j / sides;
+            text << "v " << (R + r * cos(v)) * cos(u) << " " << r * sin(v) << " "
+                 << (R + r * cos(v)) * sin(u) << "\n";
+         }
+      for (int i = 0; i < rings; i++)
+         for (int j = 0; j < sides; j++)
+         {
+            int a = i * sides + j;
+            int b = (i + 1) % rings * sides + j;
+            int c = i * sides + (j + 1) % sides;
+            int d = (i + 1) % rings * sides + (j + 1) % sides;
+            text << "f " << a << " " << c << " " << d << "\n"
+                 << "f " << a << " " << d << " " << b << "\n";
+         }
+      text << "light -7 10 -10 white\n";
+   }
+   else
+      return "";
+
+   return text.str();
+}
+
+/******************************************************************************
+ * JSON STRING - s quoted and escaped for a JSON report
+ *****************************************************************************/
+inline std::string jsonString(const std::string &s)
+{
+   std::string quoted = "\"";
+   for (int i = 0; i < (int)s.size(); i++)
+   {
+      if (s[i] == '"' || s[i] == '\\')
+         quoted += '\\';
+      if ((unsigned char)s[i] < 0x20)
+         quoted += ' ';
+      else
+         quoted += s[i];
+   }
+   return quoted + "\"";
+}
+
+/******************************************************************************
+ * WRITE BENCH JSON - the report of a benchmark suite, one entry per scene
+ *    with every run and the median run
+ *****************************************************************************/
+inline void writeBenchJson(std::ostream &out, const std::vector<BenchScene> &scenes,
+                           int threads, const char *kernels, const char *integrator)
+{
+   out << "{\n"
+       << "  \"version\": " << benchReportVersion << ",\n"
+       << "  \"compiler\": " << jsonString(__VERSION__) << ",\n"
+       << "  \"threads\": " << threads << ",\n"
+       << "  \"kernels\": " << jsonString(kernels) << ",\n"
+       << "  \"integrator\": " << jsonString(integrator) << ",\n"
+       << "  \"scenes\": [\n";
+
+   for (int s = 0; s < (int)scenes.size(); s++)
+   {
+      const BenchScene &scene = scenes[s];
+      out << "    {\n"
+          << "      \"name\": " << jsonString(scene.name) << ",\n"
+          << "      \"objects\": " << scene.objects << ",\n"
+          << "      \"triangles\": " << scene.triangles << ",\n"
+          << "      \"lights\": " << scene.lights << ",\n"
+          << "      \"width\": " << scene.width << ",\n"
+          << "      \"height\": " << scene.height << ",\n"
+          << "      \"runs\": [\n";
+
+      for (int r = 0; r <= (int)scene.runs.size(); r++)
+      {
+         // the median is written last, under its own name
+         bool median = r == (int)scene.runs.size();
+         const BenchRun &run = median ? scene.median() : scene.runs[r];
+         if (median)
+            out << "      ],\n      \"median\": ";
+         else
+            out << "        ";
+
+         out << "{ \"wall\": " << run.wall
+             << ", \"raysPerSecond\": " << run.raysPerSecond()
+             << ", \"rays\": " << run.rays
+             << ", \"samples\": " << run.samples
+             << ", \"phases\": { \"load\": " << run.load
+             << ", \"build\": " << run.build
+             << ", \"trace\": " << run.trace
+             << ", \"shade\": " << run.shade
+             << ", \"write\": " << run.write << " } }";
+
+         if (median)
+            out << "\n";
+         else
+            out << (r + 1 < (int)scene.runs.size() ? ",\n" : "\n");
+      }
+
+      out << "    }" << (s + 1 < (int)scenes.size() ? ",\n" : "\n");
+   }
+
+   out << "  ]\n"
+       << "}\n";
+}
+
+#endif
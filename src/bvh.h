@@ -0,0 +1,812 @@
+/******************************************************************************
+* Header:
+*   BVH
+* Desc:
+*   Contains the BVH class, a bounding volume hierarchy over the scene
+*   objects. Spheres, triangles and every triangle of a mesh are sorted into
+*   a tree of boxes built with the surface area heuristic, planes have no
+*   bounds and are kept in their own list. Replaces testing every ray against
+*   every object.
+******************************************************************************/
+#ifndef BVH_H
+#define BVH_H
+
+/******************************************************************************
+ * TRAVERSAL STATS STRUCT - what the BVH queries cost on one thread
+ *****************************************************************************/
+struct TraversalStats
+{
+   long long rays;         // closest and any hit queries
+   long long nodesVisited; // nodes popped off the traversal stack
+   long long primTests;    // calls to findIntersection
+
+   TraversalStats() : rays(0), nodesVisited(0), primTests(0) {}
+
+   void add(const TraversalStats &s)
+   {
+      rays += s.rays;
+      nodesVisited += s.nodesVisited;
+      primTests += s.primTests;
+   }
+};
+
+// every render thread counts into its own copy, the caller gathers them
+inline TraversalStats &traversalStats()
+{
+   static thread_local TraversalStats stats;
+   return stats;
+}
+
+/******************************************************************************
+ * HIT STRUCT - the nearest intersection of a ray, filled in by closestHit
+ *****************************************************************************/
+struct Hit
+{
+   Real t;         // distance along the ray
+   int index;      // the object's position in the scene's object list
+   int prim;       // the triangle of a mesh, -1 for any other object
+   Object *object; // the object that was hit
+   int material;   // its material, an index into the scene's MaterialTable
+   Vect position;  // point of intersection
+   Vect normal;    // surface normal at that point, computed once per hit
+};
+
+/******************************************************************************
+ * BVH NODE STRUCT - one box of the flattened tree
+ *****************************************************************************/
+struct BVHNode
+{
+   BBox bounds;
+   int offset;      // leaf: first slot in primIndex. interior: the right child
+   int count;       // leaf: objects in primIndex (neither spheres nor triangles)
+   int axis;        // split axis, -1 for leaves. interior: left child is next
+   int sphereStart; // leaf: spheres [sphereStart, +sphereCount) in the SoA
+   int sphereCount; //       padded to a multiple of soaBlock
+   int triStart;    // leaf: triangles [triStart, +triCount) in the SoA
+   int triCount;
+   int meshStart;   // leaf: mesh triangles [meshStart, +meshCount) in the SoA
+   int meshCount;
+};
+
+/******************************************************************************
+ * BVH CLASS - answers closest hit and any hit queries for a scene. Leaves
+ *    keep their spheres, triangles and mesh triangles in SoA arrays tested
+ *    by the SIMD kernels, anything else goes through the virtual
+ *    findIntersection.
+ *****************************************************************************/
+class BVH
+{
+private:
+   static const int maxLeafSize = 8;   // leaves never hold more than this
+   static const int sahBins = 16;      // buckets per axis when splitting
+   static const int maxDepth = 64;     // deepest the tree is allowed to get
+
+   struct BuildPrim
+   {
+      BBox bounds;
+      double centroid[3];
+      int index;
+      int prim;    // triangle of a mesh, -1 for the whole object
+   };
+
+   std::vector<Object*> objects; // scene order, the indices callers get back
+   Column<int> primIndex;        // other bounded objects in leaf order
+   Column<int> unbounded;        // planes, tested on every ray
+   Column<BVHNode> nodes;
+   SphereSoA spheres;
+   TriangleSoA triangles;
+   MeshSoA meshes;
+   const IntersectKernels *kernels;
+   double buildSeconds;
+
+   // cost of a leaf with n objects relative to visiting one more node. the
+   // kernels test a whole block at once
+   static double leafCost(int n) { return (n + soaBlock - 1) / soaBlock; }
+
+   // whether [start, start + count) lies inside [0, size), without overflow
+   static bool inRange(int start, int count, int size)
+   {
+      return start >= 0 && count >= 0 && start <= size && count <= size - start;
+   }
+
+   // the same for a run of whole soaBlock blocks, which the kernels read
+   static bool inBlocks(int start, int count, int size)
+   {
+      return inRange(start, count, size) && start % soaBlock == 0 && count % soaBlock == 0;
+   }
+
+   // whether every column of a SoA is as long as its object column
+   template <class SoA> static bool sameLengths(SoA &soa)
+   {
+      bool same = true;
+      soa.forEachColumn([&](auto &column) { same = same && column.size() == soa.size(); });
+      return same;
+   }
+
+   void makeLeaf(BVHNode &node, std::vector<BuildPrim> &prims, int first, int last)
+   {
+      node.axis = -1;
+      node.offset = primIndex.size();
+      node.sphereStart = spheres.size();
+      node.triStart = triangles.size();
+      node.meshStart = meshes.size();
+
+      for (int i = first; i < last; i++)
+      {
+         Object *object = objects[prims[i].index];
+         if (prims[i].prim != -1)
+            meshes.add(static_cast<TriangleMesh*>(object), prims[i].prim, prims[i].index);
+         else if (Sphere *sphere = dynamic_cast<Sphere*>(object))
+            spheres.add(sphere, prims[i].index);
+         else if (Triangle *triangle = dynamic_cast<Triangle*>(object))
+            triangles.add(triangle, prims[i].index);
+         else
+            primIndex.push_back(prims[i].index);
+      }
+
+      spheres.pad();
+      triangles.pad();
+      meshes.pad();
+      node.count = primIndex.size() - node.offset;
+      node.sphereCount = spheres.size() - node.sphereStart;
+      node.triCount = triangles.size() - node.triStart;
+      node.meshCount = meshes.size() - node.meshStart;
+   }
+
+   // builds the subtree over prims[first, last) and returns its node index
+   int buildNode(std::vector<BuildPrim> &prims, int first, int last, int depth)
+   {
+      int nodeIndex = nodes.size();
+      nodes.push_back(BVHNode());
+
+      BBox bounds, centroids;
+      for (int i = first; i < last; i++)
+      {
+         bounds.expand(prims[i].bounds);
+         centroids.expand(Vect(prims[i].centroid[0], prims[i].centroid[1],
+                               prims[i].centroid[2]));
+      }
+      nodes[nodeIndex].bounds = bounds;
+
+      int n = last - first;
+      int axis = centroids.longestAxis();
+      double extent = centroids.getMax(axis) - centroids.getMin(axis);
+
+      if (n == 1 || extent <= 0 || depth >= maxDepth - 1)
+      {
+         makeLeaf(nodes[nodeIndex], prims, first, last);
+         return nodeIndex;
+      }
+
+      // bin the centroids and sweep for the cheapest split on every axis
+      double bestCost = std::numeric_limits<double>::infinity();
+      int bestAxis = -1, bestBin = 0;
+
+      for (int a = 0; a < 3; a++)
+      {
+         double lo = centroids.getMin(a);
+         double width = centroids.getMax(a) - lo;
+         if (width <= 0)
+            continue;
+
+         BBox binBounds[sahBins];
+         int binCount[sahBins] = {0};
+         for (int i = first; i < last; i++)
+         {
+            int b = (int)(sahBins * (prims[i].centroid[a] - lo) / width);
+            b = std::min(b, sahBins - 1);
+            binCount[b]++;
+            binBounds[b].expand(prims[i].bounds);
+         }
+
+         // areas and counts to the right of every split plane
+         double rightArea[sahBins];
+         int rightCount[sahBins];
+         BBox right;
+         int count = 0;
+         for (int b = sahBins - 1; b > 0; b--)
+         {
+            right.expand(binBounds[b]);
+            count += binCount[b];
+            rightArea[b] = right.surfaceArea();
+            rightCount[b] = count;
+         }
+
+         BBox left;
+         count = 0;
+         for (int b = 1; b < sahBins; b++)
+         {
+            left.expand(binBounds[b - 1]);
+            count += binCount[b - 1];
+            if (count == 0 || rightCount[b] == 0)
+               continue;
+
+            double cost = 1 + (left.surfaceArea() * leafCost(count)
+                             + rightArea[b] * leafCost(rightCount[b]))
+                            / bounds.surfaceArea();
+            if (cost < bestCost)
+            {
+               bestCost = cost;
+               bestAxis = a;
+               bestBin = b;
+            }
+         }
+      }
+
+      if (bestAxis == -1 || (bestCost >= leafCost(n) && n <= maxLeafSize))
+      {
+         makeLeaf(nodes[nodeIndex], prims, first, last);
+         return nodeIndex;
+      }
+
+      double lo = centroids.getMin(bestAxis);
+      double width = centroids.getMax(bestAxis) - lo;
+      BuildPrim *mid = std::partition(&prims[first], &prims[first] + n,
+         [&](const BuildPrim &p)
+         {
+            int b = (int)(sahBins * (p.centroid[bestAxis] - lo) / width);
+            return std::min(b, sahBins - 1) < bestBin;
+         });
+      int split = mid - &prims[0];
+
+      buildNode(prims, first, split, depth + 1);
+      int right = buildNode(prims, split, last, depth + 1);
+
+      nodes[nodeIndex].offset = right;
+      nodes[nodeIndex].count = 0;
+      nodes[nodeIndex].axis = bestAxis;
+      nodes[nodeIndex].sphereCount = 0;
+      nodes[nodeIndex].triCount = 0;
+      nodes[nodeIndex].meshCount = 0;
+      return nodeIndex;
+   }
+
+   void fillHit(const Ray &ray, int index, int prim, Real t, Hit &hit) const
+   {
+      Object *object = objects[index];
+      hit.t = t;
+      hit.index = index;
+      hit.prim = prim;
+      hit.object = object;
+      hit.material = object->getMaterial();
+      hit.position = ray.at(t);
+      if (prim == -1)
+         hit.normal = object->getNormalAt(hit.position);
+      else
+         hit.normal = object->getPrimitiveNormal(hit.position, prim);
+   }
+
+   static void rayArrays(const Ray &ray, Real org[3], Real invDir[3])
+   {
+      const Vect &o = ray.getRayOrigin();
+      const Vect &inv = ray.getRayInvDirection();
+      org[0] = o.getVectX();
+      org[1] = o.getVectY();
+      org[2] = o.getVectZ();
+      invDir[0] = inv.getVectX();
+      invDir[1] = inv.getVectY();
+      invDir[2] = inv.getVectZ();
+   }
+
+public:
+   BVH() : kernels(bestKernels()), buildSeconds(0) {}
+
+   // swap the intersection kernels, e.g. to compare against scalar
+   void setKernels(const IntersectKernels *k) { kernels = k;             }
+   const IntersectKernels *getKernels() const { return kernels;          }
+
+   void build(const std::vector<Object*> &sceneObjects)
+   {
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+      objects = sceneObjects;
+      primIndex.clear();
+      unbounded.clear();
+      nodes.clear();
+      spheres.clear();
+      triangles.clear();
+      meshes.clear();
+
+      std::vector<BuildPrim> prims;
+      for (int i = 0; i < (int)objects.size(); i++)
+      {
+         BuildPrim prim;
+
+         // a mesh goes into the tree one triangle at a time
+         if (TriangleMesh *mesh = dynamic_cast<TriangleMesh*>(objects[i]))
+         {
+            for (int tri = 0; tri < mesh->getTriangleCount(); tri++)
+            {
+               mesh->getTriangleBounds(tri, prim.bounds);
+               prim.bounds.pad(1e-5);
+               for (int a = 0; a < 3; a++)
+                  prim.centroid[a] = prim.bounds.getCenter(a);
+               prim.index = i;
+               prim.prim = tri;
+               prims.push_back(prim);
+            }
+            continue;
+         }
+
+         if (!objects[i]->getBounds(prim.bounds))
+         {
+            unbounded.push_back(i);
+            continue;
+         }
+
+         // intersections are nudged by a small bias, keep them in the box
+         prim.bounds.pad(1e-5);
+         for (int a = 0; a < 3; a++)
+            prim.centroid[a] = prim.bounds.getCenter(a);
+         prim.index = i;
+         prim.prim = -1;
+         prims.push_back(prim);
+      }
+
+      if (!prims.empty())
+         buildNode(prims, 0, prims.size(), 0);
+
+      std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      buildSeconds = elapsed.count();
+   }
+
+   // calls f on every array of the built tree, always in the same order.
+   // the scene cache saves them and later borrows them back
+   template <class F> void forEachColumn(F f)
+   {
+      f(nodes);
+      f(primIndex);
+      f(unbounded);
+      spheres.forEachColumn(f);
+      triangles.forEachColumn(f);
+      meshes.forEachColumn(f);
+   }
+
+   // use a tree restored by forEachColumn instead of building one. the
+   // objects must be in the order the tree was built over
+   void attach(const std::vector<Object*> &sceneObjects)
+   {
+      objects = sceneObjects;
+      buildSeconds = 0;
+   }
+
+   // whether a tree restored by forEachColumn can be attached to
+   // sceneObjects: every node, slot and scene index in range, every object
+   // in the array its kind goes to and no path deeper than the traversal
+   // stacks hold
+   bool isConsistent(const std::vector<Object*> &sceneObjects)
+   {
+      int nObjects = sceneObjects.size();
+      bool ok = sameLengths(spheres) && sameLengths(triangles) && sameLengths(meshes);
+
+      for (int i = 0; ok && i < primIndex.size(); i++)
+         ok = primIndex[i] >= 0 && primIndex[i] < nObjects &&
+              !dynamic_cast<TriangleMesh*>(sceneObjects[primIndex[i]]);
+      for (int i = 0; ok && i < unbounded.size(); i++)
+         ok = unbounded[i] >= 0 && unbounded[i] < nObjects &&
+              !dynamic_cast<TriangleMesh*>(sceneObjects[unbounded[i]]);
+      for (int i = 0; ok && i < spheres.size(); i++)
+         ok = spheres.object[i] == -1 ||
+              (spheres.object[i] >= 0 && spheres.object[i] < nObjects &&
+               dynamic_cast<Sphere*>(sceneObjects[spheres.object[i]]));
+      for (int i = 0; ok && i < triangles.size(); i++)
+         ok = triangles.object[i] == -1 ||
+              (triangles.object[i] >= 0 && triangles.object[i] < nObjects &&
+               dynamic_cast<Triangle*>(sceneObjects[triangles.object[i]]));
+      for (int i = 0; ok && i < meshes.size(); i++)
+      {
+         int index = meshes.object[i];
+         TriangleMesh *mesh = index >= 0 && index < nObjects ?
+                              dynamic_cast<TriangleMesh*>(sceneObjects[index]) : NULL;
+         ok = (index == -1 && meshes.prim[i] == -1) ||
+              (mesh && meshes.prim[i] >= 0 && meshes.prim[i] < mesh->getTriangleCount());
+      }
+
+      // walk the tree as traversal would. a right child past its parent
+      // rules out cycles
+      std::vector<std::pair<int, int> > pending; // node, depth
+      if (!nodes.empty())
+         pending.push_back(std::make_pair(0, 0));
+      while (ok && !pending.empty())
+      {
+         int i = pending.back().first, depth = pending.back().second;
+         pending.pop_back();
+         const BVHNode &node = nodes[i];
+         if (depth >= maxDepth)
+            ok = false;
+         else if (node.axis == -1)
+            ok = inRange(node.offset, node.count, primIndex.size()) &&
+                 inBlocks(node.sphereStart, node.sphereCount, spheres.size()) &&
+                 inBlocks(node.triStart, node.triCount, triangles.size()) &&
+                 inBlocks(node.meshStart, node.meshCount, meshes.size());
+         else if (node.axis >= 0 && node.axis < 3 && i + 1 < node.offset &&
+                  node.offset < nodes.size())
+         {
+            pending.push_back(std::make_pair(i + 1, depth + 1));
+            pending.push_back(std::make_pair(node.offset, depth + 1));
+         }
+         else
+            ok = false;
+      }
+      return ok;
+   }
+
+   // point this tree at other's arrays without copying them, e.g. to
+   // trace a shared scene. other must outlive it
+   void borrow(const BVH &other)
+   {
+      // other's columns are only read
+      std::vector<std::pair<const void*, int> > arrays;
+      const_cast<BVH &>(other).forEachColumn([&](auto &column)
+      {
+         arrays.push_back(std::make_pair((const void *)column.data(), column.size()));
+      });
+      int next = 0;
+      forEachColumn([&](auto &column)
+      {
+         column.borrow((decltype(column.data()))arrays[next].first, arrays[next].second);
+         next++;
+      });
+      objects = other.objects;
+      kernels = other.kernels;
+      buildSeconds = 0;
+   }
+
+   int getNodeCount()       const { return nodes.size();     }
+   int getBoundedCount()    const
+   {
+      int count = primIndex.size();
+      for (int i = 0; i < spheres.size(); i++)
+         count += (spheres.object[i] != -1);
+      for (int i = 0; i < triangles.size(); i++)
+         count += (triangles.object[i] != -1);
+      for (int i = 0; i < meshes.size(); i++)
+         count += (meshes.object[i] != -1);
+      return count;
+   }
+   int getUnboundedCount()  const { return unbounded.size(); }
+   double getBuildSeconds() const { return buildSeconds;     }
+
+   // finds the object with the smallest positive intersection in a single
+   // pass. returns false when the ray missed everything, otherwise fills hit
+   bool closestHit(const Ray &ray, Hit &hit) const
+   {
+      TraversalStats &stats = traversalStats();
+      stats.rays++;
+
+      int iWinObj = -1;
+      int iWinPrim = -1;
+      Real tBest = std::numeric_limits<Real>::infinity();
+
+      for (int i = 0; i < unbounded.size(); i++)
+      {
+         Real tObj = objects[unbounded[i]]->findIntersection(ray);
+         stats.primTests++;
+         PROFILE(profileCounters().tests[otherTest]++);
+         if (tObj > 0 && tObj < tBest)
+         {
+            tBest = tObj;
+            iWinObj = unbounded[i];
+         }
+      }
+
+      if (!nodes.empty())
+      {
+         Real org[3], invDir[3];
+         rayArrays(ray, org, invDir);
+         SoARay soaRay (ray);
+
+         int stack[2 * maxDepth];
+         int top = 0;
+         stack[top++] = 0;
+
+         while (top > 0)
+         {
+            const BVHNode &node = nodes[stack[--top]];
+            stats.nodesVisited++;
+
+            if (!node.bounds.intersect(org, invDir, tBest))
+               continue;
+
+            if (node.axis < 0)
+            {
+               int slot = -1;
+               if (node.sphereCount > 0)
+               {
+                  kernels->sphereClosest(soaRay, spheres, node.sphereStart,
+                                         node.sphereCount, tBest, slot);
+                  if (slot != -1)
+                  {
+                     iWinObj = spheres.object[slot];
+                     iWinPrim = -1;
+                  }
+               }
+
+               slot = -1;
+               if (node.triCount > 0)
+               {
+                  kernels->triangleClosest(soaRay, triangles, node.triStart,
+                                           node.triCount, tBest, slot);
+                  if (slot != -1)
+                  {
+                     iWinObj = triangles.object[slot];
+                     iWinPrim = -1;
+                  }
+               }
+
+               slot = -1;
+               if (node.meshCount > 0)
+               {
+                  kernels->meshClosest(soaRay, meshes, node.meshStart,
+                                       node.meshCount, tBest, slot);
+                  if (slot != -1)
+                  {
+                     iWinObj = meshes.object[slot];
+                     iWinPrim = meshes.prim[slot];
+                  }
+               }
+               stats.primTests += node.sphereCount + node.triCount + node.meshCount
+                                + node.count;
+               PROFILE(profileLeafTests(node.sphereCount, node.triCount, node.meshCount,
+                                        node.count));
+
+               for (int i = node.offset; i < node.offset + node.count; i++)
+               {
+                  Real tObj = objects[primIndex[i]]->findIntersection(ray);
+                  if (tObj > 0 && tObj < tBest)
+                  {
+                     tBest = tObj;
+                     iWinObj = primIndex[i];
+                     iWinPrim = -1;
+                  }
+               }
+            }
+            else
+            {
+               // push the far child first so the near one is visited first
+               int left = &node - &nodes[0] + 1;
+               if (invDir[node.axis] < 0)
+               {
+                  stack[top++] = left;
+                  stack[top++] = node.offset;
+               }
+               else
+               {
+                  stack[top++] = node.offset;
+                  stack[top++] = left;
+               }
+            }
+         }
+      }
+
+      if (iWinObj == -1)
+         return false;
+
+      fillHit(ray, iWinObj, iWinPrim, tBest, hit);
+      return true;
+   }
+
+   // closestHit for every ray of a packet in one walk of the tree. found[r]
+   // tells whether hits[r] was filled. gives the same hits as closestHit
+   void closestHitPacket(RayPacket &packet, Hit hits[], bool found[]) const
+   {
+      TraversalStats &stats = traversalStats();
+      stats.rays += packet.count;
+
+      Real tBest[maxPacketRays];
+      int iWinObj[maxPacketRays];
+      int iWinPrim[maxPacketRays];
+
+      for (int r = 0; r < packet.count; r++)
+      {
+         tBest[r] = std::numeric_limits<Real>::infinity();
+         iWinObj[r] = -1;
+         iWinPrim[r] = -1;
+
+         for (int i = 0; i < unbounded.size(); i++)
+         {
+            Real tObj = objects[unbounded[i]]->findIntersection(packet.rays[r]);
+            stats.primTests++;
+            PROFILE(profileCounters().tests[otherTest]++);
+            if (tObj > 0 && tObj < tBest[r])
+            {
+               tBest[r] = tObj;
+               iWinObj[r] = unbounded[i];
+            }
+         }
+      }
+
+      // farthest any ray can still hit something, refreshed after leaves
+      Real tMax = std::numeric_limits<Real>::infinity();
+      bool tMaxStale = !unbounded.empty();
+
+      // every entry carries the first ray known to still hit the parent
+      int stack[2 * maxDepth], stackFirst[2 * maxDepth];
+      int top = 0;
+      if (!nodes.empty())
+      {
+         stack[top] = 0;
+         stackFirst[top++] = 0;
+      }
+
+      while (top > 0)
+      {
+         top--;
+         const BVHNode &node = nodes[stack[top]];
+         int first = stackFirst[top];
+         stats.nodesVisited++;
+
+         if (tMaxStale)
+         {
+            tMax = 0;
+            for (int r = 0; r < packet.count; r++)
+               tMax = std::max(tMax, tBest[r]);
+            tMaxStale = false;
+         }
+
+         // one test culls the box for the whole packet
+         if (packet.frustumMiss(node.bounds, tMax))
+            continue;
+
+         // otherwise find the first ray that really enters the box
+         while (first < packet.count &&
+                !node.bounds.intersect(packet.org, packet.invDir[first], tBest[first]))
+            first++;
+         if (first == packet.count)
+            continue;
+
+         if (node.axis < 0)
+         {
+            tMaxStale = true;
+            for (int r = first; r < packet.count; r++)
+            {
+               if (!node.bounds.intersect(packet.org, packet.invDir[r], tBest[r]))
+                  continue;
+
+               int slot = -1;
+               if (node.sphereCount > 0)
+               {
+                  kernels->sphereClosest(packet.soaRays[r], spheres, node.sphereStart,
+                                         node.sphereCount, tBest[r], slot);
+                  if (slot != -1)
+                  {
+                     iWinObj[r] = spheres.object[slot];
+                     iWinPrim[r] = -1;
+                  }
+               }
+
+               slot = -1;
+               if (node.triCount > 0)
+               {
+                  kernels->triangleClosest(packet.soaRays[r], triangles, node.triStart,
+                                           node.triCount, tBest[r], slot);
+                  if (slot != -1)
+                  {
+                     iWinObj[r] = triangles.object[slot];
+                     iWinPrim[r] = -1;
+                  }
+               }
+
+               slot = -1;
+               if (node.meshCount > 0)
+               {
+                  kernels->meshClosest(packet.soaRays[r], meshes, node.meshStart,
+                                       node.meshCount, tBest[r], slot);
+                  if (slot != -1)
+                  {
+                     iWinObj[r] = meshes.object[slot];
+                     iWinPrim[r] = meshes.prim[slot];
+                  }
+               }
+               stats.primTests += node.sphereCount + node.triCount + node.meshCount
+                                + node.count;
+               PROFILE(profileLeafTests(node.sphereCount, node.triCount, node.meshCount,
+                                        node.count));
+
+               for (int i = node.offset; i < node.offset + node.count; i++)
+               {
+                  Real tObj = objects[primIndex[i]]->findIntersection(packet.rays[r]);
+                  if (tObj > 0 && tObj < tBest[r])
+                  {
+                     tBest[r] = tObj;
+                     iWinObj[r] = primIndex[i];
+                     iWinPrim[r] = -1;
+                  }
+               }
+            }
+         }
+         else
+         {
+            // near child first, judged by the first active ray
+            int left = &node - &nodes[0] + 1;
+            bool leftFirst = packet.invDir[first][node.axis] >= 0;
+            stack[top] = leftFirst ? node.offset : left;
+            stackFirst[top++] = first;
+            stack[top] = leftFirst ? left : node.offset;
+            stackFirst[top++] = first;
+         }
+      }
+
+      for (int r = 0; r < packet.count; r++)
+      {
+         found[r] = (iWinObj[r] != -1);
+         if (found[r])
+            fillHit(packet.rays[r], iWinObj[r], iWinPrim[r], tBest[r], hits[r]);
+      }
+   }
+
+   // true as soon as any object is hit in (tMin, tMax]
+   bool anyHit(const Ray &ray, Real tMin, Real tMax) const
+   {
+      TraversalStats &stats = traversalStats();
+      stats.rays++;
+
+      for (int i = 0; i < unbounded.size(); i++)
+      {
+         Real tObj = objects[unbounded[i]]->findIntersection(ray);
+         stats.primTests++;
+         PROFILE(profileCounters().tests[otherTest]++);
+         if (tObj > tMin && tObj <= tMax)
+            return true;
+      }
+
+      if (nodes.empty())
+         return false;
+
+      Real org[3], invDir[3];
+      rayArrays(ray, org, invDir);
+      SoARay soaRay (ray);
+
+      int stack[2 * maxDepth];
+      int top = 0;
+      stack[top++] = 0;
+
+      while (top > 0)
+      {
+         const BVHNode &node = nodes[stack[--top]];
+         stats.nodesVisited++;
+
+         if (!node.bounds.intersect(org, invDir, tMax))
+            continue;
+
+         if (node.axis < 0)
+         {
+            stats.primTests += node.sphereCount + node.triCount + node.meshCount
+                             + node.count;
+            PROFILE(profileLeafTests(node.sphereCount, node.triCount, node.meshCount,
+                                     node.count));
+
+            if (node.sphereCount > 0 &&
+                kernels->sphereAny(soaRay, spheres, node.sphereStart,
+                                   node.sphereCount, tMin, tMax))
+               return true;
+
+            if (node.triCount > 0 &&
+                kernels->triangleAny(soaRay, triangles, node.triStart,
+                                     node.triCount, tMin, tMax))
+               return true;
+
+            if (node.meshCount > 0 &&
+                kernels->meshAny(soaRay, meshes, node.meshStart,
+                                 node.meshCount, tMin, tMax))
+               return true;
+
+            for (int i = node.offset; i < node.offset + node.count; i++)
+            {
+               Real tObj = objects[primIndex[i]]->findIntersection(ray);
+               if (tObj > tMin && tObj <= tMax)
+                  return true;
+            }
+         }
+         else
+         {
+            stack[top++] = node.offset;
+            stack[top++] = &node - &nodes[0] + 1;
+         }
+      }
+
+      return false;
+   }
+};
+
+#endif
@@ -0,0 +1,388 @@
+/******************************************************************************
+* Header:
+*   Cache
+* Desc:
+*   The binary scene cache. After a scene file has been parsed and its BVH
+*   built, everything needed to render it is written out as flat arrays:
+*   the settings, camera, lights, one record per object, the materials, the
+*   mesh arrays and every array of the BVH. Later runs map the cache into memory and point
+*   the BVH and meshes straight at it, so there is nothing to parse or
+*   build. The header holds a format version and a hash of the scene text;
+*   a cache that does not match is ignored and rewritten.
+*
+*   Layout: a CacheHeader, a CacheSection table, then the sections, each
+*   starting on a 64 byte boundary.
+******************************************************************************/
+#ifndef CACHE_H
+#define CACHE_H
+
+// bump whenever the layout of anything written to the cache changes
+const unsigned int sceneCacheVersion = 2;
+
+/******************************************************************************
+ * CACHE HEADER STRUCT - the start of every cache file
+ *****************************************************************************/
+struct CacheHeader
+{
+   char magic[8];           // "RTSCENE"
+   unsigned int version;    // sceneCacheVersion
+   unsigned int sections;   // entries in the section table that follows
+   unsigned long long hash; // sceneHash of the text the cache was made from
+};
+
+/******************************************************************************
+ * CACHE SECTION STRUCT - where one array lives in the file
+ *****************************************************************************/
+struct CacheSection
+{
+   unsigned long long offset;
+   unsigned long long bytes;
+};
+
+/******************************************************************************
+ * CACHED OBJECT STRUCT - one scene object. first and count index the
+ *    parameter array, meshes keep their data in sections of their own
+ *****************************************************************************/
+struct CachedObject
+{
+   enum { sphere, plane, triangle, mesh };
+
+   int type;
+   int first;
+   int count;
+   int material; // index into the materials section
+};
+
+/******************************************************************************
+ * CACHED LIGHT STRUCT - one point light
+ *****************************************************************************/
+struct CachedLight
+{
+   Vect position;
+   Color color;
+};
+
+/******************************************************************************
+ * SCENE HASH - FNV-1a over the scene text, salted with the sizes of
+ *    everything the cache stores raw so another build never reads it
+ *****************************************************************************/
+inline unsigned long long sceneHash(const char *text, size_t length)
+{
+   size_t sizes[] = { sizeof(Vect), sizeof(Color), sizeof(Material), sizeof(Camera),
+                      sizeof(RenderSettings), sizeof(BBox), sizeof(BVHNode), (size_t)soaBlock };
+
+   unsigned long long hash = 14695981039346656037ull;
+   const unsigned char *salt = (const unsigned char *)sizes;
+   for (size_t i = 0; i < sizeof(sizes); i++)
+      hash = (hash ^ salt[i]) * 1099511628211ull;
+   for (size_t i = 0; i < length; i++)
+      hash = (hash ^ (unsigned char)text[i]) * 1099511628211ull;
+   return hash;
+}
+
+/******************************************************************************
+ * CACHE WRITER CLASS - collects arrays and writes them as one cache file
+ *****************************************************************************/
+class CacheWriter
+{
+private:
+   std::vector<const void*> data;
+   std::vector<size_t> bytes;
+
+   static size_t align(size_t offset) { return (offset + 63) / 64 * 64; }
+
+public:
+   // the memory must stay valid until write
+   template <class T> void add(const T *p, int n)
+   {
+      data.push_back(p);
+      bytes.push_back(sizeof(T) * n);
+   }
+
+   template <class T> void add(const Column<T> &column)
+   {
+      add(column.data(), column.size());
+   }
+
+   // writes to a temporary file that is renamed over path, so a reader
+   // never sees half a cache
+   bool write(const std::string &path, unsigned long long hash)
+   {
+      CacheHeader header;
+      memset(&header, 0, sizeof(header));
+      memcpy(header.magic, "RTSCENE", 8);
+      header.version = sceneCacheVersion;
+      header.sections = data.size();
+      header.hash = hash;
+
+      std::vector<CacheSection> table (data.size());
+      size_t offset = align(sizeof(header) + sizeof(CacheSection) * table.size());
+      for (int i = 0; i < (int)table.size(); i++)
+      {
+         table[i].offset = offset;
+         table[i].bytes = bytes[i];
+         offset = align(offset + bytes[i]);
+      }
+
+      std::string temp = path + ".tmp";
+      FILE *file = fopen(temp.c_str(), "wb");
+      if (file == NULL)
+         return false;
+
+      static const char zeros[64] = {0};
+      bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                (table.empty() ||
+                 fwrite(&table[0], sizeof(CacheSection), table.size(), file) == table.size());
+      size_t at = sizeof(header) + sizeof(CacheSection) * table.size();
+
+      for (int i = 0; ok && i < (int)table.size(); i++)
+      {
+         ok = fwrite(zeros, 1, table[i].offset - at, file) == table[i].offset - at &&
+              (bytes[i] == 0 || fwrite(data[i], 1, bytes[i], file) == bytes[i]);
+         at = table[i].offset + bytes[i];
+      }
+
+      if (fclose(file) != 0)
+         ok = false;
+      if (ok && rename(temp.c_str(), path.c_str()) == 0)
+         return true;
+
+      remove(temp.c_str());
+      return false;
+   }
+};
+
+/******************************************************************************
+ * CACHE READER CLASS - hands out the sections of a mapped cache in order
+ *****************************************************************************/
+class CacheReader
+{
+private:
+   const char *base;
+   size_t length;
+   const CacheSection *table;
+   int sections;
+   int next;
+
+public:
+   CacheReader() : base(NULL), length(0), table(NULL), sections(0), next(0) {}
+
+   // false if the mapping is not a cache of this version made from hash
+   bool open(const MappedFile &file, unsigned long long hash)
+   {
+      base = file.data();
+      length = file.size();
+      next = 0;
+
+      if (length < sizeof(CacheHeader))
+         return false;
+
+      const CacheHeader *header = (const CacheHeader *)base;
+      if (memcmp(header->magic, "RTSCENE", 8) != 0 ||
+          header->version != sceneCacheVersion || header->hash != hash)
+         return false;
+
+      sections = header->sections;
+      table = (const CacheSection *)(base + sizeof(CacheHeader));
+      if (sizeof(CacheHeader) + sizeof(CacheSection) * (size_t)sections > length)
+         return false;
+
+      for (int i = 0; i < sections; i++)
+         if (table[i].offset % 64 != 0 || table[i].offset > length ||
+             table[i].bytes > length - table[i].offset)
+            return false;
+      return true;
+   }
+
+   // the next section as n values of T. false if it does not fit
+   template <class T> bool take(const T *&p, int &n)
+   {
+      if (next >= sections || table[next].bytes % sizeof(T) != 0)
+         return false;
+      p = (const T *)(base + table[next].offset);
+      n = table[next].bytes / sizeof(T);
+      next++;
+      return true;
+   }
+
+   template <class T> bool take(Column<T> &column)
+   {
+      const T *p;
+      int n;
+      if (!take(p, n))
+         return false;
+      column.borrow(p, n);
+      return true;
+   }
+
+   bool finished() const { return next == sections; }
+};
+
+/******************************************************************************
+ * SAVE SCENE CACHE - writes a built scene to path. false if the scene holds
+ *    something the cache can not store or the file could not be written
+ *****************************************************************************/
+inline bool saveSceneCache(const std::string &path, unsigned long long hash, Scene &scene)
+{
+   const std::vector<Object*> &objects = scene.getObjects();
+   const std::vector<Source*> &sources = scene.getLights();
+
+   std::vector<CachedLight> lights;
+   for (int i = 0; i < (int)sources.size(); i++)
+   {
+      Light *light = dynamic_cast<Light*>(sources[i]);
+      if (light == NULL)
+         return false;
+
+      CachedLight cached;
+      cached.position = light->getLightPosition();
+      cached.color = light->getLightColor();
+      lights.push_back(cached);
+   }
+
+   std::vector<CachedObject> records;
+   std::vector<double> params;
+   std::vector<TriangleMesh*> meshes;
+   for (int i = 0; i < (int)objects.size(); i++)
+   {
+      CachedObject record;
+      record.first = params.size();
+      record.material = objects[i]->getMaterial();
+
+      if (Sphere *sphere = dynamic_cast<Sphere*>(objects[i]))
+      {
+         Vect c = sphere->getSphereCenter();
+         double values[] = { c.getVectX(), c.getVectY(), c.getVectZ(),
+                             sphere->getSphereRadius() };
+         params.insert(params.end(), values, values + 4);
+         record.type = CachedObject::sphere;
+      }
+      else if (Plane *plane = dynamic_cast<Plane*>(objects[i]))
+      {
+         Vect n = plane->getPlaneNormal();
+         double values[] = { n.getVectX(), n.getVectY(), n.getVectZ(),
+                             plane->getPlaneDistance() };
+         params.insert(params.end(), values, values + 4);
+         record.type = CachedObject::plane;
+      }
+      else if (Triangle *triangle = dynamic_cast<Triangle*>(objects[i]))
+      {
+         Vect corners[] = { triangle->getTriangleA(), triangle->getTriangleB(),
+                            triangle->getTriangleC() };
+         for (int k = 0; k < 3; k++)
+         {
+            params.push_back(corners[k].getVectX());
+            params.push_back(corners[k].getVectY());
+            params.push_back(corners[k].getVectZ());
+         }
+         record.type = CachedObject::triangle;
+      }
+      else if (TriangleMesh *mesh = dynamic_cast<TriangleMesh*>(objects[i]))
+      {
+         meshes.push_back(mesh);
+         record.type = CachedObject::mesh;
+      }
+      else
+         return false;
+
+      record.count = params.size() - record.first;
+      records.push_back(record);
+   }
+
+   RenderSettings settings = scene.getSettings();
+   Camera camera = scene.getCamera();
+
+   CacheWriter writer;
+   writer.add(&settings, 1);
+   writer.add(&camera, 1);
+   writer.add(lights.empty() ? NULL : &lights[0], lights.size());
+   writer.add(records.empty() ? NULL : &records[0], records.size());
+   writer.add(params.empty() ? NULL : &params[0], params.size());
+   writer.add(scene.getMaterials().data(), scene.getMaterials().size());
+   scene.getBVH().forEachColumn([&](auto &column) { writer.add(column); });
+   for (int i = 0; i < (int)meshes.size(); i++)
+      meshes[i]->forEachColumn([&](auto &column) { writer.add(column); });
+
+   return writer.write(path, hash);
+}
+
+/******************************************************************************
+ * LOAD SCENE CACHE - fills an empty scene from the cache at path, in
+ *    directory if given, BVH included. false, with the scene left empty,
+ *    if there is no usable cache made from the text with this hash
+ *****************************************************************************/
+inline bool loadSceneCache(const std::string &path, unsigned long long hash, Scene &scene,
+                           int directory = AT_FDCWD)
+{
+   MappedFile &storage = scene.getStorage();
+   CacheReader reader;
+   if (!storage.open(path.c_str(), directory) || !reader.open(storage, hash))
+   {
+      storage.close();
+      return false;
+   }
+
+   const RenderSettings *settings = NULL;
+   const Camera *camera = NULL;
+   const CachedLight *lights = NULL;
+   const CachedObject *records = NULL;
+   const double *params = NULL;
+   const Material *materials = NULL;
+   int nSettings = 0, nCameras = 0, nLights = 0, nRecords = 0, nParams = 0, nMaterials = 0;
+
+   bool ok = reader.take(settings, nSettings) && nSettings == 1 && settings->isValid() &&
+             reader.take(camera, nCameras) && nCameras == 1 &&
+             reader.take(lights, nLights) &&
+             reader.take(records, nRecords) &&
+             reader.take(params, nParams) &&
+             reader.take(materials, nMaterials) && nMaterials > 0;
+
+   if (ok)
+   {
+      scene.getSettings() = *settings;
+      scene.setCamera(*camera);
+      scene.setMaterials(materials, nMaterials);
+      for (int i = 0; i < nLights; i++)
+         scene.addLight(new Light(lights[i].position, lights[i].color));
+
+      scene.getBVH().forEachColumn([&](auto &column) { ok = ok && reader.take(column); });
+   }
+
+   for (int i = 0; ok && i < nRecords; i++)
+   {
+      const CachedObject &record = records[i];
+      const double *p = params + record.first;
+      if (record.first < 0 || record.count < 0 || record.count > nParams - record.first ||
+          record.material < 0 || record.material >= nMaterials)
+         ok = false;
+      else if (record.type == CachedObject::sphere && record.count == 4)
+         scene.addObject(new Sphere(Vect(p[0], p[1], p[2]), p[3], record.material));
+      else if (record.type == CachedObject::plane && record.count == 4)
+         scene.addObject(new Plane(Vect(p[0], p[1], p[2]), p[3], record.material));
+      else if (record.type == CachedObject::triangle && record.count == 9)
+         scene.addObject(new Triangle(Vect(p[0], p[1], p[2]), Vect(p[3], p[4], p[5]),
+                                      Vect(p[6], p[7], p[8]), record.material));
+      else if (record.type == CachedObject::mesh)
+      {
+         TriangleMesh *mesh = new TriangleMesh(record.material);
+         scene.addObject(mesh);
+         mesh->forEachColumn([&](auto &column) { ok = ok && reader.take(column); });
+         ok = ok && mesh->isConsistent();
+      }
+      else
+         ok = false;
+   }
+
+   // a tree that does not fit the objects would index out of its arrays
+   if (!ok || !reader.finished() || !scene.getBVH().isConsistent(scene.getObjects()))
+   {
+      std::cerr << path << ": damaged scene cache, rebuilding it" << std::endl;
+      scene.clear();
+      return false;
+   }
+
+   scene.getBVH().attach(scene.getObjects());
+   return true;
+}
+
+#endif
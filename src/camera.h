@@ -22,10 +22,35 @@ public:
    Camera (Vect pos, Vect dir, Vect right, Vect down)
       : camPos(pos), camDir(dir), camRight(right), camDown(down) {} // secondary const
 
-   Vect getCameraPosition()  { return camPos;   }
-   Vect getCameraDirection() { return camDir;   }
-   Vect getCamRight()        { return camRight; }
-   Vect getCamDown()         { return camDown;  }
+   // a camera at pos looking at focus, with +y up
+   static Camera lookAt(const Vect &pos, const Vect &focus)
+   {
+      Vect Y (0,1,0);
+      Vect camdir = (focus - pos).normalize();
+      Vect camright = Y.crossProduct(camdir).normalize();
+      Vect camdown = camright.crossProduct(camdir);
+      return Camera (pos, camdir, camright, camdown);
+   }
+
+   // whether lookAt can aim a camera from pos at focus. it can not when
+   // the two are the same point or the view is straight up or down, as +y
+   // then gives no right vector and the basis comes out NaN
+   static bool canLookAt(const Vect &pos, const Vect &focus)
+   {
+      Camera camera = lookAt(pos, focus);
+      const Vect *basis[4] = { &camera.camPos, &camera.camDir, &camera.camRight,
+                               &camera.camDown };
+      for (int i = 0; i < 4; i++)
+         if (!std::isfinite(basis[i]->getVectX()) || !std::isfinite(basis[i]->getVectY()) ||
+             !std::isfinite(basis[i]->getVectZ()))
+            return false;
+      return true;
+   }
+
+   const Vect &getCameraPosition() const  { return camPos;   }
+   const Vect &getCameraDirection() const { return camDir;   }
+   const Vect &getCamRight() const        { return camRight; }
+   const Vect &getCamDown() const         { return camDown;  }
 };
 
 #endif
@@ -0,0 +1,1056 @@
+/******************************************************************************
+* Header:
+*   Cluster
+* Desc:
+*   The transport of a distributed render and of the render server. A
+*   coordinator process listens on a Unix socket or a TCP port and worker
+*   processes connect to it; a render server listens the same way for
+*   clients submitting jobs. They talk in framed messages: a MessageHeader
+*   giving the type and length, then the body. Bodies are plain structs, so
+*   both ends must be the same build on the same kind of machine. The hello
+*   a worker opens with and every job carry the protocol version and a
+*   build salt to check that, and the hello also carries the run token the
+*   coordinator was started with. renderDistributed is the coordinator and
+*   runWorker the worker.
+******************************************************************************/
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+// bump whenever a message changes
+const unsigned int clusterProtocolVersion = 3;
+
+// the longest message body a connection takes unless told otherwise, room
+// for any hello, tile, job, result or stats message
+const size_t messageLimit = 65536;
+
+// bytes in a run token, the secret a worker must know to join a render
+const int tokenBytes = 16;
+
+// where a spawned worker finds the token, as hex
+const char *const tokenVariable = "RAYTRACER_TOKEN";
+
+// the messages of a distributed render and of the render server
+enum MessageType
+{
+   helloMessage = 1, // worker: a HelloBody
+   sceneMessage,     // coordinator: a SceneBody, then a path or the scene cache
+   tileMessage,      // coordinator: a TileBody, render this tile
+   pixelsMessage,    // worker: a PixelsBody, then the tile's channels as floats
+   doneMessage,      // coordinator: the frame is finished, exit
+   jobMessage,       // client: a JobBody, then the scene and output files
+   resultMessage,    // server: a ResultBody, then why the job failed if it did
+   statsMessage      // client: empty. server: the server's metrics as text
+};
+
+/******************************************************************************
+ * MESSAGE HEADER STRUCT - starts every message
+ *****************************************************************************/
+struct MessageHeader
+{
+   unsigned int type;
+   unsigned int reserved;
+   unsigned long long bytes; // length of the body that follows
+};
+
+/******************************************************************************
+ * HELLO BODY STRUCT - the first thing a worker sends
+ *****************************************************************************/
+struct HelloBody
+{
+   unsigned int version;     // clusterProtocolVersion
+   int pid;
+   unsigned long long build; // sceneHash of nothing, differs between builds
+   unsigned char token[tokenBytes]; // the coordinator's run token
+};
+
+/******************************************************************************
+ * SCENE BODY STRUCT - what a worker renders. followed by the path of the
+ *    compiled scene when shared, otherwise by the scene cache itself
+ *****************************************************************************/
+struct SceneBody
+{
+   unsigned long long hash; // the scene cache's hash
+   int shared;              // 1 if a path follows
+   int channels;            // FrameBuffer channels to send back
+   int tileSize;            // no tile is larger
+};
+
+/******************************************************************************
+ * TILE BODY STRUCT - one tile to render
+ *****************************************************************************/
+struct TileBody
+{
+   int id;
+   Tile tile;
+};
+
+/******************************************************************************
+ * PIXELS BODY STRUCT - a rendered tile. followed by its colors and then each
+ *    extra channel, every channel in scanline order
+ *****************************************************************************/
+struct PixelsBody
+{
+   int id;
+   int values;        // floats that follow
+   long long samples; // camera samples traced
+   double seconds;    // time spent rendering the tile
+};
+
+/******************************************************************************
+ * JOB BODY STRUCT - a frame for the render server to render. followed by
+ *    the scene file, empty for the built in scene, a 0 and the image file
+ *****************************************************************************/
+struct JobBody
+{
+   unsigned int version;     // clusterProtocolVersion
+   unsigned long long build; // sceneHash of nothing
+   int width, height;        // 0 keeps the scene's size
+   int aadepth;              // 0 keeps the scene's
+   int camera;               // 1 to look from position at focus
+   double position[3];
+   double focus[3];
+   int format;               // ImageFormat of the image
+   int aovs;                 // FrameBuffer channels written next to it
+};
+
+/******************************************************************************
+ * JOB TIMES STRUCT - where a render job's time went, in seconds
+ *****************************************************************************/
+struct JobTimes
+{
+   double queue;  // waiting for a render slot
+   double load;   // reading the scene, and building it unless it was kept
+   double render;
+   double write;
+   double total;  // from the job arriving to its reply
+};
+
+/******************************************************************************
+ * RESULT BODY STRUCT - how a job went
+ *****************************************************************************/
+struct ResultBody
+{
+   int ok;
+   int warm;          // 1 if the scene was already loaded
+   long long samples; // camera samples traced
+   JobTimes times;
+};
+
+/******************************************************************************
+ * MESSAGE STRUCT - a message as received
+ *****************************************************************************/
+struct Message
+{
+   unsigned int type;
+   std::vector<char> body;
+
+   // splits the body into a T and what follows it. NULL if it is too short
+   template <class T> const char *split(T &head, size_t &tailBytes) const
+   {
+      if (body.size() < sizeof(T))
+         return NULL;
+      memcpy(&head, body.data(), sizeof(T));
+      tailBytes = body.size() - sizeof(T);
+      return body.data() + sizeof(T);
+   }
+};
+
+/******************************************************************************
+ * CONNECTION CLASS - one end of a stream socket carrying messages
+ *****************************************************************************/
+class Connection
+{
+private:
+   // a queued message. the header and body are copied, the tail is not
+   struct Outgoing
+   {
+      std::vector<char> head;
+      const char *tail;
+      size_t tailBytes;
+      size_t sent; // of head, then of tail
+   };
+
+   int fd;
+   std::vector<char> inbox; // bytes received but not yet taken
+   size_t taken;            // of those, the ones already handed out
+   size_t limit;            // the longest body the peer may send
+   bool tooLong;            // it announced a longer one
+   std::deque<Outgoing> outbox; // queued messages, the first maybe partly sent
+
+   bool sendAll(const void *data, size_t bytes)
+   {
+      const char *p = (const char *)data;
+      while (bytes > 0)
+      {
+         ssize_t sent = ::send(fd, p, bytes, MSG_NOSIGNAL);
+         if (sent < 0 && errno == EINTR)
+            continue;
+         if (sent <= 0)
+            return false;
+         p += sent;
+         bytes -= sent;
+      }
+      return true;
+   }
+
+public:
+   Connection() : fd(-1), taken(0), limit(messageLimit), tooLong(false) {}
+   explicit Connection(int socket, size_t maxBytes = messageLimit)
+      : fd(socket), taken(0), limit(maxBytes), tooLong(false) {}
+   ~Connection() { close(); }
+
+   // a socket has one owner, it is closed exactly once
+   Connection(const Connection &) = delete;
+   Connection &operator = (const Connection &) = delete;
+
+   void close()
+   {
+      if (fd >= 0)
+         ::close(fd);
+      fd = -1;
+      inbox.clear();
+      taken = 0;
+      outbox.clear();
+   }
+
+   int getSocket() const { return fd; }
+
+   // the peer announced a message longer than the limit, so its connection
+   // is of no more use
+   bool isTooLong() const { return tooLong; }
+
+   // sends a body and an optional tail as one message. false if the peer
+   // is gone
+   bool send(unsigned int type, const void *body, size_t bytes,
+             const void *tail = NULL, size_t tailBytes = 0)
+   {
+      MessageHeader header;
+      header.type = type;
+      header.reserved = 0;
+      header.bytes = bytes + tailBytes;
+      return sendAll(&header, sizeof(header)) && sendAll(body, bytes) &&
+             sendAll(tail, tailBytes);
+   }
+
+   // queues a message for flush, for a caller that must not wait on a
+   // slow peer. the tail is not copied and must stay valid until it is sent
+   void queue(unsigned int type, const void *body, size_t bytes,
+              const void *tail = NULL, size_t tailBytes = 0)
+   {
+      MessageHeader header;
+      header.type = type;
+      header.reserved = 0;
+      header.bytes = bytes + tailBytes;
+
+      outbox.emplace_back();
+      Outgoing &out = outbox.back();
+      out.head.assign((const char *)&header, (const char *)&header + sizeof(header));
+      out.head.insert(out.head.end(), (const char *)body, (const char *)body + bytes);
+      out.tail = (const char *)tail;
+      out.tailBytes = tailBytes;
+      out.sent = 0;
+   }
+
+   bool hasQueued() const { return !outbox.empty(); }
+
+   // sends as much of the queue as the socket takes without waiting and
+   // adds the bytes that went to sent. false if the peer is gone
+   bool flush(size_t &sent)
+   {
+      while (!outbox.empty())
+      {
+         Outgoing &out = outbox.front();
+         bool inHead = out.sent < out.head.size();
+         const char *data = inHead ? &out.head[out.sent] : out.tail + (out.sent - out.head.size());
+         size_t bytes = inHead ? out.head.size() - out.sent
+                               : out.head.size() + out.tailBytes - out.sent;
+         ssize_t n = ::send(fd, data, bytes, MSG_NOSIGNAL | MSG_DONTWAIT);
+         if (n < 0 && errno == EINTR)
+            continue;
+         if (n <= 0)
+            return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+         out.sent += n;
+         sent += n;
+         if (out.sent == out.head.size() + out.tailBytes)
+            outbox.pop_front();
+      }
+      return true;
+   }
+
+   // reads whatever has arrived, first waiting for something if wait is
+   // set. false once the peer has closed the connection, it failed or the
+   // peer announced a message longer than the limit
+   bool receive(bool wait)
+   {
+      MessageHeader header;
+      if (inbox.size() - taken >= sizeof(header))
+      {
+         memcpy(&header, &inbox[taken], sizeof(header));
+         tooLong = header.bytes > limit;
+      }
+      if (tooLong)
+         return false;
+
+      char buffer[65536];
+      ssize_t n = recv(fd, buffer, sizeof(buffer), wait ? 0 : MSG_DONTWAIT);
+      if (n > 0)
+      {
+         inbox.insert(inbox.end(), buffer, buffer + n);
+         return true;
+      }
+      return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+   }
+
+   // takes the next whole message out of what has arrived. false if none
+   // is complete yet
+   bool next(Message &message)
+   {
+      MessageHeader header;
+      if (inbox.size() - taken < sizeof(header))
+         return false;
+      memcpy(&header, &inbox[taken], sizeof(header));
+      if (header.bytes > limit || inbox.size() - taken - sizeof(header) < header.bytes)
+         return false;
+
+      std::vector<char>::iterator body = inbox.begin() + taken + sizeof(header);
+      message.type = header.type;
+      message.body.assign(body, body + header.bytes);
+      taken += sizeof(header) + header.bytes;
+
+      // drop what has been handed out once it is most of the inbox
+      if (taken * 2 >= inbox.size())
+      {
+         inbox.erase(inbox.begin(), inbox.begin() + taken);
+         taken = 0;
+      }
+      return true;
+   }
+
+   // waits for the next message. false if the connection closed first
+   bool wait(Message &message)
+   {
+      while (!next(message))
+         if (!receive(true))
+            return false;
+      return true;
+   }
+};
+
+/******************************************************************************
+ * RUN TOKEN - a random secret for one distributed render. The coordinator
+ *    makes one unless given --token and turns away any worker whose hello
+ *    does not carry it, so only workers it spawned or that were told the
+ *    token can take tiles and see the scene. it travels as hex text
+ *****************************************************************************/
+inline bool randomToken(unsigned char token[tokenBytes])
+{
+   int fd = open("/dev/urandom", O_RDONLY);
+   bool ok = fd >= 0 && read(fd, token, tokenBytes) == tokenBytes;
+   if (fd >= 0)
+      close(fd);
+   return ok;
+}
+
+inline std::string tokenText(const unsigned char token[tokenBytes])
+{
+   const char digits[] = "0123456789abcdef";
+   std::string text;
+   for (int i = 0; i < tokenBytes; i++)
+   {
+      text += digits[token[i] >> 4];
+      text += digits[token[i] & 15];
+   }
+   return text;
+}
+
+// false unless text is tokenBytes bytes in hex
+inline bool parseToken(const std::string &text, unsigned char token[tokenBytes])
+{
+   if ((int)text.size() != 2 * tokenBytes)
+      return false;
+   for (int i = 0; i < 2 * tokenBytes; i++)
+   {
+      int c = tolower(text[i]);
+      int digit = c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1;
+      if (digit < 0)
+         return false;
+      token[i / 2] = i % 2 ? token[i / 2] | digit : digit << 4;
+   }
+   return true;
+}
+
+// compares every byte, so the time taken does not give away where the
+// first wrong one is
+inline bool sameToken(const unsigned char a[tokenBytes], const unsigned char b[tokenBytes])
+{
+   unsigned char difference = 0;
+   for (int i = 0; i < tokenBytes; i++)
+      difference |= a[i] ^ b[i];
+   return difference == 0;
+}
+
+/******************************************************************************
+ * OPEN SOCKET - a socket listening on address, or connected to it. the
+ *    address is unix:PATH for a Unix socket or HOST:PORT for TCP. an empty
+ *    HOST is 127.0.0.1, so only local processes can reach it; 0.0.0.0 or
+ *    :: listen on every interface. only a coordinator
+ *    listens on TCP, for workers on other machines; the render server
+ *    takes a Unix socket alone. -1, with errno set, on failure
+ *****************************************************************************/
+inline int openSocket(const std::string &address, bool listening)
+{
+   // binds or connects fd, closing it on failure
+   auto attach = [listening](int fd, const sockaddr *where, socklen_t length)
+   {
+      bool ok = listening ? bind(fd, where, length) == 0 && listen(fd, 64) == 0
+                          : connect(fd, where, length) == 0;
+      if (!ok)
+      {
+         int error = errno;
+         ::close(fd);
+         errno = error;
+      }
+      return ok ? fd : -1;
+   };
+
+   if (address.compare(0, 5, "unix:") == 0)
+   {
+      std::string path = address.substr(5);
+      sockaddr_un where;
+      memset(&where, 0, sizeof(where));
+      where.sun_family = AF_UNIX;
+      if (path.empty() || path.size() >= sizeof(where.sun_path))
+      {
+         errno = ENAMETOOLONG;
+         return -1;
+      }
+      memcpy(where.sun_path, path.c_str(), path.size());
+
+      // a socket left behind by an earlier coordinator would block bind
+      struct stat info;
+      if (listening && stat(path.c_str(), &info) == 0 && S_ISSOCK(info.st_mode))
+         unlink(path.c_str());
+
+      int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      return fd < 0 ? -1 : attach(fd, (const sockaddr *)&where, sizeof(where));
+   }
+
+   size_t colon = address.rfind(':');
+   if (colon == std::string::npos)
+   {
+      errno = EINVAL;
+      return -1;
+   }
+   std::string host = address.substr(0, colon);
+   std::string port = address.substr(colon + 1);
+
+   addrinfo hints;
+   memset(&hints, 0, sizeof(hints));
+   hints.ai_family = AF_UNSPEC;
+   hints.ai_socktype = SOCK_STREAM;
+   addrinfo *found;
+   if (getaddrinfo(host.empty() ? "127.0.0.1" : host.c_str(), port.c_str(), &hints, &found) != 0)
+   {
+      errno = EINVAL;
+      return -1;
+   }
+
+   int fd = -1;
+   for (addrinfo *a = found; a != NULL && fd < 0; a = a->ai_next)
+   {
+      fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+      if (fd < 0)
+         continue;
+
+      // tiles are small messages that should not wait for more to send
+      int on = 1;
+      setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+      fd = attach(fd, a->ai_addr, a->ai_addrlen);
+   }
+   freeaddrinfo(found);
+   return fd;
+}
+
+// a socket connected to address, trying again for up to seconds while
+// nothing listens there yet. -1, with errno set, on failure
+inline int connectSocket(const std::string &address, double seconds)
+{
+   int fd = openSocket(address, false);
+   for (int attempt = 0; fd < 0 && attempt < seconds * 10; attempt++)
+   {
+      std::this_thread::sleep_for(std::chrono::milliseconds(100));
+      fd = openSocket(address, false);
+   }
+   return fd;
+}
+
+// tiles a worker is sent ahead, so it has the next one as it sends a result
+const int tilesInFlight = 2;
+
+// seconds a worker has from connecting to saying hello
+const double helloTimeout = 10;
+
+/******************************************************************************
+ * REMOTE WORKER STRUCT - a worker process connected to the coordinator
+ *****************************************************************************/
+struct RemoteWorker
+{
+   Connection connection;
+   int number;          // in the order workers joined, from 1
+   int pid;
+   bool ready;             // has said hello and been queued the scene
+   std::vector<int> tiles; // the tiles it is rendering
+   double joined;          // seconds into the render it connected
+   double lastHeard;       // seconds into the render it last sent or took something
+   int tilesRendered;
+   double busySeconds;
+
+   RemoteWorker(int socket, size_t limit, int n, double now)
+      : connection(socket, limit), number(n), pid(0), ready(false), joined(now)
+      , lastHeard(now), tilesRendered(0), busySeconds(0) {}
+};
+
+/******************************************************************************
+ * SPAWN WORKER - starts a local worker process for the coordinator at
+ *    address, handing it the run token in its environment rather than on
+ *    its command line, where any user could read it. returns its pid, or
+ *    -1 if it could not
+ *****************************************************************************/
+inline pid_t spawnWorker(const std::string &address, const Options &options,
+                         const std::string &token)
+{
+   // built before forking, the child only calls exec
+   std::vector<const char*> args = { "raytracer", "--worker", address.c_str() };
+   if (!options.kernels.empty())
+   {
+      args.push_back("--kernels");
+      args.push_back(options.kernels.c_str());
+   }
+   args.push_back(NULL);
+
+   std::string variable = std::string(tokenVariable) + "=" + token;
+   std::vector<const char*> env;
+   for (char **e = environ; *e != NULL; e++)
+      if (strncmp(*e, variable.c_str(), strlen(tokenVariable) + 1) != 0)
+         env.push_back(*e);
+   env.push_back(variable.c_str());
+   env.push_back(NULL);
+
+   pid_t pid = fork();
+   if (pid == 0)
+   {
+      execve("/proc/self/exe", (char * const *)&args[0], (char * const *)&env[0]);
+      _exit(127);
+   }
+   return pid;
+}
+
+/******************************************************************************
+ * RENDER DISTRIBUTED - renders the frame as the coordinator of worker
+ *    processes and writes it like renderFrame. The scene is compiled into
+ *    a scene cache, which every worker that connects is sent, or only its
+ *    path with options.sharedScene. Tiles are handed out tilesInFlight at
+ *    a time per worker and gathered into a band of tile rows; the next
+ *    band is handed out while one finishes, so workers do not wait at band
+ *    boundaries. The tiles of a worker that disconnects, or stays silent
+ *    for options.workerTimeout seconds, go back to the front of the queue.
+ *    A worker must open with a hello carrying the run token, options.token
+ *    or a random one passed to the spawned workers, within helloTimeout
+ *    seconds. Everything a worker is sent is queued and goes out as its
+ *    socket takes it, so one slow reader never stalls the others
+ *****************************************************************************/
+inline bool renderDistributed(Scene &scene, const Options &options)
+{
+   const RenderSettings &settings = scene.getSettings();
+   int x0, y0, x1, y1;
+   settings.region(x0, y0, x1, y1);
+   int channels = FrameBuffer::colorChannel | options.aovs;
+
+   // compile the scene. a scene that is sent is read back into memory and
+   // its file removed at once
+   bool shared = !options.sharedScene.empty();
+   std::string compiled = options.sharedScene;
+   if (!shared)
+   {
+      char temp[] = "/tmp/raytracer-scene-XXXXXX";
+      int fd = mkstemp(temp);
+      if (fd < 0)
+      {
+         std::cerr << "could not create a file for the compiled scene: " << strerror(errno)
+                   << std::endl;
+         return false;
+      }
+      close(fd);
+      compiled = temp;
+   }
+   unsigned long long hash = sceneHash(NULL, 0);
+   MappedFile sceneData;
+   bool compiledOk = saveSceneCache(compiled, hash, scene) &&
+                     (shared || sceneData.open(compiled.c_str()));
+   if (!shared)
+      remove(compiled.c_str());
+   if (!compiledOk)
+   {
+      std::cerr << "could not compile the scene to " << compiled << std::endl;
+      return false;
+   }
+
+   unsigned char token[tokenBytes];
+   if (options.token.empty() ? !randomToken(token) : !parseToken(options.token, token))
+   {
+      std::cerr << "could not make a run token" << std::endl;
+      return false;
+   }
+
+   int socket = openSocket(options.coordinator, true);
+   if (socket < 0)
+   {
+      std::cerr << "could not listen on " << options.coordinator << ": " << strerror(errno)
+                << std::endl;
+      return false;
+   }
+   Connection listener (socket);
+   std::cout << "coordinator listening on " << options.coordinator << ", the compiled scene is ";
+   if (shared)
+      std::cout << "shared at " << compiled << std::endl;
+   else
+      std::cout << "sent to each worker (" << sceneData.size() / 1024 << " KB)" << std::endl;
+   if (options.token.empty())
+      std::cout << "other workers join with --token " << tokenText(token) << std::endl;
+
+   std::vector<pid_t> spawned;
+   for (int i = 0; i < options.spawn; i++)
+   {
+      pid_t pid = spawnWorker(options.coordinator, options, tokenText(token));
+      if (pid > 0)
+         spawned.push_back(pid);
+   }
+
+   // a band holds eight tiles per spawned worker, and at least 64
+   int tilesPerRow = (x1 - x0 + options.tileSize - 1) / options.tileSize;
+   int bandTileRows = (8 * std::max(options.spawn, 8) + tilesPerRow - 1) / tilesPerRow;
+   int bandHeight = std::min(bandTileRows * options.tileSize, y1 - y0);
+   int bandCount = (y1 - y0 + bandHeight - 1) / bandHeight;
+
+   std::vector<Tile> tiles = makeTiles(x0, y0, x1, y1, options.tileSize);
+   std::vector<int> bandLeft (bandCount, 0); // tiles of each band still to come back
+   std::deque<int> pending;                  // tiles not handed out, by index
+   for (int i = 0; i < (int)tiles.size(); i++)
+   {
+      bandLeft[(tiles[i].y0 - y0) / bandHeight]++;
+      pending.push_back(i);
+   }
+
+   // band b is gathered in buffers[b % 2]
+   FrameBuffer buffers[2];
+   auto startBand = [&](int band)
+   {
+      int bandY0 = y0 + band * bandHeight;
+      buffers[band % 2].reset(x0, bandY0, x1, std::min(bandY0 + bandHeight, y1),
+                              options.tileSize, channels);
+   };
+   for (int band = 0; band < std::min(bandCount, 2); band++)
+      startBand(band);
+
+   BandWriter writer;
+   if (!writer.open(options.output.c_str(), options.format, x1 - x0, y1 - y0, settings.dpi,
+                    options.aovs, bandHeight))
+      return false;
+
+   // the longest message a worker sends is a tile with every channel
+   size_t pixelsLimit = sizeof(PixelsBody) +
+                        sizeof(float) * 8 * options.tileSize * options.tileSize;
+
+   std::list<RemoteWorker> workers;
+   int joined = 0, reissued = 0, written = 0;
+   long long samples = 0;
+   double writeSeconds = 0, lastConnected = 0;
+   bool ok = true;
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+   // a worker's message. NULL if it was fine, otherwise why the worker is
+   // dropped
+   auto handle = [&](RemoteWorker &worker, const Message &message) -> const char *
+   {
+      const char *broken = "broke the protocol";
+      size_t tailBytes;
+      if (message.type == helloMessage && !worker.ready)
+      {
+         HelloBody hello;
+         if (message.split(hello, tailBytes) == NULL)
+            return broken;
+         worker.pid = hello.pid;
+         if (hello.version != clusterProtocolVersion || hello.build != hash)
+            return "is another build";
+         if (!sameToken(hello.token, token))
+            return "gave the wrong token";
+
+         SceneBody body;
+         body.hash = hash;
+         body.shared = shared;
+         body.channels = channels;
+         body.tileSize = options.tileSize;
+         if (shared)
+            worker.connection.queue(sceneMessage, &body, sizeof(body), compiled.c_str(),
+                                    compiled.size());
+         else
+            worker.connection.queue(sceneMessage, &body, sizeof(body), sceneData.data(),
+                                    sceneData.size());
+         worker.ready = true;
+         return (const char *)NULL;
+      }
+
+      PixelsBody pixels;
+      const float *values = NULL;
+      if (message.type == pixelsMessage)
+         values = (const float *)message.split(pixels, tailBytes);
+      if (values == NULL)
+         return broken;
+      std::vector<int>::iterator mine = std::find(worker.tiles.begin(), worker.tiles.end(), pixels.id);
+      if (mine == worker.tiles.end())
+         return broken;
+
+      const Tile &tile = tiles[pixels.id];
+      size_t expected = 0;
+      for (int c = FrameBuffer::colorChannel; c <= FrameBuffer::idChannel; c <<= 1)
+         if (channels & c)
+            expected += (size_t)(tile.x1 - tile.x0) * (tile.y1 - tile.y0) *
+                        FrameBuffer::channelWidth((FrameBuffer::Channel)c);
+      if ((size_t)pixels.values != expected || tailBytes != expected * sizeof(float))
+         return broken;
+
+      // channels come in the order of their bits, each in scanline order
+      int band = (tile.y0 - y0) / bandHeight;
+      for (int c = FrameBuffer::colorChannel; c <= FrameBuffer::idChannel; c <<= 1)
+         if (channels & c)
+            for (int y = tile.y0; y < tile.y1; y++)
+            {
+               buffers[band % 2].setChannelRow((FrameBuffer::Channel)c, y, tile.x0, tile.x1, values);
+               values += (tile.x1 - tile.x0) * FrameBuffer::channelWidth((FrameBuffer::Channel)c);
+            }
+
+      worker.tiles.erase(mine);
+      worker.tilesRendered++;
+      worker.busySeconds += pixels.seconds;
+      samples += pixels.samples;
+      bandLeft[band]--;
+      return (const char *)NULL;
+   };
+
+   // disconnects a worker and puts its tiles back at the front of the queue
+   auto drop = [&](std::list<RemoteWorker>::iterator worker, const char *why)
+   {
+      std::cout << "worker " << worker->number;
+      if (worker->ready)
+         std::cout << " (pid " << worker->pid << ")";
+      std::cout << " " << why << ", " << worker->tilesRendered << " tiles rendered";
+      if (!worker->tiles.empty())
+         std::cout << ", re-issuing " << worker->tiles.size();
+      std::cout << std::endl;
+      pending.insert(pending.begin(), worker->tiles.begin(), worker->tiles.end());
+      reissued += worker->tiles.size();
+      return workers.erase(worker);
+   };
+
+   while (written < bandCount)
+   {
+      double now = secondsSince(start);
+
+      // hand out tiles, at most one band past the one being gathered
+      for (RemoteWorker &worker : workers)
+         while (worker.ready && worker.tiles.size() < tilesInFlight && !pending.empty() &&
+                (tiles[pending.front()].y0 - y0) / bandHeight < written + 2)
+         {
+            TileBody body;
+            body.id = pending.front();
+            body.tile = tiles[body.id];
+            worker.connection.queue(tileMessage, &body, sizeof(body));
+            if (worker.tiles.empty())
+               worker.lastHeard = now; // the timeout runs while it has work
+            worker.tiles.push_back(body.id);
+            pending.pop_front();
+         }
+
+      std::vector<pollfd> polled (1 + workers.size());
+      polled[0].fd = listener.getSocket();
+      int i = 1;
+      polled[0].events = POLLIN;
+      for (RemoteWorker &worker : workers)
+      {
+         polled[i].fd = worker.connection.getSocket();
+         polled[i++].events = POLLIN | (worker.connection.hasQueued() ? POLLOUT : 0);
+      }
+      if (poll(&polled[0], polled.size(), 100) < 0 && errno != EINTR)
+      {
+         std::cerr << "poll failed: " << strerror(errno) << std::endl;
+         ok = false;
+         break;
+      }
+      now = secondsSince(start);
+
+      i = 1;
+      for (std::list<RemoteWorker>::iterator worker = workers.begin(); worker != workers.end(); i++)
+      {
+         const char *why = NULL;
+         size_t sent = 0;
+         if ((polled[i].revents & POLLOUT) && !worker->connection.flush(sent))
+            why = "disconnected";
+         if (sent > 0)
+            worker->lastHeard = now;
+         if (why == NULL && (polled[i].revents & ~POLLOUT) != 0)
+         {
+            worker->lastHeard = now;
+            Message message;
+            if (!worker->connection.receive(false))
+               why = worker->connection.isTooLong() ? "broke the protocol" : "disconnected";
+            while (why == NULL && worker->connection.next(message))
+               why = handle(*worker, message);
+         }
+         if (why == NULL && !worker->ready && now - worker->joined > helloTimeout)
+            why = "never said hello";
+         if (why == NULL && !worker->tiles.empty() && now - worker->lastHeard > options.workerTimeout)
+            why = "stopped answering";
+         worker = why != NULL ? drop(worker, why) : std::next(worker);
+      }
+
+      if (polled[0].revents & POLLIN)
+      {
+         int fd = accept(listener.getSocket(), NULL, NULL);
+         if (fd >= 0)
+            workers.emplace_back(fd, pixelsLimit, ++joined, now);
+      }
+
+      // write out finished bands in order, reusing their buffers
+      while (written < bandCount && bandLeft[written] == 0)
+      {
+         std::chrono::steady_clock::time_point writeStart = std::chrono::steady_clock::now();
+         int bandY0 = y0 + written * bandHeight;
+         if (!writer.write(buffers[written % 2], bandY0, std::min(bandY0 + bandHeight, y1)))
+         {
+            ok = false;
+            break;
+         }
+         if (written + 2 < bandCount)
+            startBand(written + 2);
+         written++;
+         writeSeconds += secondsSince(writeStart);
+      }
+      if (!ok)
+         break;
+
+      // only a worker that has said hello counts, a silent connection does not
+      // keep the render waiting
+      if (std::any_of(workers.begin(), workers.end(),
+                      [](const RemoteWorker &worker) { return worker.ready; }))
+         lastConnected = now;
+      else if (now - lastConnected > options.workerTimeout)
+      {
+         std::cerr << "no worker joined for " << options.workerTimeout << " seconds"
+                   << std::endl;
+         ok = false;
+         break;
+      }
+   }
+   double renderSeconds = secondsSince(start);
+
+   if (ok)
+   {
+      std::cout << tiles.size() << " tiles on " << joined << " workers in " << renderSeconds
+                << " seconds (wall), " << reissued << " re-issued" << std::endl;
+      for (RemoteWorker &worker : workers)
+      {
+         // a worker that does not take this at once is stopped by the close
+         size_t sent = 0;
+         worker.connection.queue(doneMessage, NULL, 0);
+         worker.connection.flush(sent);
+         std::cout << "   worker " << worker.number << " (pid " << worker.pid << "): "
+                   << worker.busySeconds << " s busy, " << worker.tilesRendered << " tiles"
+                   << std::endl;
+      }
+   }
+
+   // closing the sockets stops any worker still running
+   workers.clear();
+   listener.close();
+   if (options.coordinator.compare(0, 5, "unix:") == 0)
+      unlink(options.coordinator.c_str() + 5);
+   for (int i = 0; i < (int)spawned.size(); i++)
+      waitpid(spawned[i], NULL, 0);
+
+   if (!ok || !writer.close())
+      return false;
+
+   std::cout << "image written to " << options.output << " (" << x1 - x0 << "x" << y1 - y0
+             << ") in " << bandCount << " bands of " << bandHeight << " rows, "
+             << writeSeconds * 1000 << " ms" << std::endl;
+   std::cout << (double)samples / ((x1 - x0) * (y1 - y0))
+             << " samples per pixel (adaptive, up to " << (1 << (2 * aaRefineDepth(settings.aadepth)))
+             << ", threshold " << settings.aathreshold << ")" << std::endl;
+   return true;
+}
+
+/******************************************************************************
+ * RUN WORKER - renders tiles for the coordinator at options.worker until it
+ *    says the frame is done. The run token comes from options.token, or
+ *    from the environment when the coordinator spawned this worker. The
+ *    scene comes as a compiled scene cache, which is written to a
+ *    temporary file to be mapped, or as the path of one on a shared
+ *    filesystem
+ *****************************************************************************/
+inline bool runWorker(const Options &options, const IntersectKernels *kernels)
+{
+   HelloBody hello;
+   const char *variable = getenv(tokenVariable);
+   std::string token = !options.token.empty() ? options.token : variable ? variable : "";
+   if (!parseToken(token, hello.token))
+   {
+      std::cerr << "worker " << getpid() << ": needs the coordinator's run token, with --token"
+                << std::endl;
+      return false;
+   }
+
+   // the coordinator may not be listening yet, it gets ten seconds
+   int socket = connectSocket(options.worker, 10);
+   if (socket < 0)
+   {
+      std::cerr << "could not connect to " << options.worker << ": " << strerror(errno)
+                << std::endl;
+      return false;
+   }
+   // the scene is sent whole, so the limit is the largest scene allowed
+   Connection coordinator (socket, (size_t)options.sceneMegabytes << 20);
+
+   hello.version = clusterProtocolVersion;
+   hello.pid = getpid();
+   hello.build = sceneHash(NULL, 0);
+
+   Message message;
+   SceneBody body;
+   size_t tailBytes = 0;
+   const char *tail = NULL;
+   if (coordinator.send(helloMessage, &hello, sizeof(hello)) && coordinator.wait(message) &&
+       message.type == sceneMessage)
+      tail = message.split(body, tailBytes);
+   if (tail == NULL)
+   {
+      std::cerr << "worker " << getpid() << ": the coordinator sent no scene, it may be "
+                << "another build or run, or the scene is over --scene-mb" << std::endl;
+      return false;
+   }
+   int known = FrameBuffer::colorChannel | FrameBuffer::depthChannel |
+               FrameBuffer::normalChannel | FrameBuffer::idChannel;
+   if (body.tileSize < 1 || body.tileSize > maxImageSize || (body.channels & ~known) != 0 ||
+       (body.channels & FrameBuffer::colorChannel) == 0)
+   {
+      std::cerr << "worker " << getpid() << ": the coordinator sent a broken scene" << std::endl;
+      return false;
+   }
+
+   std::string path (tail, tailBytes);
+   if (!body.shared)
+   {
+      char temp[] = "/tmp/raytracer-worker-XXXXXX";
+      int fd = mkstemp(temp);
+      FILE *file = fd < 0 ? NULL : fdopen(fd, "wb");
+      bool saved = file != NULL && fwrite(tail, 1, tailBytes, file) == tailBytes;
+      if (file != NULL && fclose(file) != 0)
+         saved = false;
+      path = temp;
+      if (!saved)
+      {
+         std::cerr << "worker " << getpid() << ": could not write the scene to " << path
+                   << std::endl;
+         remove(path.c_str());
+         return false;
+      }
+   }
+
+   // the mapping keeps a sent scene's file until the worker exits. the
+   // loader checks its structure, so a broken one is refused here
+   Scene scene;
+   bool loaded = loadSceneCache(path, body.hash, scene);
+   if (!body.shared)
+      remove(path.c_str());
+   std::vector<char>().swap(message.body);
+   if (!loaded)
+   {
+      std::cerr << "worker " << getpid() << ": could not load the scene from " << path << std::endl;
+      return false;
+   }
+   if (kernels != NULL)
+      scene.getBVH().setKernels(kernels);
+
+   const RenderSettings &settings = scene.getSettings();
+   PROFILE(profileImage().reset(settings.width, settings.height));
+
+   // scratch space for one tile at a time, sized up front. no tile is
+   // larger than the frame
+   FrameBuffer pixels;
+   std::vector<Color> firstPass;
+   Wavefront wave;
+   std::vector<float> values;
+   int tileWidth = std::min(body.tileSize, settings.width);
+   int tileHeight = std::min(body.tileSize, settings.height);
+   firstPass.reserve((tileWidth + 2) * (tileHeight + 2));
+   if (settings.wavefront)
+      wave.reserve((tileWidth + 2) * (tileHeight + 2));
+   values.reserve(8 * tileWidth * tileHeight);
+
+   int rendered = 0;
+   while (coordinator.wait(message))
+   {
+      if (message.type == doneMessage)
+         return true;
+
+      TileBody job;
+      if (message.type != tileMessage || message.split(job, tailBytes) == NULL)
+         break;
+      const Tile &tile = job.tile;
+      if (tile.x0 < 0 || tile.y0 < 0 || tile.x1 > settings.width || tile.y1 > settings.height ||
+          tile.x1 <= tile.x0 || tile.y1 <= tile.y0 ||
+          tile.x1 - tile.x0 > body.tileSize || tile.y1 - tile.y0 > body.tileSize)
+         break;
+
+      if (options.exitAfter > 0 && rendered == options.exitAfter)
+      {
+         std::cerr << "worker " << getpid() << ": exiting after " << rendered << " tiles as asked"
+                   << std::endl;
+         _exit(1);
+      }
+
+      std::chrono::steady_clock::time_point tileStart = std::chrono::steady_clock::now();
+      pixels.reset(tile.x0, tile.y0, tile.x1, tile.y1, std::max(tileWidth, tileHeight),
+                   body.channels);
+
+      PixelsBody result;
+      result.id = job.id;
+      result.samples = renderTile(scene, tile, pixels, firstPass, wave, NULL);
+      traversalStats() = TraversalStats();
+
+      values.clear();
+      for (int c = FrameBuffer::colorChannel; c <= FrameBuffer::idChannel; c <<= 1)
+         if (body.channels & c)
+         {
+            int rowValues = (tile.x1 - tile.x0) * FrameBuffer::channelWidth((FrameBuffer::Channel)c);
+            for (int y = tile.y0; y < tile.y1; y++)
+            {
+               values.resize(values.size() + rowValues);
+               pixels.channelRow((FrameBuffer::Channel)c, y, &values[values.size() - rowValues]);
+            }
+         }
+      result.values = values.size();
+      result.seconds = secondsSince(tileStart);
+
+      if (!coordinator.send(pixelsMessage, &result, sizeof(result), &values[0],
+                            values.size() * sizeof(float)))
+         break;
+      rendered++;
+   }
+
+   std::cerr << "worker " << getpid() << ": lost the coordinator after " << rendered << " tiles"
+             << std::endl;
+   return false;
+}
+
+#endif
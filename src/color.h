@@ -3,7 +3,7 @@
 *   Color
 * Desc:
 *   Contains the Color class and its funcitons. Used to store and manipulate
-*   the colors of every pixel.
+*   the colors of every pixel. How a surface shades is up to its Material.
 ******************************************************************************/
 #ifndef COLOR_H
 #define COLOR_H
@@ -14,54 +14,48 @@
 class Color
 {
 private:
-   double red, green, blue, special;
+   Real red, green, blue;
 
 public:
-   Color() : red(0.5), green(0.5), blue(0.5), special(0) {} // default const
-   Color(double r, double g, double b, double s) 
-                 : red(r), green(g), blue(b), special(s) {} // secondary const
+   Color() : red(0.5), green(0.5), blue(0.5) {}                // default const
+   Color(Real r, Real g, Real b) : red(r), green(g), blue(b) {} // secondary const
 
-   double getColorRed()     { return red;     }
-   double getColorGreen()   { return green;   }
-   double getColorBlue()    { return blue;    }
-   double getColorSpecial() { return special; }
+   Real getColorRed()     { return red;     }
+   Real getColorGreen()   { return green;   }
+   Real getColorBlue()    { return blue;    }
 
-   double setColorRed(double redValue)         { red = redValue;         }
-   double setColorGreen(double greenValue)     { green = greenValue;     }
-   double setColorBlue(double blueValue)       { blue = blueValue;       }
-   double setColorSpecial(double specialValue) { special = specialValue; }
+   void setColorRed(Real redValue)         { red = redValue;         }
+   void setColorGreen(Real greenValue)     { green = greenValue;     }
+   void setColorBlue(Real blueValue)       { blue = blueValue;       }
 
-   double brightness() { return (red + green + blue) / 3; }
-   Color colorScalar(double s) { return Color (red*s, green*s, blue*s, special); }
+   Real brightness() { return (red + green + blue) / 3; }
+   Color colorScalar(Real s) { return Color (red*s, green*s, blue*s); }
 
    Color colorAdd(Color color)
    {
       return Color ( red   + color.getColorRed()
                    , green + color.getColorGreen()
-                   , blue  + color.getColorBlue()
-                   , special);
+                   , blue  + color.getColorBlue() );
    }
 
    Color colorMultiply(Color color)
    {
       return Color ( red   * color.getColorRed()
                    , green * color.getColorGreen()
-                   , blue  * color.getColorBlue()
-                   , special);
+                   , blue  * color.getColorBlue() );
    }
 
    Color colorAverage(Color color)
    {
       return Color ( (red   + color.getColorRed()) / 2
                    , (green + color.getColorGreen()) / 2
-                   , (blue  + color.getColorBlue()) / 2
-                   , special);
+                   , (blue  + color.getColorBlue()) / 2 );
    }
 
    Color clip()
    {
-      double allLight = red + green + blue;
-      double excessLight = allLight - 3;
+      Real allLight = red + green + blue;
+      Real excessLight = allLight - 3;
       if (excessLight > 0)
       {
          red += excessLight * (red / allLight);
@@ -75,7 +69,7 @@ public:
       if (green < 0) { green = 0; }
       if (blue < 0)  { blue = 0;  }
 
-      return Color (red, green, blue, special);
+      return Color (red, green, blue);
    }
 };
 
@@ -0,0 +1,74 @@
+/******************************************************************************
+* Header:
+*   Column
+* Desc:
+*   Contains the Column class, a growable array that can also borrow memory
+*   it does not own. The BVH, its SoA leaves and meshes keep their data in
+*   columns, so a scene loaded from the binary cache can point them straight
+*   at the memory mapped file instead of copying anything.
+******************************************************************************/
+#ifndef COLUMN_H
+#define COLUMN_H
+
+/******************************************************************************
+ * COLUMN CLASS - an array of plain values, owned or borrowed. A borrowed
+ *    column is read only, push_back copies it into owned storage first
+ *****************************************************************************/
+template <class T>
+class Column
+{
+private:
+   std::vector<T> owned;
+   T *items;  // owned.data() or the borrowed memory
+   int count;
+
+public:
+   Column() : items(NULL), count(0) {}
+   Column(const Column &other) : items(NULL), count(0) { *this = other; }
+
+   Column &operator = (const Column &other)
+   {
+      if (this != &other)
+      {
+         owned.assign(other.items, other.items + other.count);
+         items = owned.empty() ? NULL : &owned[0];
+         count = other.count;
+      }
+      return *this;
+   }
+
+   int size() const      { return count;          }
+   bool empty() const    { return count == 0;     }
+   bool borrowed() const { return items != NULL && owned.empty(); }
+   const T *data() const { return items;          }
+
+   T &operator [] (int i)             { return items[i]; }
+   const T &operator [] (int i) const { return items[i]; }
+
+   void push_back(const T &value)
+   {
+      if (borrowed())
+         owned.assign(items, items + count);
+      owned.push_back(value);
+      items = &owned[0];
+      count = owned.size();
+   }
+
+   void clear()
+   {
+      owned.clear();
+      items = NULL;
+      count = 0;
+   }
+
+   // use n values at p without copying them. p must outlive the column
+   void borrow(const T *p, int n)
+   {
+      owned.clear();
+      owned.shrink_to_fit();
+      items = const_cast<T *>(p);
+      count = n;
+   }
+};
+
+#endif
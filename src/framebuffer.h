@@ -0,0 +1,225 @@
+/******************************************************************************
+* Header:
+*   FrameBuffer
+* Desc:
+*   Contains the FrameBuffer class, where render threads store the pixels of
+*   a band of tiles. Pixels are kept tile by tile instead of in scanlines:
+*   a tile's pixels are contiguous and every tile starts on its own cache
+*   line, so a thread filling one tile never touches a line another thread
+*   is writing. Colors are stored as floats. Besides the color a frame can
+*   carry extra channels (AOVs): the depth, normal and object id seen
+*   through the middle of each pixel. Rows go back to scanline order only
+*   when the band is written out.
+******************************************************************************/
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+// tiles, rows of the accumulation buffer and the like start on a cache line
+const int cacheLineBytes = 64;
+
+/******************************************************************************
+ * CACHE LINE STRUCT - storage that is allocated on a cache line boundary
+ *****************************************************************************/
+struct alignas(cacheLineBytes) CacheLine
+{
+   unsigned char bytes[cacheLineBytes];
+};
+
+/******************************************************************************
+ * TILE PIXEL STRUCT - where a pixel lives: its tile and its place in the tile
+ *****************************************************************************/
+struct TilePixel
+{
+   int tile;
+   int pixel;
+};
+
+/******************************************************************************
+ * TILED PLANE CLASS - one channel of a tiled image, a T for every pixel.
+ *    each tile holds tileSize x tileSize values in scanline order and is
+ *    padded to whole cache lines
+ *****************************************************************************/
+template <class T>
+class TiledPlane
+{
+private:
+   std::vector<CacheLine> lines;
+   T *values;
+   size_t tileStride; // values from one tile to the next
+
+public:
+   TiledPlane() : values(NULL), tileStride(0) {}
+
+   void reset(int tiles, int tileSize)
+   {
+      size_t tileBytes = sizeof(T) * tileSize * tileSize;
+      size_t tileLines = (tileBytes + cacheLineBytes - 1) / cacheLineBytes;
+      tileStride = tileLines * cacheLineBytes / sizeof(T);
+      lines.assign(tileLines * tiles, CacheLine());
+      values = lines.empty() ? NULL : (T *)&lines[0];
+   }
+
+   bool empty() const { return lines.empty(); }
+   void clear()       { lines.clear(); values = NULL; }
+
+   T &at(TilePixel p)             { return values[p.tile * tileStride + p.pixel]; }
+   const T &at(TilePixel p) const { return values[p.tile * tileStride + p.pixel]; }
+};
+
+/******************************************************************************
+ * FRAME BUFFER CLASS - the pixels of [x0, x1) x [y0, y1), in tiles laid out
+ *    like the scheduler's, starting at (x0, y0)
+ *****************************************************************************/
+class FrameBuffer
+{
+public:
+   // the channels a frame buffer can carry, or'ed together
+   enum Channel { colorChannel = 1, depthChannel = 2, normalChannel = 4, idChannel = 8 };
+
+   struct Rgb
+   {
+      float r, g, b;
+   };
+
+private:
+   int x0, y0, x1, y1;
+   int tileSize;
+   int tilesPerRow;
+   int channels;
+   int capacity; // tiles the planes have room for
+   TiledPlane<Rgb> color;
+   TiledPlane<float> depth;
+   TiledPlane<Rgb> normal;
+   TiledPlane<int> id;
+
+public:
+   FrameBuffer() : x0(0), y0(0), x1(0), y1(0), tileSize(1), tilesPerRow(0), channels(0)
+                 , capacity(0) {}
+
+   // covers a new rectangle. storage is only reallocated when it grows or
+   // the tile size changes, since the planes are laid out by tile size
+   void reset(int rx0, int ry0, int rx1, int ry1, int size, int withChannels)
+   {
+      bool resized = size != tileSize;
+      x0 = rx0;
+      y0 = ry0;
+      x1 = rx1;
+      y1 = ry1;
+      tileSize = size;
+      tilesPerRow = (x1 - x0 + tileSize - 1) / tileSize;
+      int tiles = tilesPerRow * ((y1 - y0 + tileSize - 1) / tileSize);
+
+      if (withChannels != channels || tiles > capacity || resized)
+      {
+         channels = withChannels;
+         capacity = tiles;
+         color.reset(tiles, tileSize);
+         depth.clear();
+         normal.clear();
+         id.clear();
+         if (channels & depthChannel)
+            depth.reset(tiles, tileSize);
+         if (channels & normalChannel)
+            normal.reset(tiles, tileSize);
+         if (channels & idChannel)
+            id.reset(tiles, tileSize);
+      }
+   }
+
+   int getChannels() const { return channels; }
+
+   // floats a pixel of the channel takes in a row
+   static int channelWidth(Channel c)
+   {
+      return c == colorChannel || c == normalChannel ? 3 : 1;
+   }
+
+   TilePixel locate(int x, int y) const
+   {
+      int tx = (x - x0) / tileSize, ty = (y - y0) / tileSize;
+      TilePixel p;
+      p.tile = ty * tilesPerRow + tx;
+      p.pixel = (y - y0 - ty * tileSize) * tileSize + (x - x0 - tx * tileSize);
+      return p;
+   }
+
+   void setColor(TilePixel p, Color c)
+   {
+      Rgb &rgb = color.at(p);
+      rgb.r = c.getColorRed();
+      rgb.g = c.getColorGreen();
+      rgb.b = c.getColorBlue();
+   }
+
+   // what the ray through the middle of the pixel saw. a miss has depth 0,
+   // a zero normal and id -1
+   void setSurface(TilePixel p, float t, const Vect &n, int object)
+   {
+      if (channels & depthChannel)
+         depth.at(p) = t;
+      if (channels & normalChannel)
+      {
+         Rgb &v = normal.at(p);
+         v.r = n.getVectX();
+         v.g = n.getVectY();
+         v.b = n.getVectZ();
+      }
+      if (channels & idChannel)
+         id.at(p) = object;
+   }
+
+   // row y of the colors in scanline order, for writing out
+   void colorRow(int y, RGBType *row) const
+   {
+      for (int x = x0; x < x1; x++)
+      {
+         const Rgb &rgb = color.at(locate(x, y));
+         row[x - x0].r = rgb.r;
+         row[x - x0].g = rgb.g;
+         row[x - x0].b = rgb.b;
+      }
+   }
+
+   // row y of a channel in scanline order as floats, channelWidth a pixel
+   void channelRow(Channel c, int y, float *row) const
+   {
+      for (int x = x0; x < x1; x++)
+      {
+         TilePixel p = locate(x, y);
+         if (c == depthChannel)
+            row[x - x0] = depth.at(p);
+         else if (c == idChannel)
+            row[x - x0] = id.at(p);
+         else
+         {
+            const Rgb &v = c == colorChannel ? color.at(p) : normal.at(p);
+            row[3 * (x - x0) + 0] = v.r;
+            row[3 * (x - x0) + 1] = v.g;
+            row[3 * (x - x0) + 2] = v.b;
+         }
+      }
+   }
+
+   // stores pixels [rx0, rx1) of row y of a channel, laid out as channelRow
+   // gives them
+   void setChannelRow(Channel c, int y, int rx0, int rx1, const float *row)
+   {
+      for (int x = rx0; x < rx1; x++)
+      {
+         TilePixel p = locate(x, y);
+         if (c == depthChannel)
+            depth.at(p) = row[x - rx0];
+         else if (c == idChannel)
+            id.at(p) = row[x - rx0];
+         else
+         {
+            Rgb &v = c == colorChannel ? color.at(p) : normal.at(p);
+            v.r = row[3 * (x - rx0) + 0];
+            v.g = row[3 * (x - rx0) + 1];
+            v.b = row[3 * (x - rx0) + 2];
+         }
+      }
+   }
+};
+
+#endif
@@ -0,0 +1,552 @@
+/******************************************************************************
+* Header:
+*   Image
+* Desc:
+*   Contains the RGBType struct and the BmpWriter and PpmWriter classes. The
+*   writers take the image a band of rows at a time as the render finishes
+*   them, encode each band into one reusable byte buffer and write it with a
+*   single fwrite, so the whole frame never has to be held in memory.
+*   ImageWriter picks one of them by format. PfmWriter streams the float
+*   channels (depth, normals, ids) the same way. readBmp and compareImages
+*   read the images back to check two builds agree. openIn opens their
+*   files, inside a directory a render server's job may use when given one.
+******************************************************************************/
+#ifndef IMAGE_H
+#define IMAGE_H
+
+/******************************************************************************
+ * OPEN IN - opens name in the directory fd directory, or the current
+ *    directory for AT_FDCWD. A name opened in a directory fd must be a
+ *    plain file and not a link, which is checked on the file opened so it
+ *    can not be swapped for another after. -1 with errno set if it can not
+ *    be opened
+ *****************************************************************************/
+inline int openIn(int directory, const char *name, int flags)
+{
+   if (directory != AT_FDCWD)
+      flags |= O_NOFOLLOW | O_NONBLOCK; // a FIFO must not hold up the open
+   int fd = openat(directory, name, flags, 0666);
+   struct stat info;
+   if (fd >= 0 && directory != AT_FDCWD && (fstat(fd, &info) != 0 || !S_ISREG(info.st_mode)))
+   {
+      close(fd);
+      fd = -1;
+      errno = EPERM;
+   }
+   return fd;
+}
+
+// the same as a stream, mode being what fopen would take for flags
+inline FILE *fopenIn(int directory, const char *name, int flags, const char *mode)
+{
+   int fd = openIn(directory, name, flags);
+   FILE *file = fd < 0 ? NULL : fdopen(fd, mode);
+   if (fd >= 0 && file == NULL)
+      close(fd);
+   return file;
+}
+
+/******************************************************************************
+ * RGBTYPE STRUCT - this holds our red green and blue colors
+ *****************************************************************************/
+struct RGBType
+{
+   Real r; // red
+   Real g; // green
+   Real b; // blue
+};
+
+/******************************************************************************
+ * BMP WRITER CLASS - streams a 24 bit BMP to disk. BMP files store the
+ *    bottom row first, which is the order the renderer produces rows in
+ *****************************************************************************/
+class BmpWriter
+{
+private:
+   FILE *file;
+   std::string filename;
+   int width;
+   int height;
+   int rowBytes;                      // 3 bytes a pixel, padded to 4
+   int rowsWritten;
+   std::vector<unsigned char> buffer; // reused for every band
+
+   // little endian, as BMP wants it
+   static void put32(unsigned char *p, int value)
+   {
+      p[0] = (unsigned char)(value);
+      p[1] = (unsigned char)(value >> 8);
+      p[2] = (unsigned char)(value >> 16);
+      p[3] = (unsigned char)(value >> 24);
+   }
+
+   bool fail(const char *what)
+   {
+      std::cerr << "cannot " << what << " " << filename << ": "
+                << strerror(errno) << std::endl;
+      fclose(file);
+      file = NULL;
+      return false;
+   }
+
+public:
+   BmpWriter() : file(NULL), width(0), height(0), rowBytes(0), rowsWritten(0) {}
+   ~BmpWriter()
+   {
+      if (file != NULL)
+         fclose(file);
+   }
+
+   BmpWriter(const BmpWriter &) = delete;
+   BmpWriter &operator = (const BmpWriter &) = delete;
+
+   // creates the file, in directory if given, and writes the headers.
+   // false if it could not
+   bool open(const char *name, int w, int h, int dpi, int directory = AT_FDCWD)
+   {
+      filename = name;
+      width = w;
+      height = h;
+      rowBytes = (3 * w + 3) / 4 * 4;
+      rowsWritten = 0;
+
+      int s = rowBytes * h;
+      int filesize = 54 + s;
+      int ppm = dpi * static_cast<int>(39.375); // dots per inch to per meter
+
+      unsigned char bmpfileheader[14] = {'B','M', 0,0,0,0, 0,0,0,0, 54,0,0,0};
+      unsigned char bmpinfoheader[40] = {40,0,0,0, 0,0,0,0, 0,0,0,0, 1,0,24,0};
+
+      put32(&bmpfileheader[2], filesize);
+      put32(&bmpinfoheader[4], w);
+      put32(&bmpinfoheader[8], h);
+      put32(&bmpinfoheader[20], s);
+      put32(&bmpinfoheader[24], ppm);
+      put32(&bmpinfoheader[28], ppm);
+
+      file = fopenIn(directory, name, O_WRONLY | O_CREAT | O_TRUNC, "wb");
+      if (file == NULL)
+      {
+         std::cerr << "cannot open " << name << ": " << strerror(errno) << std::endl;
+         return false;
+      }
+
+      if (fwrite(bmpfileheader, 1, 14, file) != 14 ||
+          fwrite(bmpinfoheader, 1, 40, file) != 40)
+         return fail("write to");
+
+      return true;
+   }
+
+   // appends count rows of width pixels, the lowest row first
+   bool writeRows(const RGBType *rows, int count)
+   {
+      if (file == NULL || rowsWritten + count > height)
+         return false;
+
+      // the padding bytes stay zero, only the pixels are rewritten
+      if (buffer.size() < (size_t)count * rowBytes)
+         buffer.resize((size_t)count * rowBytes, 0);
+
+      for (int y = 0; y < count; y++)
+      {
+         unsigned char *out = &buffer[(size_t)y * rowBytes];
+         const RGBType *in = &rows[(size_t)y * width];
+         for (int x = 0; x < width; x++)
+         {
+            out[3*x + 0] = (unsigned char)(int)floor(in[x].b * 255);
+            out[3*x + 1] = (unsigned char)(int)floor(in[x].g * 255);
+            out[3*x + 2] = (unsigned char)(int)floor(in[x].r * 255);
+         }
+      }
+
+      size_t bytes = (size_t)count * rowBytes;
+      if (fwrite(&buffer[0], 1, bytes, file) != bytes)
+         return fail("write to");
+
+      rowsWritten += count;
+      return true;
+   }
+
+   // flushes the file. false if a row is missing or the data did not land
+   bool close()
+   {
+      if (file == NULL)
+         return false;
+
+      if (rowsWritten != height)
+      {
+         std::cerr << filename << ": only " << rowsWritten << " of " << height
+                   << " rows were written" << std::endl;
+         fclose(file);
+         file = NULL;
+         return false;
+      }
+
+      if (fclose(file) != 0)
+      {
+         file = NULL;
+         std::cerr << "cannot write " << filename << ": " << strerror(errno) << std::endl;
+         return false;
+      }
+
+      file = NULL;
+      return true;
+   }
+};
+
+/******************************************************************************
+ * PPM WRITER CLASS - streams a binary (P6) PPM to disk. PPM files store the
+ *    top row first, so each band is written reversed at its place from the
+ *    end of the file
+ *****************************************************************************/
+class PpmWriter
+{
+private:
+   FILE *file;
+   std::string filename;
+   int width;
+   int height;
+   long headerBytes;
+   int rowsWritten;
+   std::vector<unsigned char> buffer; // reused for every band
+
+   bool fail(const char *what)
+   {
+      std::cerr << "cannot " << what << " " << filename << ": "
+                << strerror(errno) << std::endl;
+      fclose(file);
+      file = NULL;
+      return false;
+   }
+
+public:
+   PpmWriter() : file(NULL), width(0), height(0), headerBytes(0), rowsWritten(0) {}
+   ~PpmWriter()
+   {
+      if (file != NULL)
+         fclose(file);
+   }
+
+   PpmWriter(const PpmWriter &) = delete;
+   PpmWriter &operator = (const PpmWriter &) = delete;
+
+   // creates the file, in directory if given, and writes the header. PPM
+   // has no resolution field, dpi is ignored
+   bool open(const char *name, int w, int h, int dpi, int directory = AT_FDCWD)
+   {
+      filename = name;
+      width = w;
+      height = h;
+      rowsWritten = 0;
+
+      file = fopenIn(directory, name, O_WRONLY | O_CREAT | O_TRUNC, "wb");
+      if (file == NULL)
+      {
+         std::cerr << "cannot open " << name << ": " << strerror(errno) << std::endl;
+         return false;
+      }
+
+      headerBytes = fprintf(file, "P6\n%d %d\n255\n", w, h);
+      if (headerBytes < 0)
+         return fail("write to");
+      return true;
+   }
+
+   // adds count rows of width pixels, the lowest row first
+   bool writeRows(const RGBType *rows, int count)
+   {
+      if (file == NULL || rowsWritten + count > height)
+         return false;
+
+      size_t rowBytes = (size_t)3 * width;
+      if (buffer.size() < count * rowBytes)
+         buffer.resize(count * rowBytes);
+
+      for (int y = 0; y < count; y++)
+      {
+         unsigned char *out = &buffer[(count - 1 - y) * rowBytes];
+         const RGBType *in = &rows[(size_t)y * width];
+         for (int x = 0; x < width; x++)
+         {
+            out[3*x + 0] = (unsigned char)(int)floor(in[x].r * 255);
+            out[3*x + 1] = (unsigned char)(int)floor(in[x].g * 255);
+            out[3*x + 2] = (unsigned char)(int)floor(in[x].b * 255);
+         }
+      }
+
+      // the highest of these rows is the first of them in the file
+      long offset = headerBytes + (long)(height - rowsWritten - count) * rowBytes;
+      size_t bytes = count * rowBytes;
+      if (fseek(file, offset, SEEK_SET) != 0 || fwrite(&buffer[0], 1, bytes, file) != bytes)
+         return fail("write to");
+
+      rowsWritten += count;
+      return true;
+   }
+
+   // flushes the file. false if a row is missing or the data did not land
+   bool close()
+   {
+      if (file == NULL)
+         return false;
+
+      if (rowsWritten != height)
+      {
+         std::cerr << filename << ": only " << rowsWritten << " of " << height
+                   << " rows were written" << std::endl;
+         fclose(file);
+         file = NULL;
+         return false;
+      }
+
+      if (fclose(file) != 0)
+      {
+         file = NULL;
+         std::cerr << "cannot write " << filename << ": " << strerror(errno) << std::endl;
+         return false;
+      }
+
+      file = NULL;
+      return true;
+   }
+};
+
+// the file formats the renderer can write
+enum ImageFormat { bmpFormat, ppmFormat };
+
+// the format named by name (bmp or ppm). false for any other name
+inline bool findImageFormat(const std::string &name, ImageFormat &format)
+{
+   if (name == "bmp")
+      format = bmpFormat;
+   else if (name == "ppm")
+      format = ppmFormat;
+   else
+      return false;
+   return true;
+}
+
+// the format a filename's extension asks for, BMP unless it ends in .ppm
+inline ImageFormat imageFormatOf(const std::string &filename)
+{
+   size_t dot = filename.rfind('.');
+   ImageFormat format = bmpFormat;
+   if (dot != std::string::npos)
+   {
+      std::string extension = filename.substr(dot + 1);
+      for (int i = 0; i < (int)extension.size(); i++)
+         extension[i] = tolower(extension[i]);
+      findImageFormat(extension, format);
+   }
+   return format;
+}
+
+/******************************************************************************
+ * IMAGE WRITER CLASS - streams an image in whichever format it is opened
+ *    with. same interface as the writers it forwards to
+ *****************************************************************************/
+class ImageWriter
+{
+private:
+   ImageFormat format;
+   BmpWriter bmp;
+   PpmWriter ppm;
+
+public:
+   ImageWriter() : format(bmpFormat) {}
+
+   bool open(const char *name, ImageFormat f, int w, int h, int dpi, int directory = AT_FDCWD)
+   {
+      format = f;
+      return format == ppmFormat ? ppm.open(name, w, h, dpi, directory)
+                                 : bmp.open(name, w, h, dpi, directory);
+   }
+
+   bool writeRows(const RGBType *rows, int count)
+   {
+      return format == ppmFormat ? ppm.writeRows(rows, count) : bmp.writeRows(rows, count);
+   }
+
+   bool close() { return format == ppmFormat ? ppm.close() : bmp.close(); }
+};
+
+/******************************************************************************
+ * PFM WRITER CLASS - streams a float image as PFM, 1 or 3 floats a pixel.
+ *    PFM stores the bottom row first like BMP, and the -1 scale in the
+ *    header marks the floats as little endian, as they are in memory
+ *****************************************************************************/
+class PfmWriter
+{
+private:
+   FILE *file;
+   std::string filename;
+   int width;
+   int height;
+   int channels;
+   int rowsWritten;
+
+public:
+   PfmWriter() : file(NULL), width(0), height(0), channels(0), rowsWritten(0) {}
+   ~PfmWriter()
+   {
+      if (file != NULL)
+         fclose(file);
+   }
+
+   PfmWriter(const PfmWriter &) = delete;
+   PfmWriter &operator = (const PfmWriter &) = delete;
+
+   // creates the file, in directory if given, and writes the header. false
+   // if it could not
+   bool open(const char *name, int w, int h, int c, int directory = AT_FDCWD)
+   {
+      filename = name;
+      width = w;
+      height = h;
+      channels = c;
+      rowsWritten = 0;
+
+      file = fopenIn(directory, name, O_WRONLY | O_CREAT | O_TRUNC, "wb");
+      if (file == NULL)
+      {
+         std::cerr << "cannot open " << name << ": " << strerror(errno) << std::endl;
+         return false;
+      }
+      if (fprintf(file, "%s\n%d %d\n-1.0\n", c == 3 ? "PF" : "Pf", w, h) < 0)
+      {
+         std::cerr << "cannot write to " << name << ": " << strerror(errno) << std::endl;
+         fclose(file);
+         file = NULL;
+         return false;
+      }
+      return true;
+   }
+
+   // appends count rows of width * channels floats, the lowest row first
+   bool writeRows(const float *rows, int count)
+   {
+      if (file == NULL || rowsWritten + count > height)
+         return false;
+
+      size_t values = (size_t)count * width * channels;
+      if (fwrite(rows, sizeof(float), values, file) != values)
+      {
+         std::cerr << "cannot write to " << filename << ": " << strerror(errno) << std::endl;
+         return false;
+      }
+      rowsWritten += count;
+      return true;
+   }
+
+   // flushes the file. false if a row is missing or the data did not land
+   bool close()
+   {
+      if (file == NULL)
+         return false;
+
+      bool ok = fclose(file) == 0;
+      file = NULL;
+      if (!ok)
+         std::cerr << "cannot write " << filename << ": " << strerror(errno) << std::endl;
+      else if (rowsWritten != height)
+      {
+         std::cerr << filename << ": only " << rowsWritten << " of " << height
+                   << " rows were written" << std::endl;
+         ok = false;
+      }
+      return ok;
+   }
+};
+
+/******************************************************************************
+ * READ BMP - loads a 24 bit BMP like the ones BmpWriter makes. pixels gets
+ *    3 bytes, blue green red, for every pixel, the bottom row first. false
+ *    with the problem printed if the file can not be read
+ *****************************************************************************/
+inline bool readBmp(const char *name, int &width, int &height,
+                    std::vector<unsigned char> &pixels)
+{
+   FILE *file = fopen(name, "rb");
+   if (file == NULL)
+   {
+      std::cerr << "cannot open " << name << ": " << strerror(errno) << std::endl;
+      return false;
+   }
+
+   unsigned char header[54];
+   bool ok = fread(header, 1, 54, file) == 54 && header[0] == 'B' && header[1] == 'M';
+
+   // little endian fields of the file and info headers
+   int offset = header[10] | header[11] << 8 | header[12] << 16 | header[13] << 24;
+   width = header[18] | header[19] << 8 | header[20] << 16 | header[21] << 24;
+   height = header[22] | header[23] << 8 | header[24] << 16 | header[25] << 24;
+   int bits = header[28] | header[29] << 8;
+   ok = ok && bits == 24 && width > 0 && height > 0 && fseek(file, offset, SEEK_SET) == 0;
+
+   if (ok)
+   {
+      int rowBytes = (3 * width + 3) / 4 * 4;
+      std::vector<unsigned char> row (rowBytes);
+      pixels.resize((size_t)3 * width * height);
+      for (int y = 0; ok && y < height; y++)
+      {
+         ok = fread(&row[0], 1, rowBytes, file) == (size_t)rowBytes;
+         memcpy(&pixels[(size_t)3 * width * y], &row[0], 3 * width);
+      }
+   }
+   fclose(file);
+
+   if (!ok)
+      std::cerr << name << ": not a 24 bit BMP or cut short" << std::endl;
+   return ok;
+}
+
+/******************************************************************************
+ * COMPARE IMAGES - prints how far apart two images are. a pixel is an
+ *    outlier when any channel differs by more than tolerance levels out of
+ *    255. true when the images are the same size and at most maxOutliers
+ *    percent of the pixels are outliers
+ *****************************************************************************/
+inline bool compareImages(const char *nameA, const char *nameB, int tolerance,
+                          double maxOutliers)
+{
+   int widthA, heightA, widthB, heightB;
+   std::vector<unsigned char> a, b;
+   if (!readBmp(nameA, widthA, heightA, a) || !readBmp(nameB, widthB, heightB, b))
+      return false;
+
+   if (widthA != widthB || heightA != heightB)
+   {
+      std::cout << nameA << " is " << widthA << "x" << heightA << " but " << nameB
+                << " is " << widthB << "x" << heightB << std::endl;
+      return false;
+   }
+
+   long long pixels = (long long)widthA * heightA;
+   long long outliers = 0, total = 0;
+   int largest = 0;
+   for (long long p = 0; p < pixels; p++)
+   {
+      int worst = 0;
+      for (int c = 0; c < 3; c++)
+      {
+         int difference = abs(a[3*p + c] - b[3*p + c]);
+         worst = std::max(worst, difference);
+         total += difference;
+      }
+      largest = std::max(largest, worst);
+      outliers += (worst > tolerance);
+   }
+
+   double percent = 100.0 * outliers / pixels;
+   bool pass = percent <= maxOutliers;
+   std::cout << outliers << " of " << pixels << " pixels (" << percent
+             << "%) differ by more than " << tolerance << ", largest difference "
+             << largest << ", mean " << (double)total / (3 * pixels) << ": "
+             << (pass ? "within" : "OUTSIDE") << " the tolerance of "
+             << maxOutliers << "%" << std::endl;
+   return pass;
+}
+
+#endif
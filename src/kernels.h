@@ -0,0 +1,194 @@
+/******************************************************************************
+* Header:
+*   Kernels
+* Desc:
+*   The SIMD sphere, triangle and mesh intersection kernels. This file has no
+*   include guard on purpose: simd.h includes it once per instruction set
+*   with KERNEL_NS (namespace), KERNEL_LANES (Reals per register) and
+*   KERNEL_SQRT (the lane wise square root) defined, inside a
+*   "#pragma GCC target" region for that instruction set.
+*
+*   Every lane repeats the exact operations of Sphere::findIntersection and
+*   Triangle::findIntersection (TriangleMesh::intersectTriangle for meshes)
+*   in the same order, so the kernels return the same bits as the virtual
+*   path.
+******************************************************************************/
+
+namespace KERNEL_NS
+{
+   // unaligned and allowed to alias the SoA columns, like __m256d
+   typedef Real lanes __attribute__((vector_size(KERNEL_LANES * sizeof(Real)),
+                                     aligned(sizeof(Real)), may_alias));
+
+   static inline lanes load(const Real *p) { return *(const lanes *)p; }
+
+   static inline lanes broadcast(Real x) { return lanes{} + x; }
+
+   // intersection distance of the ray with spheres [i, i + KERNEL_LANES)
+   static inline lanes sphereLanes(const SoARay &ray, const SphereSoA &s, int i)
+   {
+      lanes ocx = broadcast(ray.ox) - load(&s.cx[i]);
+      lanes ocy = broadcast(ray.oy) - load(&s.cy[i]);
+      lanes ocz = broadcast(ray.oz) - load(&s.cz[i]);
+      lanes r   = load(&s.radius[i]);
+
+      lanes b = (Real(2) * ocx * ray.dx) + (Real(2) * ocy * ray.dy) + (Real(2) * ocz * ray.dz);
+      lanes c = ocx*ocx + ocy*ocy + ocz*ocz - (r*r);
+
+      lanes discriminant = b*b - Real(4)*c;
+      lanes root = KERNEL_SQRT(discriminant);
+      lanes root1 = ((Real(-1)*b - root) / Real(2)) - sphereBias;
+      lanes root2 = ((root - b) / Real(2)) - sphereBias;
+
+      lanes miss = broadcast(-1);
+      return discriminant > 0 ? (root1 > 0 ? root1 : root2) : miss;
+   }
+
+   // intersection distance of the ray with triangles [i, i + KERNEL_LANES)
+   static inline lanes triangleLanes(const SoARay &ray, const TriangleSoA &s, int i)
+   {
+      lanes nx = load(&s.nx[i]), ny = load(&s.ny[i]), nz = load(&s.nz[i]);
+      lanes d = load(&s.distance[i]);
+
+      lanes a = ray.dx*nx + ray.dy*ny + ray.dz*nz;
+      lanes b = nx*(ray.ox + -(nx*d)) + ny*(ray.oy + -(ny*d)) + nz*(ray.oz + -(nz*d));
+      lanes distToPlane = Real(-1)*b/a;
+
+      // point of intersection
+      lanes qx = ray.dx*distToPlane + ray.ox;
+      lanes qy = ray.dy*distToPlane + ray.oy;
+      lanes qz = ray.dz*distToPlane + ray.oz;
+
+      // [CAxQA]*n >= 0
+      lanes ex = load(&s.cax[i]), ey = load(&s.cay[i]), ez = load(&s.caz[i]);
+      lanes px = qx - load(&s.ax[i]), py = qy - load(&s.ay[i]), pz = qz - load(&s.az[i]);
+      lanes test1 = (ey*pz - ez*py)*nx + (ez*px - ex*pz)*ny + (ex*py - ey*px)*nz;
+
+      // [BCxQC]*n >= 0
+      ex = load(&s.bcx[i]); ey = load(&s.bcy[i]); ez = load(&s.bcz[i]);
+      px = qx - load(&s.cx[i]); py = qy - load(&s.cy[i]); pz = qz - load(&s.cz[i]);
+      lanes test2 = (ey*pz - ez*py)*nx + (ez*px - ex*pz)*ny + (ex*py - ey*px)*nz;
+
+      // [ABxQB]*n >= 0
+      ex = load(&s.abx[i]); ey = load(&s.aby[i]); ez = load(&s.abz[i]);
+      px = qx - load(&s.bx[i]); py = qy - load(&s.by[i]); pz = qz - load(&s.bz[i]);
+      lanes test3 = (ey*pz - ez*py)*nx + (ez*px - ex*pz)*ny + (ex*py - ey*px)*nz;
+
+      lanes miss = broadcast(-1);
+      lanes inside = (test1 >= 0) & (test2 >= 0) & (test3 >= 0) ? distToPlane : miss;
+      return a == 0 ? miss : inside;
+   }
+
+   // Moller-Trumbore distance to mesh triangles [i, i + KERNEL_LANES)
+   static inline lanes meshLanes(const SoARay &ray, const MeshSoA &s, int i)
+   {
+      lanes e1x = load(&s.e1x[i]), e1y = load(&s.e1y[i]), e1z = load(&s.e1z[i]);
+      lanes e2x = load(&s.e2x[i]), e2y = load(&s.e2y[i]), e2z = load(&s.e2z[i]);
+
+      // pvec = dir x e2
+      lanes px = ray.dy*e2z - ray.dz*e2y;
+      lanes py = ray.dz*e2x - ray.dx*e2z;
+      lanes pz = ray.dx*e2y - ray.dy*e2x;
+      lanes det = e1x*px + e1y*py + e1z*pz;
+      lanes invDet = Real(1) / det;
+
+      lanes tx = ray.ox - load(&s.vx[i]);
+      lanes ty = ray.oy - load(&s.vy[i]);
+      lanes tz = ray.oz - load(&s.vz[i]);
+      lanes u = (tx*px + ty*py + tz*pz) * invDet;
+
+      // qvec = tvec x e1
+      lanes qx = ty*e1z - tz*e1y;
+      lanes qy = tz*e1x - tx*e1z;
+      lanes qz = tx*e1y - ty*e1x;
+      lanes v = (ray.dx*qx + ray.dy*qy + ray.dz*qz) * invDet;
+      lanes t = (e2x*qx + e2y*qy + e2z*qz) * invDet;
+
+      lanes miss = broadcast(-1);
+      return (det != 0) & (u >= 0) & (u <= 1) & (v >= 0) & (u + v <= 1) ? t : miss;
+   }
+
+   inline void sphereClosest(const SoARay &ray, const SphereSoA &s, int first, int count,
+                             Real &tBest, int &best)
+   {
+      for (int i = first; i < first + count; i += KERNEL_LANES)
+      {
+         lanes t = sphereLanes(ray, s, i);
+         for (int l = 0; l < KERNEL_LANES; l++)
+            if (t[l] > 0 && t[l] < tBest)
+            {
+               tBest = t[l];
+               best = i + l;
+            }
+      }
+   }
+
+   inline bool sphereAny(const SoARay &ray, const SphereSoA &s, int first, int count,
+                         Real tMin, Real tMax)
+   {
+      for (int i = first; i < first + count; i += KERNEL_LANES)
+      {
+         lanes t = sphereLanes(ray, s, i);
+         for (int l = 0; l < KERNEL_LANES; l++)
+            if (t[l] > tMin && t[l] <= tMax)
+               return true;
+      }
+      return false;
+   }
+
+   inline void triangleClosest(const SoARay &ray, const TriangleSoA &s, int first, int count,
+                               Real &tBest, int &best)
+   {
+      for (int i = first; i < first + count; i += KERNEL_LANES)
+      {
+         lanes t = triangleLanes(ray, s, i);
+         for (int l = 0; l < KERNEL_LANES; l++)
+            if (t[l] > 0 && t[l] < tBest)
+            {
+               tBest = t[l];
+               best = i + l;
+            }
+      }
+   }
+
+   inline bool triangleAny(const SoARay &ray, const TriangleSoA &s, int first, int count,
+                           Real tMin, Real tMax)
+   {
+      for (int i = first; i < first + count; i += KERNEL_LANES)
+      {
+         lanes t = triangleLanes(ray, s, i);
+         for (int l = 0; l < KERNEL_LANES; l++)
+            if (t[l] > tMin && t[l] <= tMax)
+               return true;
+      }
+      return false;
+   }
+
+   inline void meshClosest(const SoARay &ray, const MeshSoA &s, int first, int count,
+                           Real &tBest, int &best)
+   {
+      for (int i = first; i < first + count; i += KERNEL_LANES)
+      {
+         lanes t = meshLanes(ray, s, i);
+         for (int l = 0; l < KERNEL_LANES; l++)
+            if (t[l] > 0 && t[l] < tBest)
+            {
+               tBest = t[l];
+               best = i + l;
+            }
+      }
+   }
+
+   inline bool meshAny(const SoARay &ray, const MeshSoA &s, int first, int count,
+                       Real tMin, Real tMax)
+   {
+      for (int i = first; i < first + count; i += KERNEL_LANES)
+      {
+         lanes t = meshLanes(ray, s, i);
+         for (int l = 0; l < KERNEL_LANES; l++)
+            if (t[l] > tMin && t[l] <= tMax)
+               return true;
+      }
+      return false;
+   }
+}
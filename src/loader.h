@@ -0,0 +1,462 @@
+/******************************************************************************
+* Header:
+*   Loader
+* Desc:
+*   Contains the SceneLoader class, which reads a text scene description
+*   straight into a Scene. The file is read into memory with one fread and
+*   parsed in a single pass; tokens are pointer ranges into that buffer and
+*   numbers are converted in place, so nothing is allocated per token. See
+*   scenes/default.scene for the format.
+******************************************************************************/
+#ifndef LOADER_H
+#define LOADER_H
+
+/******************************************************************************
+ * SCENE LOADER CLASS - parses a scene file. errors name the file and line
+ *****************************************************************************/
+class SceneLoader
+{
+private:
+   // a color or material line. lights take the color, objects the material
+   struct NamedColor
+   {
+      std::string name;
+      Color color;
+      int material; // index in the scene's MaterialTable
+   };
+
+   std::string filename;
+   std::vector<char> text;   // the whole file, NUL terminated
+   const char *pos;          // next character to read
+   int line;                 // line pos is on, from 1
+   const char *token;        // the token last read, [token, tokenEnd)
+   const char *tokenEnd;
+   std::vector<NamedColor> colors;
+   TriangleMesh *mesh;       // the mesh vertex and face lines add to
+   bool hasCamera;
+
+   // line 0 is for problems with the file as a whole
+   bool fail(const std::string &message)
+   {
+      std::cerr << filename;
+      if (line > 0)
+         std::cerr << ":" << line;
+      std::cerr << ": " << message << std::endl;
+      return false;
+   }
+
+   std::string tokenText() const { return std::string(token, tokenEnd); }
+
+   bool tokenIs(const char *word) const
+   {
+      size_t n = strlen(word);
+      return (size_t)(tokenEnd - token) == n && memcmp(token, word, n) == 0;
+   }
+
+   // moves to the next token on this line. false at the end of the line
+   bool nextToken()
+   {
+      while (*pos == ' ' || *pos == '\t' || *pos == '\r')
+         pos++;
+
+      if (*pos == '#') // comments run to the end of the line
+         while (*pos != '\n' && *pos != '\0')
+            pos++;
+
+      if (*pos == '\n' || *pos == '\0')
+         return false;
+
+      token = pos;
+      while (*pos != ' ' && *pos != '\t' && *pos != '\r' && *pos != '\n' &&
+             *pos != '\0' && *pos != '#')
+         pos++;
+      tokenEnd = pos;
+      return true;
+   }
+
+   bool number(double &value, const char *what)
+   {
+      if (!nextToken())
+         return fail(std::string("expected ") + what);
+
+      std::from_chars_result result = std::from_chars(token, tokenEnd, value);
+      if (result.ec != std::errc() || result.ptr != tokenEnd)
+         return fail(std::string("expected ") + what + ", found \"" + tokenText() + "\"");
+      return true;
+   }
+
+   bool integer(int &value, const char *what)
+   {
+      if (!nextToken())
+         return fail(std::string("expected ") + what);
+
+      std::from_chars_result result = std::from_chars(token, tokenEnd, value);
+      if (result.ec != std::errc() || result.ptr != tokenEnd)
+         return fail(std::string("expected ") + what + ", found \"" + tokenText() + "\"");
+      return true;
+   }
+
+   bool vect(Vect &v, const char *what)
+   {
+      double x, y, z;
+      if (!number(x, what) || !number(y, what) || !number(z, what))
+         return false;
+      v = Vect(x, y, z);
+      return true;
+   }
+
+   // a color or material defined earlier with a color or material line
+   bool named(const NamedColor *&found)
+   {
+      if (!nextToken())
+         return fail("expected a color name");
+
+      for (int i = 0; i < (int)colors.size(); i++)
+         if (tokenIs(colors[i].name.c_str()))
+         {
+            found = &colors[i];
+            return true;
+         }
+      return fail("unknown color \"" + tokenText() + "\"");
+   }
+
+   bool colorName(Color &color)
+   {
+      const NamedColor *found;
+      if (!named(found))
+         return false;
+      color = found->color;
+      return true;
+   }
+
+   bool materialName(int &material)
+   {
+      const NamedColor *found;
+      if (!named(found))
+         return false;
+      material = found->material;
+      return true;
+   }
+
+   // the optional properties after the color of a material line
+   bool materialProperties(Material &m)
+   {
+      while (nextToken())
+      {
+         if (tokenIs("reflect"))
+         {
+            double v;
+            if (!number(v, "a reflectivity"))
+               return false;
+            m.reflectivity = v;
+         }
+         else if (tokenIs("specular"))
+         {
+            double v;
+            if (!number(v, "a specular strength"))
+               return false;
+            m.specular = v;
+         }
+         else if (tokenIs("shininess"))
+         {
+            double v;
+            if (!number(v, "a shininess"))
+               return false;
+            m.shininess = v;
+         }
+         else if (tokenIs("checker"))
+         {
+            double r, g, b;
+            if (!number(r, "a red value") || !number(g, "a green value") ||
+                !number(b, "a blue value"))
+               return false;
+            m.second = Color(r, g, b);
+            m.pattern = checkerPattern;
+         }
+         else
+            return fail("unknown material property \"" + tokenText() + "\"");
+      }
+      if (m.reflectivity < 0 || m.reflectivity > 1)
+         return fail("reflect must be between 0 and 1");
+      return true;
+   }
+
+   // anything left on the line is a mistake
+   bool endOfLine()
+   {
+      if (nextToken())
+         return fail("unexpected \"" + tokenText() + "\" at the end of the line");
+      return true;
+   }
+
+   // parses the line pos is on, leaving pos at its newline
+   bool parseLine(Scene &scene)
+   {
+      if (!nextToken())
+         return true; // blank or comment
+
+      RenderSettings &settings = scene.getSettings();
+
+      if (tokenIs("v")) // mesh vertex, the most common line first
+      {
+         Vect v;
+         if (mesh == NULL)
+            return fail("vertex outside a mesh");
+         if (!vect(v, "a vertex coordinate"))
+            return false;
+         mesh->addVertex(v);
+      }
+      else if (tokenIs("f")) // mesh face: three vertex indices from 0
+      {
+         int i[3];
+         if (mesh == NULL)
+            return fail("face outside a mesh");
+         for (int k = 0; k < 3; k++)
+         {
+            if (!integer(i[k], "a vertex index"))
+               return false;
+            if (i[k] < 0 || i[k] >= mesh->getVertexCount())
+               return fail("vertex index " + tokenText() + " is not in the mesh");
+         }
+         mesh->addTriangle(i[0], i[1], i[2]);
+      }
+      else if (tokenIs("sphere"))
+      {
+         Vect center;
+         double radius;
+         int material;
+         if (!vect(center, "a sphere center") || !number(radius, "a sphere radius") ||
+             !materialName(material))
+            return false;
+         scene.addObject(new Sphere(center, radius, material));
+      }
+      else if (tokenIs("triangle"))
+      {
+         Vect A, B, C;
+         int material;
+         if (!vect(A, "a triangle corner") || !vect(B, "a triangle corner") ||
+             !vect(C, "a triangle corner") || !materialName(material))
+            return false;
+         scene.addObject(new Triangle(A, B, C, material));
+      }
+      else if (tokenIs("plane"))
+      {
+         Vect normal;
+         double distance;
+         int material;
+         if (!vect(normal, "a plane normal") || !number(distance, "a plane distance") ||
+             !materialName(material))
+            return false;
+         scene.addObject(new Plane(normal, distance, material));
+      }
+      else if (tokenIs("mesh"))
+      {
+         int material;
+         if (!materialName(material))
+            return false;
+         mesh = new TriangleMesh(material);
+         scene.addObject(mesh);
+      }
+      else if (tokenIs("cube"))
+      {
+         Vect a, b;
+         int material;
+         if (!vect(a, "a cube corner") || !vect(b, "a cube corner") || !materialName(material))
+            return false;
+         scene.addObject(TriangleMesh::makeCube(a, b, material));
+      }
+      else if (tokenIs("light"))
+      {
+         Vect position;
+         Color color;
+         if (!vect(position, "a light position") || !colorName(color))
+            return false;
+         scene.addLight(new Light(position, color));
+      }
+      else if (tokenIs("color"))
+      {
+         NamedColor named;
+         double r, g, b, special;
+         if (!nextToken())
+            return fail("expected a color name");
+         named.name = tokenText();
+         if (!number(r, "a red value") || !number(g, "a green value") ||
+             !number(b, "a blue value") || !number(special, "a special value"))
+            return false;
+         named.color = Color(r, g, b);
+         named.material = scene.addMaterial(Material::fromSpecial(named.color, special));
+         colors.push_back(named);
+      }
+      else if (tokenIs("material")) // name r g b, then any properties
+      {
+         NamedColor named;
+         Material m;
+         double r, g, b;
+         if (!nextToken())
+            return fail("expected a material name");
+         named.name = tokenText();
+         if (!number(r, "a red value") || !number(g, "a green value") ||
+             !number(b, "a blue value"))
+            return false;
+         m.color = named.color = Color(r, g, b);
+         if (!materialProperties(m))
+            return false;
+         named.material = scene.addMaterial(m);
+         colors.push_back(named);
+      }
+      else if (tokenIs("camera"))
+      {
+         Vect position, focus;
+         if (!vect(position, "a camera position") || !vect(focus, "a camera focus"))
+            return false;
+         if (!Camera::canLookAt(position, focus))
+            return fail("the camera must look at a point apart from it, and not straight up or "
+                        "down");
+         scene.setCamera(Camera::lookAt(position, focus));
+         hasCamera = true;
+      }
+      else if (tokenIs("size"))
+      {
+         if (!integer(settings.width, "a width") || !integer(settings.height, "a height"))
+            return false;
+         if (settings.width < 1 || settings.height < 1 || settings.width > maxImageSize ||
+             settings.height > maxImageSize)
+            return fail("the image size must be from 1x1 to " + std::to_string(maxImageSize) +
+                        "x" + std::to_string(maxImageSize));
+      }
+      else if (tokenIs("crop")) // x y width height, from the top left corner
+      {
+         if (!integer(settings.cropX, "a crop x") || !integer(settings.cropY, "a crop y") ||
+             !integer(settings.cropWidth, "a crop width") ||
+             !integer(settings.cropHeight, "a crop height"))
+            return false;
+         if (settings.cropX < 0 || settings.cropY < 0 || settings.cropWidth < 1 ||
+             settings.cropHeight < 1)
+            return fail("the crop must start inside the frame and be at least 1x1");
+      }
+      else if (tokenIs("dpi"))
+      {
+         if (!integer(settings.dpi, "a dpi"))
+            return false;
+         if (settings.dpi < 1)
+            return fail("dpi must be at least 1");
+      }
+      else if (tokenIs("aadepth"))
+      {
+         if (!integer(settings.aadepth, "an anti-aliasing depth"))
+            return false;
+         if (settings.aadepth < 1)
+            return fail("aadepth must be at least 1");
+      }
+      else if (tokenIs("aathreshold"))
+      {
+         if (!number(settings.aathreshold, "an anti-aliasing threshold"))
+            return false;
+      }
+      else if (tokenIs("bounces"))
+      {
+         if (!integer(settings.maxBounces, "a bounce count"))
+            return false;
+         if (settings.maxBounces < 0 || settings.maxBounces > maxBounceLimit)
+            return fail("bounces must be between 0 and " + std::to_string(maxBounceLimit));
+      }
+      else if (tokenIs("cutoff"))
+      {
+         if (!number(settings.minThroughput, "a throughput cutoff"))
+            return false;
+         if (settings.minThroughput < 0)
+            return fail("cutoff must not be negative");
+      }
+      else if (tokenIs("ambient"))
+      {
+         if (!number(settings.ambientlight, "an ambient light level"))
+            return false;
+      }
+      else if (tokenIs("accuracy"))
+      {
+         if (!number(settings.accuracy, "an accuracy"))
+            return false;
+      }
+      else
+         return fail("unknown keyword \"" + tokenText() + "\"");
+
+      return endOfLine();
+   }
+
+public:
+   SceneLoader() : pos(NULL), line(0), token(NULL), tokenEnd(NULL), mesh(NULL)
+                 , hasCamera(false) {}
+
+   // reads the whole file, in directory if given, into memory. prints the
+   // problem and returns false if it can not
+   bool read(const char *name, int directory = AT_FDCWD)
+   {
+      filename = name;
+      line = 0;
+
+      FILE *file = fopenIn(directory, name, O_RDONLY, "rb");
+      if (file == NULL)
+         return fail(strerror(errno));
+
+      fseek(file, 0, SEEK_END);
+      long size = ftell(file);
+      fseek(file, 0, SEEK_SET);
+      if (size < 0)
+      {
+         fclose(file);
+         return fail(strerror(errno));
+      }
+
+      text.resize(size + 1);
+      size_t got = fread(&text[0], 1, size, file);
+      fclose(file);
+      if (got != (size_t)size)
+         return fail("cannot read the whole file");
+      text[size] = '\0';
+      return true;
+   }
+
+   // uses text already in memory instead of a file, name is only used in
+   // messages
+   void setText(const char *name, const std::string &source)
+   {
+      filename = name;
+      line = 0;
+      text.assign(source.begin(), source.end());
+      text.push_back('\0');
+   }
+
+   // the text read, without the terminating NUL
+   const char *getText() const { return &text[0];       }
+   size_t getTextSize() const  { return text.size() - 1; }
+
+   // fills the scene from the text read. prints the problem and returns
+   // false on an error, the scene then holds whatever was read before it
+   bool parse(Scene &scene)
+   {
+      colors.clear();
+      mesh = NULL;
+      hasCamera = false;
+      pos = &text[0];
+      for (line = 1; ; line++)
+      {
+         if (!parseLine(scene))
+            return false;
+         if (*pos == '\0')
+            break;
+         pos++; // past the newline
+      }
+
+      line = 0;
+      if (!hasCamera)
+         return fail("the scene has no camera");
+
+      // the text is not needed once the objects exist
+      std::vector<char>().swap(text);
+      return true;
+   }
+
+   bool load(const char *name, Scene &scene) { return read(name) && parse(scene); }
+};
+
+#endif
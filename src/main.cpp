@@ -10,267 +10,508 @@
 #include <iostream>
 #include <vector>
 #include <cmath>  // pow() sqrt()
-#include <cstdio> // files handling savebmp()
-#include <ctime>  // clock()
+#include <cstdio> // files handling BmpWriter
+#include <cstring>            // strerror()
+#include <cerrno>
+#include <cctype>             // tolower()
+#include <cstdlib>            // atoi()
+#include <string>
+#include <algorithm>          // min()
+#include <chrono>             // steady_clock
+#include <deque>
+#include <functional>
+#include <thread>             // render threads
+#include <mutex>
+#include <condition_variable>
+#include <limits>             // infinity()
+#include <climits>            // PATH_MAX
+#include <new>                // bad_alloc
+#include <immintrin.h>        // SSE2 and AVX2 kernels
+#include <charconv>           // from_chars() in the scene loader
+#include <fcntl.h>            // open() the scene cache
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>         // mmap()
+#include <csignal>            // stop a progressive render cleanly
+#include <sstream>            // benchmark scene text
+#include <fstream>            // benchmark report
+#include <list>
+#include <memory>             // shared_ptr
+#include <atomic>
+#include <sys/socket.h>       // coordinator and workers
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>      // TCP_NODELAY
+#include <netdb.h>            // getaddrinfo()
+#include <poll.h>
 
 // header files
+#include "alloccount.h"
+#include "real.h"
+#include "image.h"
+#include "profile.h"
 #include "vect.h"
-//#include "ray.h"
 #include "camera.h"
 #include "color.h"
+#include "material.h"
 #include "sources.h"
+#include "bbox.h"
+#include "column.h"
 #include "objects.h"
+#include "soa.h"
+#include "simd.h"
+#include "packet.h"
+#include "bvh.h"
+#include "mapped.h"
+#include "scene.h"
+#include "framebuffer.h"
+#include "microbench.h"
+#include "options.h"
+#include "scheduler.h"
+#include "loader.h"
+#include "cache.h"
+#include "accum.h"
+#include "bench.h"
+#include "shade.h"
+#include "render.h"
+#include "cluster.h"
+#include "server.h"
 
 using namespace std;
 
 /******************************************************************************
- * RGBTYPE STRUCT - this holds our red green and blue colors
+ * BENCH PRIMARY - traces only the first pass camera rays of the frame, one
+ *    ray at a time and then in packets, and reports the throughput of both
  *****************************************************************************/
-struct RGBType
+bool benchPrimary(const Scene &scene, TileScheduler &scheduler, int tileSize)
 {
-   double r; // red
-   double g; // green
-   double b; // blue
-};
+   const RenderSettings &settings = scene.getSettings();
+   const BVH &bvh = scene.getBVH();
+   vector<Tile> tiles = makeTiles(settings.width, settings.height, tileSize);
 
-/******************************************************************************
- * SAVEBMP - this takes our data and save it as a BMP image file.
- *****************************************************************************/
-void savebmp (const char *filename, int w, int h, int dpi, RGBType *data)
-{
-   FILE *fout;
-
-   int k = w*h;
-   int s = 4*k;
-   int filesize = 54 + s;
-
-   double factor = 39.375;
-   int m = static_cast<int>(factor);
+   // object hit by every camera ray, for checking the two modes agree
+   vector<int> hitObject[2];
+   const char *modes[2] = { "single", "packet" };
 
-   int ppm = dpi*m;
-
-   unsigned char bmpfileheader[14] = {'B','M', 0,0,0,0, 0,0,0,0, 54,0,0,0};
-   unsigned char bmpinfoheader[40] = {40,0,0,0, 0,0,0,0, 0,0,0,0, 1,0,24,0};
+   for (int mode = 0; mode < 2; mode++)
+   {
+      hitObject[mode].assign(settings.width * settings.height, -1);
 
-   bmpfileheader[ 2] = (unsigned char)(filesize);
-   bmpfileheader[ 3] = (unsigned char)(filesize >> 8);
-   bmpfileheader[ 4] = (unsigned char)(filesize >> 16);
-   bmpfileheader[ 5] = (unsigned char)(filesize >> 24);
+      TileScheduler::TileFunc visibility = [&](const Tile &tile, int thread)
+      {
+         RayPacket packet;
+         Hit hits[maxPacketRays];
+         bool found[maxPacketRays];
 
-   bmpinfoheader[ 4] = (unsigned char)(w);
-   bmpinfoheader[ 5] = (unsigned char)(w >> 8);
-   bmpinfoheader[ 6] = (unsigned char)(w >> 16);
-   bmpinfoheader[ 7] = (unsigned char)(w >> 24);
+         for (int by = tile.y0; by < tile.y1; by += packetWidth)
+            for (int bx = tile.x0; bx < tile.x1; bx += packetWidth)
+            {
+               int bx1 = std::min(bx + packetWidth, tile.x1);
+               int by1 = std::min(by + packetWidth, tile.y1);
 
-   bmpinfoheader[ 8] = (unsigned char)(h);
-   bmpinfoheader[ 9] = (unsigned char)(h >> 8);
-   bmpinfoheader[10] = (unsigned char)(h >> 16);
-   bmpinfoheader[11] = (unsigned char)(h >> 24);
+               packet.count = 0;
+               for (int y = by; y < by1; y++)
+                  for (int x = bx; x < bx1; x++)
+                     packet.add(cameraRay(scene, x, y, 0.5, 0.5));
 
-   bmpinfoheader[21] = (unsigned char)(s);
-   bmpinfoheader[22] = (unsigned char)(s >> 8);
-   bmpinfoheader[23] = (unsigned char)(s >> 16);
-   bmpinfoheader[24] = (unsigned char)(s >> 24);
+               if (mode == 1)
+               {
+                  packet.finish();
+                  bvh.closestHitPacket(packet, hits, found);
+               }
+               else
+               {
+                  for (int r = 0; r < packet.count; r++)
+                     found[r] = bvh.closestHit(packet.rays[r], hits[r]);
+               }
 
-   bmpinfoheader[25] = (unsigned char)(ppm);
-   bmpinfoheader[26] = (unsigned char)(ppm >> 8);
-   bmpinfoheader[27] = (unsigned char)(ppm >> 16);
-   bmpinfoheader[28] = (unsigned char)(ppm >> 24);
+               int r = 0;
+               for (int y = by; y < by1; y++)
+                  for (int x = bx; x < bx1; x++, r++)
+                     if (found[r])
+                        hitObject[mode][y * settings.width + x] = hits[r].index;
+            }
+      };
 
-   bmpinfoheader[29] = (unsigned char)(ppm);
-   bmpinfoheader[30] = (unsigned char)(ppm >> 8);
-   bmpinfoheader[31] = (unsigned char)(ppm >> 16);
-   bmpinfoheader[32] = (unsigned char)(ppm >> 24);
+      vector<WorkerStats> workerStats;
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      scheduler.run(tiles, visibility, workerStats);
+      chrono::duration<double> wall = chrono::steady_clock::now() - start;
 
-   fout = fopen(filename, "wb");
+      cout << "primary rays, " << modes[mode] << ": "
+           << hitObject[mode].size() / wall.count() / 1e6 << " Mrays/s" << endl;
+   }
 
-   fwrite(bmpfileheader,1,14,fout);
-   fwrite(bmpinfoheader,1,40,fout);
+   traversalStats() = TraversalStats();
 
-   for (int i = 0; i < k; i++)
+   if (hitObject[0] != hitObject[1])
    {
-      double red   = (data[i].r)*255;
-      double green = (data[i].g)*255;
-      double blue  = (data[i].b)*255;
-
-      unsigned char color[3] = {(int)floor(blue),
-                                (int)floor(green), 
-                                (int)floor(red)};
-
-      fwrite(color,1,3,fout);
+      cout << "packet and single ray hits DIFFER" << endl;
+      return false;
    }
-
-   fclose(fout);
+   return true;
 }
 
 /******************************************************************************
- * WINNING OBJECT INDEX - returns the index of the winning intersection
+ * BENCH WAVEFRONT - renders the frame with the recursive integrator and
+ *    then the wavefront one, options.benchRuns times each, and reports the
+ *    fastest run of each. false unless both make the same image
  *****************************************************************************/
-int winningObjectIndex(vector<double> objInt)
+bool benchWavefront(Scene &scene, TileScheduler &scheduler, const Options &options)
 {
-   int iMinVal; // index of minimum value
-   int size = objInt.size();
+   const char *modes[2] = { "recursive", "wavefront" };
+   const char *files[2] = { "bench_recursive.bmp", "bench_wavefront.bmp" };
+   double best[2];
 
-   if (size == 0)        // no objects
-      return -1;
-   else if (size == 1)   // only one object
+   for (int mode = 0; mode < 2; mode++)
    {
-      if (objInt.at(0) > 0)
-         return 0; // this is it
-      else
-         return -1; // it missed
-   }
-   else                  // many objects
-   {
-      // first find the max value
-      double max = 0;
-      for (int i = 0; i < size; i++)
-         if (max < objInt.at(i))
-            max = objInt.at(i);
-
-      // then find the min positive value
-      if (max > 0)
+      scene.getSettings().wavefront = mode == 1;
+      best[mode] = numeric_limits<double>::infinity();
+      for (int run = 0; run < options.benchRuns; run++)
       {
-         for (int i = 0; i < size; i++)
-            if (objInt.at(i) > 0 && objInt.at(i) <= max)
-            {
-               max = objInt.at(i);
-               iMinVal = i;
-            }
-         return iMinVal;
+         FrameStats frame;
+         if (!renderFrame(scene, scheduler, options, files[mode], bmpFormat, frame))
+            return false;
+         best[mode] = std::min(best[mode], frame.renderSeconds - frame.writeSeconds);
       }
-      else // all intersections were negative
-         return -1;
+      cout << modes[mode] << ": " << best[mode] << " s" << endl;
    }
+   cout << "wavefront is " << best[0] / best[1] << "x the speed of recursive" << endl;
+
+   bool same = compareImages(files[0], files[1], 0, 0);
+   remove(files[0]);
+   remove(files[1]);
+   if (!same)
+      cout << "the integrators' images DIFFER" << endl;
+   return same;
 }
 
 /******************************************************************************
- * GET COLOR AT - returns the color determained by ray intersections
+ * RUN BENCH - renders every standard scene options.benchRuns times from its
+ *    text, prints the median run of each and writes every run to the JSON
+ *    report options.benchOut. the images go to bench.bmp
  *****************************************************************************/
-Color getColorAt(Vect intPos, Vect intDir, vector<Object*> sObjects
-                , int iWinObj, vector<Source*> lSources
-                , double accuracy, double ambientlight)
+bool runBench(const Options &options, const IntersectKernels *kernels)
 {
-   Color iWinColor = sObjects.at(iWinObj)->getColor();
-   Vect iWinNorm = sObjects.at(iWinObj)->getNormalAt(intPos);
+   TileScheduler scheduler (options.threads);
+   vector<BenchScene> results;
 
-   // this adds the checkerboard
-   if (iWinColor.getColorSpecial() == 2)
+   for (int s = 0; s < benchSceneCount; s++)
    {
-      // checkered/tile floor pattern
-      int square = (int)floor(intPos.getVectX()) + (int)floor(intPos.getVectZ());
+      string text = benchSceneText(benchSceneNames[s]);
+      BenchScene result;
+      result.name = benchSceneNames[s];
 
-      if ((square % 2) == 0)         // black tile
-         iWinColor = Color(0,0,0,0);
-      else                           // white tile
-         iWinColor = Color(1,1,1,0);
-   }
+      for (int run = 0; run < options.benchRuns; run++)
+      {
+         Scene scene;
+         BenchRun timing;
+         chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+         SceneLoader loader;
+         loader.setText(benchSceneNames[s], text);
+         if (!loader.parse(scene))
+            return false;
+         chrono::steady_clock::time_point loaded = chrono::steady_clock::now();
+
+         if (kernels != NULL)
+            scene.getBVH().setKernels(kernels);
+         scene.build();
+         chrono::steady_clock::time_point built = chrono::steady_clock::now();
+
+         if (!applyOptions(options, scene))
+            return false;
+
+         FrameStats frame;
+         if (!renderFrame(scene, scheduler, options, "bench.bmp", bmpFormat, frame))
+            return false;
+
+         timing.load = chrono::duration<double>(loaded - start).count();
+         timing.build = chrono::duration<double>(built - loaded).count();
+         timing.trace = frame.traceSeconds;
+         timing.shade = frame.shadeSeconds;
+         timing.write = frame.writeSeconds;
+         timing.wall = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+         timing.rays = frame.traversal.rays;
+         timing.samples = frame.samples;
+         result.runs.push_back(timing);
+
+         if (run == 0)
+         {
+            const vector<Object*> &objects = scene.getObjects();
+            result.objects = objects.size();
+            result.triangles = 0;
+            for (int i = 0; i < (int)objects.size(); i++)
+               if (TriangleMesh *mesh = dynamic_cast<TriangleMesh*>(objects[i]))
+                  result.triangles += mesh->getTriangleCount();
+            result.lights = scene.getLights().size();
+            result.width = scene.getSettings().width;
+            result.height = scene.getSettings().height;
+         }
+      }
 
-   Color finalColor = iWinColor.colorScalar(ambientlight);
+      const BenchRun &median = result.median();
+      cout << result.name << ": " << median.wall << " s, "
+           << median.raysPerSecond() / 1e6 << " Mrays/s (load " << median.load
+           << ", build " << median.build << ", trace " << median.trace
+           << ", shade " << median.shade << ", write " << median.write << ")" << endl;
+      results.push_back(result);
+   }
 
-   // reflection
-   if (iWinColor.getColorSpecial() > 0 && iWinColor.getColorSpecial() <= 1)
+   ofstream report (options.benchOut.c_str());
+   writeBenchJson(report, results, scheduler.getThreadCount(),
+                  kernels != NULL ? kernels->name : bestKernels()->name,
+                  options.wavefront ? "wavefront" : "recursive");
+   report.close();
+   if (!report)
    {
-      // reflection from objects with specular intensity
-      double dot1  = iWinNorm.dotProduct(intDir.negative());
-      Vect scalar1 = iWinNorm.vectMult(dot1);
-      Vect add1    = scalar1.vectAdd(intDir);
-      Vect scalar2 = add1.vectMult(2);
-      Vect add2    = intDir.negative().vectAdd(scalar2);
-      Vect refDir  = add2.normalize();
+      cerr << "could not write the benchmark report " << options.benchOut << endl;
+      return false;
+   }
+   cout << "report written to " << options.benchOut << endl;
+   return true;
+}
 
-      Ray reflectRay (intPos, refDir);
+// pass 0 traces one pixel in every previewStep x previewStep block
+const int previewStep = 4;
 
-      // determine what the ray intersects with first
-      vector<double> reflectInt;
+/******************************************************************************
+ * PASS OFFSET - where in the pixel the sample of a progressive pass goes.
+ *    passes 0 and 1 sample the middle, later passes follow the R2 sequence
+ *    so every new sample lands away from the ones before it
+ *****************************************************************************/
+void passOffset(int pass, double &sx, double &sy)
+{
+   int n = std::max(pass - 1, 0);
+   sx = 0.5 + n * 0.7548776662466927;
+   sy = 0.5 + n * 0.5698402909980532;
+   sx -= floor(sx);
+   sy -= floor(sy);
+}
 
-      for (int iRef = 0; iRef < sObjects.size(); iRef++)
+/******************************************************************************
+ * RENDER PASS TILE - adds one sample of a progressive pass to every pixel
+ *    of the tile that takes part in it. pass 0 samples the first pixel of
+ *    each preview block, pass 1 every pixel not yet sampled, later passes
+ *    the pixels marked in accum.refine. the accumulation buffer covers the
+ *    rendered region, pixel (x0, y0) of the frame is its first
+ *****************************************************************************/
+void renderPassTile(const Scene &scene, const Tile &tile, int pass, AccumBuffer &accum,
+                    int x0, int y0)
+{
+   const RenderSettings &settings = scene.getSettings();
+   const BVH &bvh = scene.getBVH();
+   double sx, sy;
+   passOffset(pass, sx, sy);
+
+   RayPacket packet;
+   Hit hits[maxPacketRays];
+   bool found[maxPacketRays];
+   int px[maxPacketRays], py[maxPacketRays];
+
+   for (int by = tile.y0; by < tile.y1; by += packetWidth)
+      for (int bx = tile.x0; bx < tile.x1; bx += packetWidth)
       {
-         reflectInt.push_back(sObjects.at(iRef)->findIntersection(reflectRay));
-      }
+         int bx1 = std::min(bx + packetWidth, tile.x1);
+         int by1 = std::min(by + packetWidth, tile.y1);
 
-      int iWinObjReflect = winningObjectIndex(reflectInt);
+         packet.count = 0;
+         for (int y = by; y < by1; y++)
+            for (int x = bx; x < bx1; x++)
+            {
+               int ax = x - x0, ay = y - y0; // in the buffer
+               bool take;
+               if (pass == 0)
+                  take = (ax % previewStep == 0) && (ay % previewStep == 0);
+               else if (pass == 1)
+                  take = accum.at(ax, ay).samples == 0;
+               else
+                  take = accum.refine[ay * accum.getWidth() + ax];
 
-      if (iWinObjReflect != -1)
-      {
-         // reflection ray missed everything else
-         if(reflectInt.at(iWinObjReflect) > accuracy)
-         {
-            // determin the position and direction at the point of intersection
-            // the ray only affects the color if it reflected off something
-            Vect refIntPos = intPos.vectAdd(refDir.vectMult(reflectInt.at(iWinObjReflect)));
-            Vect refIntDir = refDir;
+               if (take)
+               {
+                  px[packet.count] = ax;
+                  py[packet.count] = ay;
+                  packet.add(cameraRay(scene, x, y, sx, sy));
+               }
+            }
 
-            // this process is recursive
-            Color refIntColor = getColorAt(refIntPos, refIntDir, sObjects, 
-                                           iWinObjReflect, lSources, accuracy, ambientlight);
+         if (packet.count == 0)
+            continue;
 
-            finalColor = finalColor.colorAdd(refIntColor.colorScalar(iWinColor.getColorSpecial()));
+         PROFILE(double profileStart = profileClock());
+         if (settings.packets)
+         {
+            packet.finish();
+            bvh.closestHitPacket(packet, hits, found);
+         }
+         else
+         {
+            for (int r = 0; r < packet.count; r++)
+               found[r] = bvh.closestHit(packet.rays[r], hits[r]);
+         }
+         PROFILE(profileRays(primaryRays, packet.count, profileStart));
+
+         int order[maxPacketRays];
+         shadeOrder(hits, found, packet.count, order);
+         for (int i = 0; i < packet.count; i++)
+         {
+            int r = order[i];
+            accum.add(px[r], py[r], shadeSample(scene, packet.rays[r], found[r] ? &hits[r] : NULL));
          }
       }
-   }
+}
 
-   // shadows
-   for (int iLight = 0; iLight < lSources.size(); iLight++)
+/******************************************************************************
+ * SAVE ACCUMULATED - writes the current state of a progressive render to
+ *    the image
+ *****************************************************************************/
+bool saveAccumulated(const AccumBuffer &accum, int dpi, const char *filename,
+                     ImageFormat format)
+{
+   ImageWriter image;
+   if (!image.open(filename, format, accum.getWidth(), accum.getHeight(), dpi))
+      return false;
+
+   vector<RGBType> row (accum.getWidth());
+   for (int y = 0; y < accum.getHeight(); y++)
    {
-      Vect lightDir = lSources.at(iLight)->getLightPosition().vectAdd(intPos.negative()).normalize();
+      for (int x = 0; x < accum.getWidth(); x++)
+         row[x] = accum.average(x, y, previewStep);
+      if (!image.writeRows(&row[0], 1))
+         return false;
+   }
+   return image.close();
+}
 
-      float cosAngle = iWinNorm.dotProduct(lightDir);
+/******************************************************************************
+ * RENDER PROGRESSIVE - renders the frame in passes: a preview at a quarter
+ *    of the resolution, every pixel once, then one more sample per pass for
+ *    pixels on an edge until they have aadepth x aadepth. the image is
+ *    saved after every pass. stops early, keeping what it has, when the
+ *    time budget runs out or a stop is requested, and saves the progress
+ *    to the checkpoint file now and then so a later run can resume it
+ *****************************************************************************/
+bool renderProgressive(const Scene &scene, TileScheduler &scheduler, const Options &options,
+                       unsigned long long key)
+{
+   const RenderSettings &settings = scene.getSettings();
+   int x0, y0, x1, y1;
+   settings.region(x0, y0, x1, y1);
+   int width = x1 - x0;
+   int height = y1 - y0;
+   int lastPass = settings.aadepth * settings.aadepth;
+
+   chrono::steady_clock::time_point start = chrono::steady_clock::now();
+   chrono::steady_clock::time_point lastCheckpoint = start;
+
+   AccumBuffer accum (width, height);
+   if (options.resume && !options.checkpoint.empty())
+   {
+      if (accum.load(options.checkpoint, key))
+         cout << "resuming " << options.checkpoint << " at pass " << accum.pass
+              << ", row " << accum.nextRow << endl;
+      else
+         cout << "no usable checkpoint in " << options.checkpoint << ", starting over" << endl;
+   }
 
-      if (cosAngle > 0)
-      {
-         // test for shadows
-         bool shadowed = false;
+   signal(SIGINT, requestStop);
+   signal(SIGTERM, requestStop);
 
-         Vect lightDist = lSources.at(iLight)->getLightPosition().vectAdd(intPos.negative()).normalize();
-         float lightDistMagnitude = lightDist.magnitude();
+   // bands of tile rows, each with enough tiles to keep every thread busy
+   int tilesPerRow = (width + options.tileSize - 1) / options.tileSize;
+   int bandTileRows = (8 * options.threads + tilesPerRow - 1) / tilesPerRow;
+   int bandHeight = std::min(bandTileRows * options.tileSize, height);
 
-         Ray shadowRay (intPos, lSources.at(iLight)->getLightPosition().vectAdd(intPos.negative()).normalize());
-         
-         vector<double> intersectTwo;
+   bool finished = true;
 
-         for (int iObj = 0; iObj < sObjects.size() && shadowed == false; iObj++)
-            intersectTwo.push_back(sObjects.at(iObj)->findIntersection(shadowRay));
+   for (; accum.pass <= lastPass && finished; accum.pass++, accum.nextRow = 0)
+   {
+      // pixels on an edge of the image so far get the extra samples. a
+      // resumed pass keeps the pixels it was started with
+      if (accum.pass >= 2 && accum.nextRow == 0)
+      {
+         vector<RGBType> current (width * height);
+         for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+               current[y * width + x] = accum.average(x, y, previewStep);
 
-         for (int c = 0; c < intersectTwo.size(); c++)
-         {
-            if (intersectTwo.at(c) > accuracy)
+         for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
             {
-               if (intersectTwo.at(c) <= lightDistMagnitude)
-               {
-                  shadowed = true;
-               }
-               break;
+               RGBType &c = current[y * width + x];
+               Real difference = 0;
+               for (int ny = std::max(y - 1, 0); ny < std::min(y + 2, height); ny++)
+                  for (int nx = std::max(x - 1, 0); nx < std::min(x + 2, width); nx++)
+                  {
+                     RGBType &n = current[ny * width + nx];
+                     difference = std::max(difference, std::max(std::fabs(c.r - n.r),
+                                  std::max(std::fabs(c.g - n.g), std::fabs(c.b - n.b))));
+                  }
+               accum.refine[y * width + x] = difference >= settings.aathreshold;
             }
-         }
+      }
+
+      TileScheduler::TileFunc passFunc = [&](const Tile &tile, int thread)
+      {
+         renderPassTile(scene, tile, accum.pass, accum, x0, y0);
+         traversalStats() = TraversalStats();
+      };
 
-         if (shadowed == false)
+      for (int row = accum.nextRow; row < height; row += bandHeight)
+      {
+         chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+         if (stopRequested || (options.timeBudget > 0 && elapsed.count() >= options.timeBudget))
          {
-            finalColor = finalColor.colorAdd(iWinColor.colorMultiply(lSources.at(iLight)->getLightColor()).colorScalar(cosAngle));
+            accum.nextRow = row;
+            finished = false;
+            break;
+         }
 
-            // shinines
-            if (iWinColor.getColorSpecial() > 0 && iWinColor.getColorSpecial() <= 1)
-            {
-               // special [0-1]
-               double dot1 = iWinNorm.dotProduct(intDir.negative());
-               Vect scalar1 = iWinNorm.vectMult(dot1);
-               Vect add1 = scalar1.vectAdd(intDir);
-               Vect scalar2 = add1.vectMult(2);
-               Vect add2 = intDir.negative().vectAdd(scalar2);
-               Vect refDir = add2.normalize();
-
-               double specular = refDir.dotProduct(lightDir);
-               if (specular > 0)
-               {
-                  specular = pow(specular, 10);
-                  finalColor = finalColor.colorAdd(lSources.at(iLight)->getLightColor().colorScalar(specular*iWinColor.getColorSpecial()));
-               }
-            }
+         int rowEnd = std::min(row + bandHeight, height);
+         vector<WorkerStats> stats;
+         scheduler.run(makeTiles(x0, y0 + row, x1, y0 + rowEnd, options.tileSize), passFunc, stats);
+         accum.nextRow = rowEnd;
+
+         chrono::duration<double> sinceCheckpoint = chrono::steady_clock::now() - lastCheckpoint;
+         if (!options.checkpoint.empty() && sinceCheckpoint.count() >= options.checkpointEvery)
+         {
+            if (!accum.save(options.checkpoint, key))
+               cerr << "could not write the checkpoint " << options.checkpoint << endl;
+            lastCheckpoint = chrono::steady_clock::now();
          }
       }
+
+      if (!finished)
+         break;
+
+      if (!saveAccumulated(accum, settings.dpi, options.output.c_str(), options.format))
+         return false;
+      cout << "pass " << accum.pass << " done after "
+           << chrono::duration<double>(chrono::steady_clock::now() - start).count()
+           << " seconds" << endl;
    }
 
-   return finalColor.clip();
+   if (!finished)
+   {
+      cout << (stopRequested ? "stopped" : "time budget used up") << " in pass "
+           << accum.pass << " at row " << accum.nextRow << endl;
+      if (!saveAccumulated(accum, settings.dpi, options.output.c_str(), options.format))
+         return false;
+   }
+
+   if (!options.checkpoint.empty())
+   {
+      if (!accum.save(options.checkpoint, key))
+      {
+         cerr << "could not write the checkpoint " << options.checkpoint << endl;
+         return false;
+      }
+      cout << "progress saved to " << options.checkpoint << endl;
+   }
+
+   return true;
 }
 
 /******************************************************************************
@@ -278,237 +519,187 @@ Color getColorAt(Vect intPos, Vect intDir, vector<Object*> sObjects
  *****************************************************************************/
 int main (int argc, char *argv[])
 {
-   cout << ">>> RENDERING..." << endl;
+   Options options;
+   if (!parseOptions(argc, argv, options))
+      return 1;
 
-   // time the process
-   clock_t start, end;
-   start = clock();
-
-   // initialize variables
-   int dpi    = 72;
-   int width  = 640;
-   int height = 480;
-   int n = width * height; // total pixels in image
-   RGBType *pixels = new RGBType[n];
-
-   // scene properties
-   int aadepth = 1; // the higher the value the longer it takes
-   double accuracy = 0.00000001;
-   double ambientlight = 0.2;
-   double aathreshold = 0.1;
-   double aspectratio = (double)width / (double)height;
-   
-   // standard vectors
-   Vect X (1,0,0);
-   Vect Y (0,1,0);
-   Vect Z (0,0,1);
-   Vect O (0,0,0); // origin
-
-   Vect Pos1 ( 1.75, -0.25, 0);
-   Vect Pos2 (-1.75, -0.25, 0);
-
-   // define camera
-   Vect campos (3, 1.5, -4);
-   Vect focus = O;
-   Vect diffBTW ( campos.getVectX() - focus.getVectX()
-                , campos.getVectY() - focus.getVectY()
-                , campos.getVectZ() - focus.getVectZ() );
-
-   Vect camdir = diffBTW.negative().normalize();
-   Vect camright = Y.crossProduct(camdir).normalize();
-   Vect camdown = camright.crossProduct(camdir);
-   Camera camera (campos, camdir, camright, camdown);
-
-   // colors
-   Color white  ( 1.0,  1.0,  1.0, 0); // special 0 = solid color
-   Color gray   ( 0.5,  0.5,  0.5, 0);
-   Color black  ( 0.0,  0.0,  0.0, 0);
-   Color maroon ( 0.5, 0.25, 0.25, 0);
-   Color orange (0.94, 0.75, 0.31, 0);
-
-   Color greenShine  ( 0.5,  1.0,  0.5, 0.3); // special [0,1] reflective
-   Color maroonShine ( 0.5, 0.25, 0.25, 0.3);
-   Color orangeShine (0.94, 0.75, 0.31, 0.3);
-   Color blackShine  (0,0,0,0.3);
-
-   Color tile (1, 1, 1, 2); // special 2 = checkered
-
-   // scene objects
-   Sphere sphere1 (   O,    1,  greenShine);
-   Sphere sphere2 (Pos1, 0.75, maroonShine);
-   Sphere sphere3 (Pos2, 0.75, orangeShine);
-   Plane ground (Y, -1, tile);
-   //Triangle scene_triangle (Vect(3,0,0), Vect(0,3,0), Vect(0,0,3), orange);
-
-   vector<Object*> sObjects;
-   sObjects.push_back(dynamic_cast<Object*>(&sphere1));
-   sObjects.push_back(dynamic_cast<Object*>(&sphere2));
-   sObjects.push_back(dynamic_cast<Object*>(&sphere3));
-   sObjects.push_back(dynamic_cast<Object*>(&ground));
-   //sObjects.push_back(dynamic_cast<Object*>(&scene_triangle));
-
-   //makeCube(Vect (1,1,1), Vect (-1,-1,-1), orange);
-
-   // light source (s)
-   Vect lightPos1 (-7,10,-10);
-   //Vect lightPos2 (14,10,-10);
-   Light light1 (lightPos1, white);
-   //Light light2 (lightPos2, gray);
-
-   vector<Source*> lSources;
-   lSources.push_back(dynamic_cast<Source*>(&light1));
-   //lSources.push_back(dynamic_cast<Source*>(&light2));
-
-   int curPixel, aaIndex;
-   double xamnt, yamnt; // amounts
-   //double tempRed, tempGreen, tempBlue;
-
-   // go through every pickel and return the color;
-   for (int x = 0; x < width; x++)
+   if (options.benchKernels)
+      return benchKernels(4096, 2000) ? 0 : 1;
+
+   if (options.benchVectors)
+      return benchVectors(4096, 1000) ? 0 : 1;
+
+   if (!options.compareA.empty())
+      return compareImages(options.compareA.c_str(), options.compareB.c_str(),
+                           options.tolerance, options.maxOutliers) ? 0 : 1;
+
+   const IntersectKernels *kernels = NULL;
+   if (!options.kernels.empty())
    {
-      for (int y = 0; y < height; y++)
+      kernels = findKernels(options.kernels);
+      if (kernels == NULL)
       {
-         curPixel = y * width + x; // the actual pixel coordinates
+         cerr << "kernels " << options.kernels << " are not supported here" << endl;
+         return 1;
+      }
+   }
 
-         // start with a blank pixel
-         double tempRed[aadepth*aadepth];
-         double tempGreen[aadepth*aadepth];
-         double tempBlue[aadepth*aadepth];
+   if (options.bench)
+      return runBench(options, kernels) ? 0 : 1;
 
-         for (int aax = 0; aax < aadepth; aax++)
-         {
-            for (int aay = 0; aay < aadepth; aay++)
-            {
-               aaIndex = aay*aadepth + aax;
+   if (!options.worker.empty())
+      return runWorker(options, kernels) ? 0 : 1;
 
-               //srand(time(0));
+   if (!options.serve.empty())
+      return runServer(options, kernels) ? 0 : 1;
 
-               // create the ray from the camera to this pixel
-               if (aadepth == 1)
-               {
-                  // start with no anti-aliasing
-                  if (width > height)
-                  {
-                     // the image is wider than it is tall
-                     xamnt = ((x+0.5)/width)*aspectratio - (((width - height)/(double)height)/2);
-                     yamnt = ((height -y)+0.5)/height;
-                  }
-                  else if (height > width)
-                  {
-                     // the image is taller than it is wide
-                     xamnt = (x + 0.5)/width;
-                     yamnt = (((height-y)+0.5)/height)/aspectratio - (((height - width)/(double)width)/2);
-                  }
-                  else
-                  {
-                     // the image is square
-                     xamnt = (x + 0.5)/width;
-                     yamnt = ((height - y)+ 0.5)/height;
-                  }
-               }
-               else
-               {
-                  // anti-aliasing
-                  if (width > height)
-                  {
-                     // the image is wider than it is tall
-                     xamnt = ((x+(double)aax/((double)aadepth - 1))/width)*aspectratio 
-                           - (((width - height)/(double)height)/2);
-                     yamnt = ((height -y)+(double)aax/((double)aadepth - 1))/height;
-                  }
-                  else if (height > width)
-                  {
-                     // the image is taller than it is wide
-                     xamnt = (x + (double)aax/((double)aadepth - 1))/width;
-                     yamnt = (((height-y)+(double)aax/((double)aadepth - 1))/height)/aspectratio 
-                           - (((height - width)/(double)width)/2);
-                  }
-                  else
-                  {
-                     // the image is square
-                     xamnt = (x + (double)aax/((double)aadepth - 1))/width;
-                     yamnt = ((height - y)+ (double)aax/((double)aadepth - 1))/height;
-                  }
-               }
+   if (!options.submit.empty() || !options.serverStats.empty())
+      return submitJob(options) ? 0 : 1;
 
+   cout << ">>> RENDERING..." << endl;
 
-               // create rays
-               Vect camRayOrg = camera.getCameraPosition();
-               Vect camRayDir = camdir.vectAdd(camright.vectMult(xamnt - 0.5)
-                                              .vectAdd(camdown.vectMult(yamnt - 0.5))).normalize();
+   // time the whole run, loading included
+   chrono::steady_clock::time_point start = chrono::steady_clock::now();
 
-               Ray cam_ray (camRayOrg, camRayDir);
+   // everything the render threads share, built once and then read only
+   Scene scene;
+   string cachePath = options.scene + ".cache";
+   unsigned long long sceneTextHash = 0;
+   bool fromCache = false;
 
-               vector<double> intersections;
+   chrono::steady_clock::time_point loadStart = chrono::steady_clock::now();
+   if (options.scene.empty())
+      buildDefaultScene(scene);
+   else
+   {
+      // a cache made from this exact text skips parsing and the BVH build
+      SceneLoader loader;
+      if (!loader.read(options.scene.c_str()))
+         return 1;
+      sceneTextHash = sceneHash(loader.getText(), loader.getTextSize());
+      fromCache = options.cache && loadSceneCache(cachePath, sceneTextHash, scene);
+      if (!fromCache && !loader.parse(scene))
+         return 1;
+   }
+   chrono::duration<double> loadTime = chrono::steady_clock::now() - loadStart;
+   cout << "scene: " << scene.getObjects().size() << " objects and "
+        << scene.getLights().size() << " lights "
+        << (options.scene.empty() ? "built" : fromCache ? "loaded from cache" : "loaded")
+        << " in " << loadTime.count() * 1000 << " ms" << endl;
 
-               for (int index = 0; index < sObjects.size(); index++)
-               {
-                  intersections.push_back(sObjects.at(index)->findIntersection(cam_ray));
-               }
+   if (kernels != NULL)
+      scene.getBVH().setKernels(kernels);
 
-               int iWinObj = winningObjectIndex(intersections);
+   if (!fromCache)
+      scene.build();
 
-               // return color
-               if(iWinObj == -1)
-               {
-                  // set the background black
-                  tempRed[aaIndex] = 0;
-                  tempGreen[aaIndex] = 0;
-                  tempBlue[aaIndex] = 0;
-               }
-               else
-               {
-                  // index coresponds to an object in our scene
-                  if (intersections.at(iWinObj) > accuracy)
-                  {
-                     // determin the position and direction vectors at the point of intersection
+   if (!fromCache && !options.scene.empty() && options.cache)
+   {
+      chrono::steady_clock::time_point saveStart = chrono::steady_clock::now();
+      if (saveSceneCache(cachePath, sceneTextHash, scene))
+         cout << "scene cache written to " << cachePath << " in "
+              << chrono::duration<double>(chrono::steady_clock::now() - saveStart).count() * 1000
+              << " ms" << endl;
+      else
+         cerr << "could not write the scene cache " << cachePath << endl;
+   }
 
-                     Vect intPos = camRayOrg.vectAdd(camRayDir.vectMult(intersections.at(iWinObj)));
-                     Vect intDir = camRayDir;
+   if (!applyOptions(options, scene))
+      return 1;
 
-                     Color intersectColor = getColorAt( intPos, intDir, sObjects
-                                                      , iWinObj, lSources, accuracy, ambientlight);
+   const RenderSettings &settings = scene.getSettings();
+   const BVH &bvh = scene.getBVH();
+   cout << "BVH: " << bvh.getNodeCount() << " nodes over " << bvh.getBoundedCount()
+        << " objects (" << bvh.getUnboundedCount() << " unbounded) ";
+   if (fromCache)
+      cout << "from the cache, ";
+   else
+      cout << "built in " << bvh.getBuildSeconds() * 1000 << " ms, ";
+   cout << bvh.getKernels()->name << " kernels" << endl;
 
-                     tempRed[aaIndex] = intersectColor.getColorRed();
-                     tempGreen[aaIndex] = intersectColor.getColorGreen();
-                     tempBlue[aaIndex] = intersectColor.getColorBlue();
-                  }
-               }
-            }
-         }
+   // or to worker processes, before any render thread is started
+   if (!options.coordinator.empty())
+      return renderDistributed(scene, options) ? 0 : 1;
 
-         // average the pixel color
-         double totalRed = 0;
-         double totalGreen = 0;
-         double totalBlue = 0;
-
-         for (int iRed = 0; iRed < aadepth*aadepth; iRed++)
-            totalRed = totalRed + tempRed[iRed];
-         for (int iGreen = 0; iGreen < aadepth*aadepth; iGreen++)
-            totalGreen = totalGreen + tempGreen[iGreen];
-         for (int iBlue = 0; iBlue < aadepth*aadepth; iBlue++)
-            totalBlue = totalBlue + tempBlue[iBlue];
-
-         double avgRed = totalRed/(aadepth*aadepth);
-         double avgGreen = totalGreen/(aadepth*aadepth);
-         double avgBlue = totalBlue/(aadepth*aadepth);
-
-         pixels[curPixel].r = avgRed;
-         pixels[curPixel].g = avgGreen;
-         pixels[curPixel].b = avgBlue;
+   // hand the tiles out to the render threads
+   TileScheduler scheduler (options.threads);
+
+   if (options.benchPrimary)
+      return benchPrimary(scene, scheduler, options.tileSize) ? 0 : 1;
+
+   if (options.benchWavefront)
+      return benchWavefront(scene, scheduler, options) ? 0 : 1;
+
+   if (options.progressive)
+   {
+      // a checkpoint only resumes the same scene with the same settings,
+      // seen from the same camera
+      const Camera &camera = scene.getCamera();
+      const Vect *view[4] = { &camera.getCameraPosition(), &camera.getCameraDirection(),
+                              &camera.getCamRight(), &camera.getCamDown() };
+      double keyed[12 + 12] = { (double)settings.width, (double)settings.height,
+                                (double)settings.aadepth, settings.aathreshold,
+                                settings.ambientlight, settings.accuracy,
+                                (double)settings.maxBounces, settings.minThroughput,
+                                (double)settings.cropX, (double)settings.cropY,
+                                (double)settings.cropWidth, (double)settings.cropHeight };
+      for (int v = 0; v < 4; v++)
+      {
+         keyed[12 + v * 3] = view[v]->getVectX();
+         keyed[12 + v * 3 + 1] = view[v]->getVectY();
+         keyed[12 + v * 3 + 2] = view[v]->getVectZ();
       }
+      unsigned long long key = sceneTextHash ^ sceneHash((const char *)keyed, sizeof(keyed));
+      return renderProgressive(scene, scheduler, options, key) ? 0 : 1;
    }
 
-   // save our pixels to the image
-   savebmp("scene.bmp", width, height, dpi, pixels);
+   FrameStats frame;
+   if (!renderFrame(scene, scheduler, options, options.output.c_str(), options.format, frame))
+      return 1;
 
-   // clean up
-   delete pixels;//, tempRed, tempGreen, tempBlue;
+   // per thread timing for capacity planning
+   cout << frame.tiles << " tiles on " << scheduler.getThreadCount()
+        << " threads in " << frame.renderSeconds << " seconds (wall)" << endl;
+   for (int i = 0; i < (int)frame.workers.size(); i++)
+   {
+      const WorkerStats &worker = frame.workers[i];
+      double load = frame.renderSeconds > 0 ? worker.busySeconds / frame.renderSeconds : 0;
+      cout << "   thread " << i << ": " << worker.busySeconds << " s busy ("
+           << (int)(load * 100) << "%), " << worker.tilesRendered << " tiles, "
+           << worker.tilesStolen << " stolen" << endl;
+   }
+   int x0, y0, x1, y1;
+   settings.region(x0, y0, x1, y1);
+   cout << "image written to " << options.output << " (" << x1 - x0 << "x" << y1 - y0;
+   if (settings.cropped())
+      cout << " cropped from " << settings.width << "x" << settings.height << " at "
+           << settings.cropX << " " << settings.cropY;
+   cout << ") in " << frame.bands << " bands of " << frame.bandHeight
+        << " rows, " << frame.writeSeconds * 1000 << " ms" << endl;
+
+   if (frame.traversal.rays > 0)
+      cout << frame.traversal.rays << " rays, "
+           << (double)frame.traversal.nodesVisited / frame.traversal.rays
+           << " nodes visited and " << (double)frame.traversal.primTests / frame.traversal.rays
+           << " intersection tests per ray" << endl;
+
+   cout << (double)frame.samples / ((x1 - x0) * (y1 - y0))
+        << " samples per pixel (adaptive, up to " << (1 << (2 * aaRefineDepth(settings.aadepth)))
+        << ", threshold " << settings.aathreshold << ")" << endl;
+
+   cout << frame.allocations << " heap allocations while tracing the frame" << endl;
+
+   PROFILE(printProfile(cout, frame.profile));
+   if (!options.heatmap.empty())
+   {
+      if (!writeHeatmap(options.heatmap.c_str(), settings.dpi))
+         return 1;
+      cout << "cost heatmap written to " << options.heatmap << endl;
+   }
 
-   // end the time and display the render time
-   end = clock();
-   float diff = ((float)end - (float)start)/1000;
-   cout << diff << " seconds" << endl;
+   // display the total time from start to finish
+   chrono::duration<double> total = chrono::steady_clock::now() - start;
+   cout << total.count() << " seconds (wall)" << endl;
 
    return 0;
 }
@@ -0,0 +1,67 @@
+/******************************************************************************
+* Header:
+*   Mapped
+* Desc:
+*   Contains the MappedFile class, a read only memory mapping of a whole
+*   file that is unmapped again when the object goes away.
+******************************************************************************/
+#ifndef MAPPED_H
+#define MAPPED_H
+
+/******************************************************************************
+ * MAPPED FILE CLASS - a file mapped read only into memory
+ *****************************************************************************/
+class MappedFile
+{
+private:
+   void *base;
+   size_t length;
+
+public:
+   MappedFile() : base(NULL), length(0) {}
+   ~MappedFile() { close(); }
+
+   // a mapping has one owner, it is unmapped exactly once
+   MappedFile(const MappedFile &) = delete;
+   MappedFile &operator = (const MappedFile &) = delete;
+
+   // false if the file, in directory if given, is missing, empty or can
+   // not be mapped
+   bool open(const char *filename, int directory = AT_FDCWD)
+   {
+      close();
+
+      int fd = openIn(directory, filename, O_RDONLY);
+      if (fd < 0)
+         return false;
+
+      struct stat info;
+      if (fstat(fd, &info) != 0 || info.st_size <= 0)
+      {
+         ::close(fd);
+         return false;
+      }
+
+      void *p = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd); // the mapping keeps the file open
+      if (p == MAP_FAILED)
+         return false;
+
+      base = p;
+      length = info.st_size;
+      return true;
+   }
+
+   void close()
+   {
+      if (base != NULL)
+         munmap(base, length);
+      base = NULL;
+      length = 0;
+   }
+
+   const char *data() const { return (const char *)base; }
+   size_t size() const      { return length;             }
+};
+
+#endif
@@ -0,0 +1,95 @@
+/******************************************************************************
+* Header:
+*   Material
+* Desc:
+*   Contains the Material struct and the MaterialTable that holds every
+*   material of a scene. Objects keep only the index of their material in
+*   the table, so shading looks its properties up in one small array: the
+*   diffuse color, how much light it reflects, its Phong highlight and the
+*   procedural pattern that varies its color over the surface.
+******************************************************************************/
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+// the procedural patterns a material can have
+enum Pattern { solidPattern, checkerPattern };
+
+/******************************************************************************
+ * MATERIAL STRUCT - how a surface shades
+ *****************************************************************************/
+struct Material
+{
+   Color color;       // diffuse color, of the odd squares for a checker
+   Color second;      // color of the even squares of a checker
+   Real reflectivity; // share of the light reflected, 0 for none
+   Real specular;     // strength of the highlight, 0 for none
+   Real shininess;    // Phong exponent of the highlight
+   int pattern;       // solidPattern or checkerPattern
+
+   Material() : color(0.5, 0.5, 0.5), second(0, 0, 0), reflectivity(0), specular(0)
+              , shininess(10), pattern(solidPattern) {}
+
+   // the color at a point on the surface
+   Color colorAt(const Vect &position) const
+   {
+      if (pattern == checkerPattern)
+      {
+         // unit squares across the xz plane
+         int square = (int)floor(position.getVectX()) + (int)floor(position.getVectZ());
+         return (square % 2) == 0 ? second : color;
+      }
+      return color;
+   }
+
+   // the material of the old "special" value that came with a color: 0 is
+   // a plain color, from 0 to 1 reflective with a highlight of that
+   // strength, and 2 a black and white checker
+   static Material fromSpecial(Color color, Real special)
+   {
+      Material m;
+      m.color = color;
+      if (special > 0 && special <= 1)
+      {
+         m.reflectivity = special;
+         m.specular = special;
+      }
+      else if (special == 2)
+      {
+         m.color = Color(1, 1, 1);
+         m.second = Color(0, 0, 0);
+         m.pattern = checkerPattern;
+      }
+      return m;
+   }
+};
+
+/******************************************************************************
+ * MATERIAL TABLE CLASS - every material of a scene, by index. index 0 is
+ *    the gray an object gets when it is not given one
+ *****************************************************************************/
+class MaterialTable
+{
+private:
+   std::vector<Material> materials;
+
+public:
+   MaterialTable() { clear(); }
+
+   void clear() { materials.assign(1, Material()); }
+
+   // adds a material and returns its index
+   int add(const Material &m)
+   {
+      materials.push_back(m);
+      return materials.size() - 1;
+   }
+
+   int size() const { return materials.size(); }
+   const Material &operator [] (int id) const { return materials[id]; }
+   const Material *data() const { return &materials[0]; }
+
+   // replaces the whole table, e.g. with one read from the scene cache
+   void assign(const Material *m, int count) { materials.assign(m, m + count); }
+};
+
+#endif
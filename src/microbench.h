@@ -0,0 +1,267 @@
+/******************************************************************************
+* Header:
+*   Microbench
+* Desc:
+*   Microbenchmark for the intersection kernels. Times the virtual
+*   findIntersection path on Sphere and Triangle objects, and the per
+*   triangle path of a TriangleMesh, against every SoA kernel this CPU
+*   supports, and checks they all find the same hits. A second one times
+*   the Vect math of shading against the same math on plain scalars and
+*   checks the results match exactly.
+******************************************************************************/
+#ifndef MICROBENCH_H
+#define MICROBENCH_H
+
+/******************************************************************************
+ * BENCH RANDOM - a small deterministic generator so every run is the same
+ *****************************************************************************/
+inline double benchRandom(unsigned int &state, double lo, double hi)
+{
+   state = state * 1664525u + 1013904223u;
+   return lo + (hi - lo) * (state >> 8) / (double)(1 << 24);
+}
+
+/******************************************************************************
+ * BENCH KERNELS - runs the kernel microbenchmark and prints the results.
+ *    returns false if any kernel disagreed with the virtual path
+ *****************************************************************************/
+inline bool benchKernels(int primitives, int rays)
+{
+   unsigned int seed = 12345;
+   primitives = (primitives + soaBlock - 1) / soaBlock * soaBlock;
+
+   // the same random primitives in both layouts
+   std::vector<Object*> sphereObjects, triangleObjects;
+   SphereSoA sphereSoA;
+   TriangleSoA triangleSoA;
+   TriangleMesh mesh;
+   MeshSoA meshSoA;
+
+   for (int i = 0; i < primitives; i++)
+   {
+      Vect center (benchRandom(seed, -10, 10), benchRandom(seed, -10, 10),
+                   benchRandom(seed, 5, 25));
+      Sphere *sphere = new Sphere(center, benchRandom(seed, 0.1, 1), 0);
+      sphereObjects.push_back(sphere);
+      sphereSoA.add(sphere, i);
+
+      Vect A (benchRandom(seed, -10, 10), benchRandom(seed, -10, 10), benchRandom(seed, 5, 25));
+      Vect B = A + Vect(benchRandom(seed, -2, 2), benchRandom(seed, -2, 2), benchRandom(seed, -2, 2));
+      Vect C = A + Vect(benchRandom(seed, -2, 2), benchRandom(seed, -2, 2), benchRandom(seed, -2, 2));
+      Triangle *triangle = new Triangle(A, B, C, 0);
+      triangleObjects.push_back(triangle);
+      triangleSoA.add(triangle, i);
+
+      int v0 = mesh.addVertex(A);
+      mesh.addVertex(B);
+      mesh.addVertex(C);
+      mesh.addTriangle(v0, v0 + 1, v0 + 2);
+      meshSoA.add(&mesh, i, i);
+   }
+
+   std::vector<Ray> rayList;
+   for (int i = 0; i < rays; i++)
+   {
+      Vect dir (benchRandom(seed, -0.5, 0.5), benchRandom(seed, -0.5, 0.5), 1);
+      rayList.push_back(Ray(Vect(0, 0, 0), dir.normalize()));
+   }
+
+   const char *kinds[3] = { "sphere", "triangle", "mesh" };
+   std::vector<Object*> *objectLists[2] = { &sphereObjects, &triangleObjects };
+   const char *names[] = { "scalar", "sse2", "avx2" };
+   bool agree = true;
+
+   std::cout << "kernel microbenchmark: " << primitives << " primitives x "
+             << rays << " rays" << std::endl;
+
+   for (int kind = 0; kind < 3; kind++)
+   {
+      std::vector<Object*> &objects = *objectLists[kind < 2 ? kind : 1];
+
+      // the AoS path the kernels replace
+      std::vector<int> reference (rays);
+      std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+      for (int r = 0; r < rays; r++)
+      {
+         Real tBest = std::numeric_limits<Real>::infinity();
+         int best = -1;
+         for (int i = 0; i < primitives; i++)
+         {
+            Real t = (kind < 2) ? objects[i]->findIntersection(rayList[r])
+                                  : mesh.intersectTriangle(i, rayList[r]);
+            if (t > 0 && t < tBest)
+            {
+               tBest = t;
+               best = i;
+            }
+         }
+         reference[r] = best;
+      }
+      std::chrono::duration<double> virtualTime = std::chrono::steady_clock::now() - start;
+      double tests = (double)primitives * rays;
+
+      std::cout << "   " << kinds[kind] << (kind < 2 ? " virtual: " : " aos: ")
+                << tests / virtualTime.count() / 1e6 << " Mtests/s" << std::endl;
+
+      for (int k = 0; k < 3; k++)
+      {
+         const IntersectKernels *kernels = findKernels(names[k]);
+         if (kernels == NULL)
+            continue;
+
+         int mismatches = 0;
+         start = std::chrono::steady_clock::now();
+         for (int r = 0; r < rays; r++)
+         {
+            SoARay soaRay (rayList[r]);
+            Real tBest = std::numeric_limits<Real>::infinity();
+            int best = -1;
+            if (kind == 0)
+               kernels->sphereClosest(soaRay, sphereSoA, 0, primitives, tBest, best);
+            else if (kind == 1)
+               kernels->triangleClosest(soaRay, triangleSoA, 0, primitives, tBest, best);
+            else
+               kernels->meshClosest(soaRay, meshSoA, 0, primitives, tBest, best);
+            mismatches += (best != reference[r]);
+         }
+         std::chrono::duration<double> kernelTime = std::chrono::steady_clock::now() - start;
+
+         std::cout << "   " << kinds[kind] << " " << kernels->name << ": "
+                   << tests / kernelTime.count() / 1e6 << " Mtests/s ("
+                   << virtualTime.count() / kernelTime.count()
+                   << (kind < 2 ? "x virtual)" : "x aos)");
+         if (mismatches > 0)
+         {
+            std::cout << ", " << mismatches << " MISMATCHED HITS";
+            agree = false;
+         }
+         std::cout << std::endl;
+      }
+   }
+
+   for (int i = 0; i < primitives; i++)
+   {
+      delete sphereObjects[i];
+      delete triangleObjects[i];
+   }
+
+   return agree;
+}
+
+/******************************************************************************
+ * SHADE MATH STRUCT - the vector results of shading one surface point
+ *****************************************************************************/
+struct ShadeMath
+{
+   Real position[3]; // the hit point
+   Real reflect[3];  // the mirrored ray direction
+   Real light[3];    // the direction to the light
+   Real distance;    // to the light
+   Real cosAngle;
+   Real specular;
+};
+
+/******************************************************************************
+ * BENCH VECTORS - times the vector math of the shading path written with
+ *    the Vect operators against the same math written out on scalars, and
+ *    checks every result is bit for bit the same. returns false if any
+ *    result differs
+ *****************************************************************************/
+inline bool benchVectors(int cases, int repeats)
+{
+   unsigned int seed = 54321;
+   std::vector<Vect> origins, directions, normals;
+   std::vector<Real> distances;
+   for (int i = 0; i < cases; i++)
+   {
+      origins.push_back(Vect(benchRandom(seed, -5, 5), benchRandom(seed, -5, 5),
+                             benchRandom(seed, -5, 5)));
+      directions.push_back(Vect(benchRandom(seed, -1, 1), benchRandom(seed, -1, 1),
+                                benchRandom(seed, -1, 1)).normalize());
+      normals.push_back(Vect(benchRandom(seed, -1, 1), benchRandom(seed, -1, 1),
+                             benchRandom(seed, -1, 1)).normalize());
+      distances.push_back(benchRandom(seed, 0.1, 20));
+   }
+   const Vect lightPosition (-7, 10, -10);
+
+   std::vector<ShadeMath> withVect (cases), withScalars (cases);
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   for (int r = 0; r < repeats; r++)
+      for (int i = 0; i < cases; i++)
+      {
+         const Vect &n = normals[i];
+         Ray ray (origins[i], directions[i]);
+         Vect position = ray.at(distances[i]);
+         Vect reflect = (-ray.getRayDirection())
+                        .addScaled(ray.getRayDirection().addScaled(n, n.dotProduct(-ray.getRayDirection())), 2)
+                        .normalize();
+         Vect offset = lightPosition - position;
+         Vect light = offset.normalize();
+
+         ShadeMath &m = withVect[i];
+         m.position[0] = position.getVectX();
+         m.position[1] = position.getVectY();
+         m.position[2] = position.getVectZ();
+         m.reflect[0] = reflect.getVectX();
+         m.reflect[1] = reflect.getVectY();
+         m.reflect[2] = reflect.getVectZ();
+         m.light[0] = light.getVectX();
+         m.light[1] = light.getVectY();
+         m.light[2] = light.getVectZ();
+         m.distance = offset.magnitude();
+         m.cosAngle = n.dotProduct(light);
+         m.specular = reflect.dotProduct(light);
+      }
+   std::chrono::duration<double> vectTime = std::chrono::steady_clock::now() - start;
+
+   start = std::chrono::steady_clock::now();
+   for (int r = 0; r < repeats; r++)
+      for (int i = 0; i < cases; i++)
+      {
+         Real n[3] = { normals[i].getVectX(), normals[i].getVectY(), normals[i].getVectZ() };
+         Real o[3] = { origins[i].getVectX(), origins[i].getVectY(), origins[i].getVectZ() };
+         Real d[3] = { directions[i].getVectX(), directions[i].getVectY(),
+                       directions[i].getVectZ() };
+         Real l[3] = { lightPosition.getVectX(), lightPosition.getVectY(),
+                       lightPosition.getVectZ() };
+         ShadeMath &m = withScalars[i];
+
+         Real dot = n[0]*-d[0] + n[1]*-d[1] + n[2]*-d[2];
+         Real offset[3], reflect[3];
+         for (int a = 0; a < 3; a++)
+         {
+            m.position[a] = o[a] + d[a]*distances[i];
+            reflect[a] = -d[a] + (d[a] + n[a]*dot)*2;
+            offset[a] = l[a] - m.position[a];
+         }
+         Real reflectLength = std::sqrt(reflect[0]*reflect[0] + reflect[1]*reflect[1] +
+                                        reflect[2]*reflect[2]);
+         m.distance = std::sqrt(offset[0]*offset[0] + offset[1]*offset[1] + offset[2]*offset[2]);
+         for (int a = 0; a < 3; a++)
+         {
+            m.reflect[a] = reflect[a] / reflectLength;
+            m.light[a] = offset[a] / m.distance;
+         }
+         m.cosAngle = n[0]*m.light[0] + n[1]*m.light[1] + n[2]*m.light[2];
+         m.specular = m.reflect[0]*m.light[0] + m.reflect[1]*m.light[1] +
+                      m.reflect[2]*m.light[2];
+      }
+   std::chrono::duration<double> scalarTime = std::chrono::steady_clock::now() - start;
+
+   int mismatches = 0;
+   for (int i = 0; i < cases; i++)
+      mismatches += memcmp(&withVect[i], &withScalars[i], sizeof(ShadeMath)) != 0;
+
+   double points = (double)cases * repeats;
+   std::cout << "vector microbenchmark: " << cases << " shading points x "
+             << repeats << " repeats" << std::endl
+             << "   vect: " << vectTime.count() / points * 1e9 << " ns per point" << std::endl
+             << "   scalar: " << scalarTime.count() / points * 1e9 << " ns per point ("
+             << scalarTime.count() / vectTime.count() << "x vect)" << std::endl;
+   if (mismatches > 0)
+      std::cout << "   " << mismatches << " MISMATCHED RESULTS" << std::endl;
+
+   return mismatches == 0;
+}
+
+#endif
@@ -3,7 +3,8 @@
 *   Objects
 * Desc:
 *   This file contains the Object Base class and all the Subclasses:
-*   (Plain, Sphere, Triangle)
+*   (Plain, Sphere, Triangle, TriangleMesh). Every object keeps the index of
+*   its material in the scene's MaterialTable, 0 for the default gray
 ******************************************************************************/
 #ifndef OBJECTS_H
 #define OBJECTS_H
@@ -14,9 +15,17 @@
 class Object 
 {
 public:
-   virtual Color getColor ()                 { return Color(0,0,0,0); }
-   virtual Vect getNormalAt(Vect pos)        { return Vect (0,0,0);   }
-   virtual double findIntersection (Ray ray) { return 0;              }
+   virtual ~Object() {}
+
+   virtual int getMaterial()                     { return 0;              }
+   virtual Vect getNormalAt(const Vect &pos)     { return Vect (0,0,0);   }
+   virtual Real findIntersection(const Ray &ray) { return 0;              }
+
+   // false for unbounded objects (planes)
+   virtual bool getBounds(BBox &box)             { return false;          }
+
+   // normal of one primitive of an object made of many (meshes)
+   virtual Vect getPrimitiveNormal(const Vect &pos, int prim) { return getNormalAt(pos); }
 };
 
 /******************************************************************************
@@ -26,30 +35,29 @@ class Plane : public Object
 {
 private:
    Vect normal;
-   double distance;
-   Color color;
+   Real distance;
+   int material;
 
 public:
-   Plane() : normal(Vect(1,0,0)), distance(0), color(Color(0.5,0.5,0.5,0)) {}
-   Plane(Vect n, double d, Color c) : normal(n), distance(d), color(c)     {}
+   Plane() : normal(Vect(1,0,0)), distance(0), material(0) {}
+   Plane(Vect n, Real d, int m) : normal(n), distance(d), material(m) {}
 
-   Vect getPlaneNormal()     { return normal;   }
-   double getPlaneDistance() { return distance; }
+   Vect getPlaneNormal()   { return normal;   }
+   Real getPlaneDistance() { return distance; }
 
    // virtual functions
-   virtual Color getColor()                 { return color;  }
-   virtual Vect getNormalAt(Vect point)     { return normal; }
-   virtual double findIntersection(Ray ray)
+   virtual int getMaterial()                   { return material; }
+   virtual Vect getNormalAt(const Vect &point) { return normal;   }
+   virtual Real findIntersection(const Ray &ray)
    {
       Vect rayDir = ray.getRayDirection();
-      double a = rayDir.dotProduct(normal);
+      Real a = rayDir.dotProduct(normal);
 
       if (a == 0) // the ray is parallel to the plane
          return -1;
       else
       {
-         double b = normal.dotProduct(ray.getRayOrigin().vectAdd(
-                    normal.vectMult(distance).negative()));
+         Real b = normal.dotProduct(ray.getRayOrigin() - normal * distance);
          return -1*b/a;
       }
    }
@@ -62,74 +70,81 @@ class Sphere : public Object
 {
 private:
    Vect center;
-   double radius;
-   Color color;
+   Real radius;
+   int material;
 
 public:
    Sphere() // default constructor
    {
       center = Vect(0,0,0);
       radius = 1.0;
-      color  = Color(0.5,0.5,0.5,0);
+      material = 0;
    }
 
-   Sphere(Vect iCenter, double iRadius, Color iColor) // secondary constructor
+   Sphere(Vect iCenter, Real iRadius, int iMaterial) // secondary constructor
    {
       center = iCenter;
       radius = iRadius;
-      color  = iColor;
+      material = iMaterial;
    }
 
-   Vect getSphereCenter ()   { return center; }
-   double getSphereRadius () { return radius; }
+   Vect getSphereCenter () { return center; }
+   Real getSphereRadius () { return radius; }
 
    // virtual functions
-   virtual Color getColor () { return color;  }
+   virtual int getMaterial() { return material; }
 
-   virtual Vect getNormalAt(Vect point)
+   virtual bool getBounds(BBox &box)
+   {
+      Vect r (radius, radius, radius);
+      box = BBox(center - r, center + r);
+      return true;
+   }
+
+   virtual Vect getNormalAt(const Vect &point)
    {
       // normal always points away from the center of a sphere
-      return point.vectAdd(center.negative()).normalize();
+      return (point - center).normalize();
    }
 
-   virtual double findIntersection(Ray ray)
+   virtual Real findIntersection(const Ray &ray)
    {
       // get the ray origin coordinates
-      Vect rayOrg = ray.getRayOrigin();
-      double rayOrgx = rayOrg.getVectX();
-      double rayOrgy = rayOrg.getVectY();
-      double rayOrgz = rayOrg.getVectZ();
+      const Vect &rayOrg = ray.getRayOrigin();
+      Real rayOrgx = rayOrg.getVectX();
+      Real rayOrgy = rayOrg.getVectY();
+      Real rayOrgz = rayOrg.getVectZ();
 
       // get the ray direction coordinates
-      Vect rayDir = ray.getRayDirection();
-      double rayDirx = rayDir.getVectX();
-      double rayDiry = rayDir.getVectY();
-      double rayDirz = rayDir.getVectZ();
+      const Vect &rayDir = ray.getRayDirection();
+      Real rayDirx = rayDir.getVectX();
+      Real rayDiry = rayDir.getVectY();
+      Real rayDirz = rayDir.getVectZ();
 
       // get the sphere center corrdinates
-      double centerx = center.getVectX();
-      double centery = center.getVectY();
-      double centerz = center.getVectZ();
+      Real centerx = center.getVectX();
+      Real centery = center.getVectY();
+      Real centerz = center.getVectZ();
 
       // calculate the discriminant
-      double b = (2 * (rayOrgx - centerx) * rayDirx) 
+      Real b = (2 * (rayOrgx - centerx) * rayDirx) 
                + (2 * (rayOrgy - centery) * rayDiry) 
                + (2 * (rayOrgz - centerz) * rayDirz);
-      double c = pow(rayOrgx - centerx, 2) 
-               + pow(rayOrgy - centery, 2) 
-               + pow(rayOrgz - centerz, 2)
+      Real c = (rayOrgx - centerx)*(rayOrgx - centerx)
+               + (rayOrgy - centery)*(rayOrgy - centery)
+               + (rayOrgz - centerz)*(rayOrgz - centerz)
                - (radius*radius);
 
-      double discriminant = b*b - 4*c;
+      Real discriminant = b*b - 4*c;
 
       if (discriminant > 0) // the ray intersects with the sphere
       {
-         double root1 = ((-1*b - sqrt(discriminant)) / 2) - 0.000001;
+         Real root1 = ((-1*b - std::sqrt(discriminant)) / 2) - sphereBias;
 
          if (root1 > 0)   // first root is the smallest
             return root1;
          else             // second root is the smallest
-            return ((sqrt(discriminant) - b)/2) - 0.000001;
+            return ((std::sqrt(discriminant) - b)/2) - sphereBias;
       }
       else // it missed
          return -1;
@@ -142,9 +157,16 @@ public:
 class Triangle : public Object
 {
 private:
-   Vect A, B, C, normal;
-   double distance;
-   Color color;
+   Vect A, B, C;
+   int material;
+   Vect normal;   // computed once by the constructors
+   Real distance; // normal . A
+
+   void computePlane()
+   {
+      normal = (C - A).crossProduct(B - A).normalize();
+      distance = normal.dotProduct(A);
+   }
 
 public:
    Triangle() // default constructor
@@ -152,90 +174,61 @@ public:
       A = Vect(1,0,0);
       B = Vect(0,1,0);
       C = Vect(0,0,1);
-      color = Color(0.5,0.5,0.5,0);
+      material = 0;
+      computePlane();
    }
 
-   Triangle(Vect iA, Vect iB, Vect iC, Color iColor) // secondary constructor
+   Triangle(Vect iA, Vect iB, Vect iC, int iMaterial) // secondary constructor
    {
       A = iA;
       B = iB;
       C = iC;
-      color = iColor;
+      material = iMaterial;
+      computePlane();
    }
 
-   Vect getTriangleNormal()
-   {
-      Vect CA ( C.getVectX() - A.getVectX()
-              , C.getVectY() - A.getVectY()
-              , C.getVectZ() - A.getVectZ());
-      Vect BA ( B.getVectX() - A.getVectX()
-              , B.getVectY() - A.getVectY()
-              , B.getVectZ() - A.getVectZ());
+   Vect getTriangleA() { return A; }
+   Vect getTriangleB() { return B; }
+   Vect getTriangleC() { return C; }
 
-      return CA.crossProduct(BA).normalize();
-   }
-
-   double getTriangleDistance()
-   {
-      normal = getTriangleNormal();
-      return normal.dotProduct(A);
-   }
+   Vect getTriangleNormal()   { return normal;   }
+   Real getTriangleDistance() { return distance; }
 
    // virtual functions
-   virtual Color getColor()             { return color;               }
-   virtual Vect getNormalAt(Vect point) { return getTriangleNormal(); }
+   virtual int getMaterial()                   { return material;            }
+   virtual Vect getNormalAt(const Vect &point) { return getTriangleNormal(); }
 
-   virtual double findIntersection(Ray ray)
+   virtual bool getBounds(BBox &box)
    {
-      Vect rayDir = ray.getRayDirection();
-      Vect rayOrg = ray.getRayOrigin();
+      box = BBox(A, B);
+      box.expand(C);
+      return true;
+   }
 
-      normal = getTriangleNormal();
-      distance = getTriangleDistance();
+   virtual Real findIntersection(const Ray &ray)
+   {
+      const Vect &rayDir = ray.getRayDirection();
 
-      double a = rayDir.dotProduct(normal);
+      Real a = rayDir.dotProduct(normal);
 
       if (a == 0) // ray is parallel to the triangle
          return -1;
       else
       {
-         double b = normal.dotProduct(ray.getRayOrigin().vectAdd(
-                    normal.vectMult(distance).negative()));
-         double distToPlane = -1*b/a;
+         Real b = normal.dotProduct(ray.getRayOrigin() - normal * distance);
+         Real distToPlane = -1*b/a;
 
          // point of intersection
-         double Qx = rayDir.vectMult(distToPlane).getVectX() + rayOrg.getVectX();
-         double Qy = rayDir.vectMult(distToPlane).getVectY() + rayOrg.getVectY();
-         double Qz = rayDir.vectMult(distToPlane).getVectZ() + rayOrg.getVectZ();
-
-         Vect Q (Qx, Qy, Qz);
+         Vect Q = ray.at(distToPlane);
 
          // [CAxQA]*a >= 0
-         Vect CA ( C.getVectX() - A.getVectX()
-                 , C.getVectY() - A.getVectY()
-                 , C.getVectZ() - A.getVectZ());
-         Vect QA ( Q.getVectX() - A.getVectX()
-                 , Q.getVectY() - A.getVectY()
-                 , Q.getVectZ() - A.getVectZ());
-         double test1 = (CA.crossProduct(QA)).dotProduct(normal);
+         Real test1 = (C - A).crossProduct(Q - A).dotProduct(normal);
 
          // [BCxQC]*a >= 0
-         Vect BC ( B.getVectX() - C.getVectX()
-                 , B.getVectY() - C.getVectY()
-                 , B.getVectZ() - C.getVectZ());
-         Vect QC ( Q.getVectX() - C.getVectX()
-                 , Q.getVectY() - C.getVectY()
-                 , Q.getVectZ() - C.getVectZ());
-         double test2 = (BC.crossProduct(QC)).dotProduct(normal);
+         Real test2 = (B - C).crossProduct(Q - C).dotProduct(normal);
 
          // [ABxQB]*a >= 0
-         Vect AB ( A.getVectX() - B.getVectX()
-                 , A.getVectY() - B.getVectY()
-                 , A.getVectZ() - B.getVectZ());
-         Vect QB ( Q.getVectX() - B.getVectX()
-                 , Q.getVectY() - B.getVectY()
-                 , Q.getVectZ() - B.getVectZ());
-         double test3 = (AB.crossProduct(QB)).dotProduct(normal);
+         Real test3 = (A - B).crossProduct(Q - B).dotProduct(normal);
 
          if((test1 >= 0) && (test2 >= 0) && (test3 >= 0)) // inside the triangle
             return distToPlane;
@@ -245,4 +238,163 @@ public:
    }
 };
 
+/******************************************************************************
+ * TRIANGLE MESH CLASS - many triangles sharing one vertex buffer. Triangles
+ *    are three indices into the buffer, their edges and normals are worked
+ *    out once when the mesh is built. The BVH intersects every triangle
+ *    separately, so a mesh is one object however many triangles it holds
+ *****************************************************************************/
+class TriangleMesh : public Object
+{
+private:
+   Column<Vect> vertices;
+   Column<int> indices;       // three per triangle
+   Column<Vect> edge1;        // v1 - v0 of each triangle
+   Column<Vect> edge2;        // v2 - v0
+   Column<Vect> normals;      // edge1 x edge2, normalized
+   int material;
+
+public:
+   TriangleMesh() : material(0) {}                          // default const
+   TriangleMesh(int iMaterial) : material(iMaterial) {}     // secondary const
+
+   // triangles wind counter clockwise seen from the side the normal faces
+   int addVertex(Vect v)
+   {
+      vertices.push_back(v);
+      return vertices.size() - 1;
+   }
+
+   void addTriangle(int i0, int i1, int i2)
+   {
+      indices.push_back(i0);
+      indices.push_back(i1);
+      indices.push_back(i2);
+
+      Vect e1 = vertices[i1] - vertices[i0];
+      Vect e2 = vertices[i2] - vertices[i0];
+      edge1.push_back(e1);
+      edge2.push_back(e2);
+      normals.push_back(e1.crossProduct(e2).normalize());
+   }
+
+   // the box from corner1 to corner2 as 12 triangles facing outwards
+   static TriangleMesh *makeCube(Vect corner1, Vect corner2, int iMaterial)
+   {
+      TriangleMesh *cube = new TriangleMesh(iMaterial);
+
+      Real x[2] = { std::min(corner1.getVectX(), corner2.getVectX()),
+                    std::max(corner1.getVectX(), corner2.getVectX()) };
+      Real y[2] = { std::min(corner1.getVectY(), corner2.getVectY()),
+                    std::max(corner1.getVectY(), corner2.getVectY()) };
+      Real z[2] = { std::min(corner1.getVectZ(), corner2.getVectZ()),
+                    std::max(corner1.getVectZ(), corner2.getVectZ()) };
+
+      // vertex i has x[i&1], y[(i>>1)&1], z[(i>>2)&1]
+      for (int i = 0; i < 8; i++)
+         cube->addVertex(Vect(x[i & 1], y[(i >> 1) & 1], z[(i >> 2) & 1]));
+
+      // two triangles per face, counter clockwise from outside
+      int faces[6][4] = { {0, 2, 3, 1},   // -z
+                          {4, 5, 7, 6},   // +z
+                          {0, 1, 5, 4},   // -y
+                          {2, 6, 7, 3},   // +y
+                          {0, 4, 6, 2},   // -x
+                          {1, 3, 7, 5} }; // +x
+      for (int f = 0; f < 6; f++)
+      {
+         cube->addTriangle(faces[f][0], faces[f][1], faces[f][2]);
+         cube->addTriangle(faces[f][0], faces[f][2], faces[f][3]);
+      }
+
+      return cube;
+   }
+
+   // calls f on every column, always in the same order
+   template <class F> void forEachColumn(F f)
+   {
+      f(vertices); f(indices); f(edge1); f(edge2); f(normals);
+   }
+
+   // whether columns restored by forEachColumn fit together: whole
+   // triangles, indices inside the vertex buffer and one edge pair and
+   // normal per triangle
+   bool isConsistent() const
+   {
+      if (indices.size() % 3 != 0)
+         return false;
+      for (int i = 0; i < indices.size(); i++)
+         if (indices[i] < 0 || indices[i] >= vertices.size())
+            return false;
+      int triangles = indices.size() / 3;
+      return edge1.size() == triangles && edge2.size() == triangles &&
+             normals.size() == triangles;
+   }
+
+   int getVertexCount()              { return vertices.size();          }
+   int getTriangleCount()            { return indices.size() / 3;       }
+   Vect getVertex(int tri, int k)    { return vertices[indices[3*tri + k]]; }
+   Vect getEdge1(int tri)            { return edge1[tri];               }
+   Vect getEdge2(int tri)            { return edge2[tri];               }
+
+   void getTriangleBounds(int tri, BBox &box)
+   {
+      box = BBox(getVertex(tri, 0), getVertex(tri, 1));
+      box.expand(getVertex(tri, 2));
+   }
+
+   // Moller-Trumbore. edges count as inside so neighbours leave no cracks
+   Real intersectTriangle(int tri, const Ray &ray)
+   {
+      const Vect &dir = ray.getRayDirection();
+      Vect pvec = dir.crossProduct(edge2[tri]);
+      Real det = edge1[tri].dotProduct(pvec);
+
+      if (det == 0) // ray is parallel to the triangle
+         return -1;
+
+      Real invDet = 1 / det;
+      Vect tvec = ray.getRayOrigin() - getVertex(tri, 0);
+      Real u = tvec.dotProduct(pvec) * invDet;
+      if (u < 0 || u > 1)
+         return -1;
+
+      Vect qvec = tvec.crossProduct(edge1[tri]);
+      Real v = dir.dotProduct(qvec) * invDet;
+      if (v < 0 || u + v > 1)
+         return -1;
+
+      return edge2[tri].dotProduct(qvec) * invDet;
+   }
+
+   // virtual functions
+   virtual int getMaterial()                                  { return material;       }
+   virtual Vect getNormalAt(const Vect &point)                { return normals[0];     }
+   virtual Vect getPrimitiveNormal(const Vect &pos, int prim) { return normals[prim]; }
+
+   virtual bool getBounds(BBox &box)
+   {
+      if (vertices.empty())
+         return false;
+
+      box = BBox(vertices[0], vertices[0]);
+      for (int i = 1; i < vertices.size(); i++)
+         box.expand(vertices[i]);
+      return true;
+   }
+
+   // nearest triangle by brute force. the BVH tests triangles one by one
+   virtual Real findIntersection(const Ray &ray)
+   {
+      Real tBest = -1;
+      for (int tri = 0; tri < getTriangleCount(); tri++)
+      {
+         Real t = intersectTriangle(tri, ray);
+         if (t > 0 && (tBest < 0 || t < tBest))
+            tBest = t;
+      }
+      return tBest;
+   }
+};
+
 #endif
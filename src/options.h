@@ -0,0 +1,529 @@
+/******************************************************************************
+* Header:
+*   Options
+* Desc:
+*   Contains the Options struct and the command line parser that fills it.
+******************************************************************************/
+#ifndef OPTIONS_H
+#define OPTIONS_H
+
+/******************************************************************************
+ * OPTIONS STRUCT - everything that can be set from the command line
+ *****************************************************************************/
+struct Options
+{
+   int threads;         // render threads, defaults to one per core
+   int tileSize;        // width and height of a scheduler tile in pixels
+   std::string kernels; // intersection kernels to force, empty picks the best
+   bool benchKernels;   // run the kernel microbenchmark instead of rendering
+   bool benchVectors;   // run the vector math microbenchmark instead of rendering
+   bool packets;        // trace camera rays in packets
+   bool wavefront;      // shade with the wavefront integrator
+   bool benchWavefront; // time both integrators instead of rendering
+   bool benchPrimary;   // time camera rays in both modes instead of rendering
+   std::string scene;   // scene file to render, empty for the built in scene
+   bool cache;          // load and save the binary cache next to the scene
+   std::string output;  // image file the render is written to
+   int aovs;            // FrameBuffer channels written next to it as PFM
+   ImageFormat format;  // its format, from its extension unless --format is given
+   int width, height;   // override the scene's image size when above 0
+   int dpi;             // overrides the scene's dpi when above 0
+   double ambient;      // overrides the scene's ambient light when 0 or more
+   int cropX, cropY, cropWidth, cropHeight; // overrides the scene's crop when cropWidth > 0
+   bool camera;         // replace the scene's camera with one at cameraPosition
+   Vect cameraPosition; // looking at cameraFocus
+   Vect cameraFocus;
+   int aadepth;         // overrides the scene's aadepth when above 0
+   double aathreshold;  // overrides the scene's aathreshold when 0 or more
+   int bounces;         // overrides the scene's maxBounces when 0 or more
+   double cutoff;       // overrides the scene's minThroughput when 0 or more
+   bool progressive;    // render in passes, see renderProgressive
+   double timeBudget;   // seconds a progressive render may take, 0 for no limit
+   std::string checkpoint; // file progressive renders save their progress in
+   double checkpointEvery; // seconds between checkpoints
+   bool resume;         // continue from the checkpoint
+   bool bench;          // run the benchmark suite instead of rendering
+   int benchRuns;       // times the suite renders each scene
+   std::string benchOut; // file the suite's JSON report goes to
+   std::string heatmap; // image of the time spent on each pixel, profiling only
+   std::string compareA, compareB; // images to compare instead of rendering
+   int tolerance;       // channel difference out of 255 that makes an outlier
+   double maxOutliers;  // percent of outlier pixels a comparison allows
+   std::string coordinator; // address to hand tiles out to workers from
+   int spawn;           // local worker processes the coordinator starts
+   std::string sharedScene; // compiled scene file workers read instead of being sent it
+   double workerTimeout; // seconds a worker with tiles may stay silent
+   std::string worker;  // coordinator address to render tiles for
+   int exitAfter;       // a worker dies after this many tiles, 0 never
+   std::string token;   // run token, hex, a coordinator's workers must know
+   int sceneMegabytes;  // largest compiled scene a worker takes
+   std::string serve;   // address to take render jobs on as a server
+   std::string serveDir; // directory a server's jobs may read and write in
+   int jobs;            // jobs a server renders at once
+   int cacheMegabytes;  // memory a server keeps loaded scenes in
+   std::string submit;  // server address to send this render to as a job
+   std::string serverStats; // server address to print the metrics of
+
+   Options() : threads(std::thread::hardware_concurrency()), tileSize(32)
+             , benchKernels(false), benchVectors(false), packets(true), wavefront(false)
+             , benchWavefront(false), benchPrimary(false)
+             , cache(true), output("scene.bmp"), aovs(0), format(bmpFormat), width(0), height(0)
+             , dpi(0), ambient(-1), cropX(0), cropY(0), cropWidth(0), cropHeight(0)
+             , camera(false), aadepth(0), aathreshold(-1), bounces(-1), cutoff(-1)
+             , progressive(false), timeBudget(0)
+             , checkpointEvery(60), resume(false), bench(false), benchRuns(3)
+             , benchOut("bench.json"), tolerance(2), maxOutliers(0.5), spawn(0)
+             , workerTimeout(60), exitAfter(0), sceneMegabytes(1024), jobs(4)
+             , cacheMegabytes(512)
+   {
+      if (threads < 1)
+         threads = 1;
+   }
+};
+
+/******************************************************************************
+ * USAGE - prints the command line help
+ *****************************************************************************/
+inline void usage(const char *program)
+{
+   std::cerr << "usage: " << program << " [options]\n"
+             << "  --scene FILE    render the scene described in FILE\n"
+             << "                  (default: the built in three sphere scene)\n"
+             << "  --no-cache      do not use or write FILE.cache, the parsed\n"
+             << "                  scene and BVH kept for the next run\n"
+             << "  --output F      write the image to F (default: scene.bmp)\n"
+             << "  --format NAME   bmp or ppm (default: from the extension of F)\n"
+             << "  --aov NAME      also write depth, normal or id, what the middle of\n"
+             << "                  each pixel sees, to F's name with .NAME.pfm in\n"
+             << "                  place of its extension. may be repeated\n"
+             << "  --size WxH      image size in pixels, overriding the scene\n"
+             << "  --dpi N         resolution stored in the image\n"
+             << "  --crop X Y W H  render only the W x H pixels whose top left corner\n"
+             << "                  is X Y; the image is W x H and matches that part\n"
+             << "                  of the full frame\n"
+             << "  --camera PX PY PZ FX FY FZ  camera at P looking at F, +y is up so F\n"
+             << "                  must not be straight above or below P\n"
+             << "  --ambient X     ambient light level\n"
+             << "  --aadepth N     anti-alias edges with up to NxN samples per pixel\n"
+             << "  --aathreshold X color difference that marks an edge pixel,\n"
+             << "                  0 supersamples every pixel\n"
+             << "  --bounces N     follow at most N reflections (0 to "
+             << maxBounceLimit << ")\n"
+             << "  --cutoff X      drop reflections carrying less than X of the light\n"
+             << "  --progressive   render in passes: a preview, every pixel, then\n"
+             << "                  more samples on edges, saving after each pass\n"
+             << "  --time-budget S stop a progressive render after S seconds\n"
+             << "  --checkpoint F  save progressive progress to F (implies\n"
+             << "                  --progressive)\n"
+             << "  --checkpoint-every S  seconds between checkpoints (default: 60)\n"
+             << "  --resume        continue the render saved in the checkpoint\n"
+             << "  --threads N     number of render threads (default: all cores)\n"
+             << "  --tile-size N   width and height of a render tile (default: 32)\n"
+             << "  --kernels NAME  intersection kernels: avx2, sse2 or scalar\n"
+             << "                  (default: the widest this CPU supports)\n"
+             << "  --bench-kernels time the kernels against the virtual path\n"
+             << "  --bench-vectors time the shading vector math against plain scalars\n"
+             << "  --no-packets    trace camera rays one at a time\n"
+             << "  --bench-primary time camera rays with and without packets\n"
+             << "  --wavefront     shade the first pass of a frame stage by stage over\n"
+             << "                  whole queues of rays instead of ray by ray\n"
+             << "  --bench-wavefront  render the scene with both integrators, time them\n"
+             << "                  and check they make the same image\n"
+             << "  --bench         render the standard benchmark scenes and write\n"
+             << "                  the timings as JSON\n"
+             << "  --bench-runs N  times each benchmark scene is rendered (default: 3)\n"
+             << "  --bench-out F   file for the JSON report (default: bench.json)\n"
+             << "  --heatmap F     write the time spent on each pixel to the image F\n"
+             << "                  (needs a profiling build, make profile)\n"
+             << "  --compare A B   compare two images, for checking the float\n"
+             << "                  build against the double one (make compare-float)\n"
+             << "  --tolerance N   channel difference, out of 255, a pixel may have\n"
+             << "                  before it counts as different (default: 2)\n"
+             << "  --max-outliers P  percent of pixels that may differ (default: 0.5)\n"
+             << "  --coordinator A hand the frame's tiles out to worker processes\n"
+             << "                  connecting to A, unix:PATH or HOST:PORT. HOST is\n"
+             << "                  loopback when left out, 0.0.0.0 takes any\n"
+             << "  --spawn N       start N local workers for the coordinator\n"
+             << "  --shared-scene F  write the compiled scene to F for the workers to\n"
+             << "                  read, instead of sending it to each of them\n"
+             << "  --worker-timeout S  re-issue the tiles of a worker silent for S\n"
+             << "                  seconds (default: 60)\n"
+             << "  --worker A      render tiles for the coordinator at A\n"
+             << "  --exit-after N  make a worker die after N tiles, for testing\n"
+             << "  --token T       the run token, 32 hex digits, a coordinator's\n"
+             << "                  workers must give. a coordinator makes one up\n"
+             << "                  and prints it when not given one\n"
+             << "  --scene-mb N    largest compiled scene a worker is sent (default:\n"
+             << "                  1024)\n"
+             << "  --serve A       run as a render server taking jobs on the Unix\n"
+             << "                  socket A, unix:PATH, until stopped with Ctrl-C\n"
+             << "  --serve-dir D   the directory jobs may read scenes from and write\n"
+             << "                  images to (default: the current one)\n"
+             << "  --jobs N        jobs a server renders at once (default: 4)\n"
+             << "  --cache-mb N    memory a server keeps loaded scenes in (default: 512)\n"
+             << "  --submit A      have the server at A render this frame; --scene,\n"
+             << "                  --output, --size, --camera, --aadepth and --aov\n"
+             << "                  are sent with the job\n"
+             << "  --server-stats A  print the job latencies and scene cache of the\n"
+             << "                  server at A\n";
+}
+
+/******************************************************************************
+ * PARSE OPTIONS - fills options from argv. returns false on a bad argument
+ *****************************************************************************/
+inline bool parseOptions(int argc, char *argv[], Options &options)
+{
+   bool formatGiven = false;
+
+   for (int i = 1; i < argc; i++)
+   {
+      std::string arg = argv[i];
+
+      if (arg == "--threads" && i + 1 < argc)
+      {
+         options.threads = atoi(argv[++i]);
+         if (options.threads < 1)
+         {
+            std::cerr << "--threads must be at least 1\n";
+            return false;
+         }
+      }
+      else if (arg == "--tile-size" && i + 1 < argc)
+      {
+         options.tileSize = atoi(argv[++i]);
+         if (options.tileSize < 1 || options.tileSize > maxImageSize)
+         {
+            std::cerr << "--tile-size must be from 1 to " << maxImageSize << "\n";
+            return false;
+         }
+      }
+      else if (arg == "--scene" && i + 1 < argc)
+         options.scene = argv[++i];
+      else if ((arg == "--output" || arg == "-o") && i + 1 < argc)
+         options.output = argv[++i];
+      else if (arg == "--format" && i + 1 < argc)
+      {
+         if (!findImageFormat(argv[++i], options.format))
+         {
+            std::cerr << "--format must be bmp or ppm\n";
+            return false;
+         }
+         formatGiven = true;
+      }
+      else if (arg == "--aov" && i + 1 < argc)
+      {
+         std::string name = argv[++i];
+         if (name == "depth")
+            options.aovs |= FrameBuffer::depthChannel;
+         else if (name == "normal")
+            options.aovs |= FrameBuffer::normalChannel;
+         else if (name == "id")
+            options.aovs |= FrameBuffer::idChannel;
+         else
+         {
+            std::cerr << "--aov must be depth, normal or id\n";
+            return false;
+         }
+      }
+      else if (arg == "--size" && i + 1 < argc)
+      {
+         char end;
+         if (sscanf(argv[++i], "%dx%d%c", &options.width, &options.height, &end) != 2 ||
+             options.width < 1 || options.height < 1 || options.width > maxImageSize ||
+             options.height > maxImageSize)
+         {
+            std::cerr << "--size must be WxH, from 1x1 to " << maxImageSize << "x"
+                      << maxImageSize << "\n";
+            return false;
+         }
+      }
+      else if (arg == "--dpi" && i + 1 < argc)
+      {
+         options.dpi = atoi(argv[++i]);
+         if (options.dpi < 1)
+         {
+            std::cerr << "--dpi must be at least 1\n";
+            return false;
+         }
+      }
+      else if (arg == "--ambient" && i + 1 < argc)
+      {
+         options.ambient = atof(argv[++i]);
+         if (options.ambient < 0)
+         {
+            std::cerr << "--ambient must not be negative\n";
+            return false;
+         }
+      }
+      else if (arg == "--crop" && i + 4 < argc)
+      {
+         options.cropX = atoi(argv[++i]);
+         options.cropY = atoi(argv[++i]);
+         options.cropWidth = atoi(argv[++i]);
+         options.cropHeight = atoi(argv[++i]);
+         if (options.cropX < 0 || options.cropY < 0 || options.cropWidth < 1 ||
+             options.cropHeight < 1)
+         {
+            std::cerr << "--crop must start inside the frame and be at least 1x1\n";
+            return false;
+         }
+      }
+      else if (arg == "--camera" && i + 6 < argc)
+      {
+         double v[6];
+         for (int k = 0; k < 6; k++)
+            v[k] = atof(argv[++i]);
+         options.camera = true;
+         options.cameraPosition = Vect(v[0], v[1], v[2]);
+         options.cameraFocus = Vect(v[3], v[4], v[5]);
+         if (!Camera::canLookAt(options.cameraPosition, options.cameraFocus))
+         {
+            std::cerr << "--camera must look at a point apart from its position, and not "
+                         "straight up or down\n";
+            return false;
+         }
+      }
+      else if (arg == "--aadepth" && i + 1 < argc)
+      {
+         options.aadepth = atoi(argv[++i]);
+         if (options.aadepth < 1)
+         {
+            std::cerr << "--aadepth must be at least 1\n";
+            return false;
+         }
+      }
+      else if (arg == "--aathreshold" && i + 1 < argc)
+      {
+         options.aathreshold = atof(argv[++i]);
+         if (options.aathreshold < 0)
+         {
+            std::cerr << "--aathreshold must not be negative\n";
+            return false;
+         }
+      }
+      else if (arg == "--bounces" && i + 1 < argc)
+      {
+         options.bounces = atoi(argv[++i]);
+         if (options.bounces < 0 || options.bounces > maxBounceLimit)
+         {
+            std::cerr << "--bounces must be between 0 and " << maxBounceLimit << "\n";
+            return false;
+         }
+      }
+      else if (arg == "--cutoff" && i + 1 < argc)
+      {
+         options.cutoff = atof(argv[++i]);
+         if (options.cutoff < 0)
+         {
+            std::cerr << "--cutoff must not be negative\n";
+            return false;
+         }
+      }
+      else if (arg == "--progressive")
+         options.progressive = true;
+      else if (arg == "--time-budget" && i + 1 < argc)
+      {
+         options.timeBudget = atof(argv[++i]);
+         options.progressive = true;
+         if (options.timeBudget <= 0)
+         {
+            std::cerr << "--time-budget must be more than 0\n";
+            return false;
+         }
+      }
+      else if (arg == "--checkpoint" && i + 1 < argc)
+      {
+         options.checkpoint = argv[++i];
+         options.progressive = true;
+      }
+      else if (arg == "--checkpoint-every" && i + 1 < argc)
+         options.checkpointEvery = atof(argv[++i]);
+      else if (arg == "--resume")
+         options.resume = true;
+      else if (arg == "--no-cache")
+         options.cache = false;
+      else if (arg == "--kernels" && i + 1 < argc)
+         options.kernels = argv[++i];
+      else if (arg == "--bench-kernels")
+         options.benchKernels = true;
+      else if (arg == "--bench-vectors")
+         options.benchVectors = true;
+      else if (arg == "--no-packets")
+         options.packets = false;
+      else if (arg == "--bench-primary")
+         options.benchPrimary = true;
+      else if (arg == "--wavefront")
+         options.wavefront = true;
+      else if (arg == "--bench-wavefront")
+         options.benchWavefront = true;
+      else if (arg == "--bench")
+         options.bench = true;
+      else if (arg == "--bench-runs" && i + 1 < argc)
+      {
+         options.benchRuns = atoi(argv[++i]);
+         if (options.benchRuns < 1)
+         {
+            std::cerr << "--bench-runs must be at least 1\n";
+            return false;
+         }
+      }
+      else if (arg == "--bench-out" && i + 1 < argc)
+         options.benchOut = argv[++i];
+      else if (arg == "--compare" && i + 2 < argc)
+      {
+         options.compareA = argv[++i];
+         options.compareB = argv[++i];
+      }
+      else if (arg == "--tolerance" && i + 1 < argc)
+         options.tolerance = atoi(argv[++i]);
+      else if (arg == "--max-outliers" && i + 1 < argc)
+         options.maxOutliers = atof(argv[++i]);
+      else if (arg == "--coordinator" && i + 1 < argc)
+         options.coordinator = argv[++i];
+      else if (arg == "--spawn" && i + 1 < argc)
+      {
+         options.spawn = atoi(argv[++i]);
+         if (options.spawn < 0)
+         {
+            std::cerr << "--spawn must not be negative\n";
+            return false;
+         }
+      }
+      else if (arg == "--shared-scene" && i + 1 < argc)
+         options.sharedScene = argv[++i];
+      else if (arg == "--worker-timeout" && i + 1 < argc)
+      {
+         options.workerTimeout = atof(argv[++i]);
+         if (options.workerTimeout <= 0)
+         {
+            std::cerr << "--worker-timeout must be more than 0\n";
+            return false;
+         }
+      }
+      else if (arg == "--worker" && i + 1 < argc)
+         options.worker = argv[++i];
+      else if (arg == "--exit-after" && i + 1 < argc)
+         options.exitAfter = atoi(argv[++i]);
+      else if (arg == "--token" && i + 1 < argc)
+      {
+         options.token = argv[++i];
+         bool hex = options.token.size() == 32;
+         for (int k = 0; hex && k < (int)options.token.size(); k++)
+            hex = isxdigit((unsigned char)options.token[k]);
+         if (!hex)
+         {
+            std::cerr << "--token must be 32 hex digits\n";
+            return false;
+         }
+      }
+      else if (arg == "--serve" && i + 1 < argc)
+      {
+         options.serve = argv[++i];
+         if (options.serve.compare(0, 5, "unix:") != 0)
+         {
+            std::cerr << "--serve must be unix:PATH, a server only takes jobs from its own "
+                      << "machine\n";
+            return false;
+         }
+      }
+      else if (arg == "--scene-mb" && i + 1 < argc)
+      {
+         options.sceneMegabytes = atoi(argv[++i]);
+         if (options.sceneMegabytes < 1)
+         {
+            std::cerr << "--scene-mb must be at least 1\n";
+            return false;
+         }
+      }
+      else if (arg == "--serve-dir" && i + 1 < argc)
+         options.serveDir = argv[++i];
+      else if (arg == "--jobs" && i + 1 < argc)
+      {
+         options.jobs = atoi(argv[++i]);
+         if (options.jobs < 1)
+         {
+            std::cerr << "--jobs must be at least 1\n";
+            return false;
+         }
+      }
+      else if (arg == "--cache-mb" && i + 1 < argc)
+      {
+         options.cacheMegabytes = atoi(argv[++i]);
+         if (options.cacheMegabytes < 0)
+         {
+            std::cerr << "--cache-mb must not be negative\n";
+            return false;
+         }
+      }
+      else if (arg == "--submit" && i + 1 < argc)
+         options.submit = argv[++i];
+      else if (arg == "--server-stats" && i + 1 < argc)
+         options.serverStats = argv[++i];
+      else if (arg == "--heatmap" && i + 1 < argc)
+      {
+         options.heatmap = argv[++i];
+         if (!profiling)
+         {
+            std::cerr << "--heatmap needs a build with RT_PROFILE (make profile)\n";
+            return false;
+         }
+      }
+      else
+      {
+         std::cerr << "unknown option: " << arg << "\n";
+         usage(argv[0]);
+         return false;
+      }
+   }
+
+   if (!formatGiven)
+      options.format = imageFormatOf(options.output);
+
+   if (options.aovs != 0 && options.progressive)
+   {
+      std::cerr << "--aov can not be used with a progressive render\n";
+      return false;
+   }
+
+   if (!options.coordinator.empty() && (options.progressive || !options.worker.empty()))
+   {
+      std::cerr << "--coordinator can not be used with a progressive render or --worker\n";
+      return false;
+   }
+
+   if (options.coordinator.empty() && (options.spawn > 0 || !options.sharedScene.empty()))
+   {
+      std::cerr << "--spawn and --shared-scene need --coordinator\n";
+      return false;
+   }
+
+   if (options.coordinator.empty() && options.worker.empty() && !options.token.empty())
+   {
+      std::cerr << "--token needs --coordinator or --worker\n";
+      return false;
+   }
+
+   if ((!options.serve.empty() || !options.submit.empty()) &&
+       (options.progressive || !options.coordinator.empty()))
+   {
+      std::cerr << "--serve and --submit can not be used with a progressive render or\n"
+                << "--coordinator\n";
+      return false;
+   }
+
+   if (options.serve.empty() && !options.serveDir.empty())
+   {
+      std::cerr << "--serve-dir needs --serve\n";
+      return false;
+   }
+
+   if (options.resume && options.checkpoint.empty())
+   {
+      std::cerr << "--resume needs --checkpoint FILE\n";
+      return false;
+   }
+
+   return true;
+}
+
+#endif
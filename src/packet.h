@@ -0,0 +1,96 @@
+/******************************************************************************
+* Header:
+*   Packet
+* Desc:
+*   Contains the RayPacket struct. Neighbouring camera rays share an origin
+*   and point in nearly the same direction, so the BVH can walk a whole
+*   packet of them at once and cull a box for every ray with one frustum
+*   test. Rays leave the packet once they are shaded, reflections and
+*   shadows are always traced one at a time.
+******************************************************************************/
+#ifndef PACKET_H
+#define PACKET_H
+
+const int packetWidth = 8;                       // packets cover 8x8 pixels
+const int maxPacketRays = packetWidth * packetWidth;
+
+/******************************************************************************
+ * RAY PACKET STRUCT - up to 64 rays leaving the same origin
+ *****************************************************************************/
+struct RayPacket
+{
+   int count;
+   Ray rays[maxPacketRays];
+   SoARay soaRays[maxPacketRays];
+   Real invDir[maxPacketRays][3];
+   Real org[3];
+
+   // the range of 1/direction over the packet on every axis. only usable
+   // when no axis mixes signs, otherwise every box goes to the per ray test
+   Real invMin[3], invMax[3];
+   bool frustum;
+
+   RayPacket() : count(0), frustum(false) {}
+
+   // every ray must start at the same origin
+   void add(const Ray &ray)
+   {
+      const Vect &inv = ray.getRayInvDirection();
+      rays[count] = ray;
+      soaRays[count] = SoARay(ray);
+      invDir[count][0] = inv.getVectX();
+      invDir[count][1] = inv.getVectY();
+      invDir[count][2] = inv.getVectZ();
+      count++;
+   }
+
+   // call after the last add
+   void finish()
+   {
+      org[0] = soaRays[0].ox;
+      org[1] = soaRays[0].oy;
+      org[2] = soaRays[0].oz;
+
+      frustum = true;
+      for (int a = 0; a < 3; a++)
+      {
+         invMin[a] = invMax[a] = invDir[0][a];
+         for (int r = 1; r < count; r++)
+         {
+            invMin[a] = std::min(invMin[a], invDir[r][a]);
+            invMax[a] = std::max(invMax[a], invDir[r][a]);
+         }
+
+         bool oneSign = (invMin[a] > 0) || (invMax[a] < 0);
+         if (!oneSign || !std::isfinite(invMin[a]) || !std::isfinite(invMax[a]))
+            frustum = false;
+      }
+   }
+
+   // true when the box is missed by every ray of the packet before tMax.
+   // interval arithmetic over the direction range bounds the entry and exit
+   // distance of every ray in the packet at once
+   bool frustumMiss(const BBox &box, Real tMax) const
+   {
+      if (!frustum)
+         return false;
+
+      Real tNear = 0;
+      Real tFar = tMax;
+
+      for (int a = 0; a < 3; a++)
+      {
+         Real entry = box.getMin(a) - org[a];
+         Real exit  = box.getMax(a) - org[a];
+         if (invMin[a] < 0)
+            std::swap(entry, exit);
+
+         tNear = std::max(tNear, std::min(entry * invMin[a], entry * invMax[a]));
+         tFar  = std::min(tFar,  std::max(exit * invMin[a],  exit * invMax[a]));
+      }
+
+      return tNear > tFar;
+   }
+};
+
+#endif
@@ -0,0 +1,227 @@
+/******************************************************************************
+* Header:
+*   Profile
+* Desc:
+*   Hot path counters for a profiling build. Compiled with RT_PROFILE
+*   (make profile) every PROFILE(...) statement counts rays by type and
+*   the time spent tracing them, intersection tests by primitive type, how
+*   many reflections shading followed and the time spent on every pixel. Without it the
+*   statements compile to nothing, so a normal build pays nothing for them.
+*   Every render thread counts into its own copy, like TraversalStats.
+******************************************************************************/
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#ifdef RT_PROFILE
+#define PROFILE(...) __VA_ARGS__
+const bool profiling = true;
+#else
+#define PROFILE(...)
+const bool profiling = false;
+#endif
+
+// the rays traced, by why they were traced
+enum RayType { primaryRays, reflectionRays, shadowRays, rayTypeCount };
+
+// intersection tests, by kind of primitive. other is anything tested
+// through the virtual findIntersection, planes included
+enum TestType { sphereTest, triangleTest, meshTest, otherTest, testTypeCount };
+
+// reflection depths counted separately, deeper ones share the last
+const int profileDepths = 8;
+
+/******************************************************************************
+ * PROFILE COUNTERS STRUCT - what the hot paths did on one thread
+ *****************************************************************************/
+struct ProfileCounters
+{
+   long long rays[rayTypeCount];
+   double raySeconds[rayTypeCount];   // time spent in the BVH queries
+   long long tests[testTypeCount];
+   long long shadeDepth[profileDepths]; // surfaces shaded by reflection depth
+
+   ProfileCounters() { memset(this, 0, sizeof(*this)); }
+
+   void add(const ProfileCounters &p)
+   {
+      for (int i = 0; i < rayTypeCount; i++)
+      {
+         rays[i] += p.rays[i];
+         raySeconds[i] += p.raySeconds[i];
+      }
+      for (int i = 0; i < testTypeCount; i++)
+         tests[i] += p.tests[i];
+      for (int i = 0; i < profileDepths; i++)
+         shadeDepth[i] += p.shadeDepth[i];
+   }
+};
+
+// every render thread counts into its own copy, the caller gathers them
+inline ProfileCounters &profileCounters()
+{
+   static thread_local ProfileCounters counters;
+   return counters;
+}
+
+// seconds on a steady clock, for timing a stretch of the hot path
+inline double profileClock()
+{
+   return std::chrono::duration<double>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// counts n rays of a type traced since start
+inline void profileRays(RayType type, int n, double start)
+{
+   ProfileCounters &counters = profileCounters();
+   counters.rays[type] += n;
+   counters.raySeconds[type] += profileClock() - start;
+}
+
+// counts the tests of one BVH leaf
+inline void profileLeafTests(int spheres, int triangles, int meshTriangles, int others)
+{
+   ProfileCounters &counters = profileCounters();
+   counters.tests[sphereTest] += spheres;
+   counters.tests[triangleTest] += triangles;
+   counters.tests[meshTest] += meshTriangles;
+   counters.tests[otherTest] += others;
+}
+
+/******************************************************************************
+ * PROFILE IMAGE CLASS - the seconds spent on every pixel of the frame.
+ *    each pixel is only written by the thread rendering its tile
+ *****************************************************************************/
+class ProfileImage
+{
+private:
+   int width;
+   int height;
+   std::vector<float> seconds;
+
+public:
+   ProfileImage() : width(0), height(0) {}
+
+   void reset(int w, int h)
+   {
+      width = w;
+      height = h;
+      seconds.assign((size_t)w * h, 0);
+   }
+
+   void add(int x, int y, double s) { seconds[(size_t)y * width + x] += s; }
+
+   int getWidth() const  { return width;  }
+   int getHeight() const { return height; }
+   float at(int x, int y) const { return seconds[(size_t)y * width + x]; }
+   bool empty() const { return seconds.empty(); }
+};
+
+// the one frame being profiled
+inline ProfileImage &profileImage()
+{
+   static ProfileImage image;
+   return image;
+}
+
+/******************************************************************************
+ * PRINT PROFILE - the per run summary of a profiling build
+ *****************************************************************************/
+inline void printProfile(std::ostream &out, const ProfileCounters &counters)
+{
+   const char *rayNames[rayTypeCount] = { "primary", "reflection", "shadow" };
+   const char *testNames[testTypeCount] = { "sphere", "triangle", "mesh triangle", "other" };
+
+   out << "profile:" << std::endl;
+   for (int i = 0; i < rayTypeCount; i++)
+   {
+      out << "   " << rayNames[i] << " rays: " << counters.rays[i] << " in "
+          << counters.raySeconds[i] << " thread s";
+      if (counters.rays[i] > 0)
+         out << ", " << counters.raySeconds[i] / counters.rays[i] * 1e9 << " ns each";
+      out << std::endl;
+   }
+
+   out << "   tests:";
+   for (int i = 0; i < testTypeCount; i++)
+      out << (i > 0 ? ", " : " ") << counters.tests[i] << " " << testNames[i];
+   out << std::endl;
+
+   out << "   shading depth:";
+   for (int i = 0; i < profileDepths; i++)
+      out << (i > 0 ? ", " : " ") << i << (i == profileDepths - 1 ? "+" : "") << ": "
+          << counters.shadeDepth[i];
+   out << std::endl;
+
+   const ProfileImage &image = profileImage();
+   if (!image.empty())
+   {
+      double total = 0, most = 0;
+      int mostX = 0, mostY = 0;
+      for (int y = 0; y < image.getHeight(); y++)
+         for (int x = 0; x < image.getWidth(); x++)
+         {
+            total += image.at(x, y);
+            if (image.at(x, y) > most)
+            {
+               most = image.at(x, y);
+               mostX = x;
+               mostY = y;
+            }
+         }
+      out << "   pixels: " << total / (image.getWidth() * image.getHeight()) * 1e6
+          << " us on average, most " << most * 1e6 << " us at (" << mostX << ", "
+          << mostY << ")" << std::endl;
+   }
+}
+
+/******************************************************************************
+ * WRITE HEATMAP - writes the profile image as a heatmap, from black for the
+ *    cheapest pixels through blue, red and yellow to white for the dearest.
+ *    costs are scaled logarithmically so a few slow pixels do not wash out
+ *    the rest
+ *****************************************************************************/
+inline bool writeHeatmap(const char *filename, int dpi)
+{
+   const ProfileImage &image = profileImage();
+   if (image.empty())
+      return false;
+
+   double lo = std::numeric_limits<double>::infinity(), hi = 0;
+   for (int y = 0; y < image.getHeight(); y++)
+      for (int x = 0; x < image.getWidth(); x++)
+         if (image.at(x, y) > 0)
+         {
+            lo = std::min(lo, (double)image.at(x, y));
+            hi = std::max(hi, (double)image.at(x, y));
+         }
+   double range = hi > lo ? log(hi / lo) : 1;
+
+   // color stops of the ramp, cheapest first
+   const double ramp[5][3] = { { 0, 0, 0 }, { 0, 0, 1 }, { 1, 0, 0 }, { 1, 1, 0 }, { 1, 1, 1 } };
+
+   BmpWriter heatmap;
+   if (!heatmap.open(filename, image.getWidth(), image.getHeight(), dpi))
+      return false;
+
+   // rows in the same order as the rendered image
+   std::vector<RGBType> row (image.getWidth());
+   for (int y = 0; y < image.getHeight(); y++)
+   {
+      for (int x = 0; x < image.getWidth(); x++)
+      {
+         double cost = image.at(x, y);
+         double k = cost > 0 ? log(cost / lo) / range * 4 : 0;
+         int stop = std::min((int)k, 3);
+         double f = std::min(k - stop, 1.0);
+         row[x].r = ramp[stop][0] + (ramp[stop + 1][0] - ramp[stop][0]) * f;
+         row[x].g = ramp[stop][1] + (ramp[stop + 1][1] - ramp[stop][1]) * f;
+         row[x].b = ramp[stop][2] + (ramp[stop + 1][2] - ramp[stop][2]) * f;
+      }
+      if (!heatmap.writeRows(&row[0], 1))
+         return false;
+   }
+   return heatmap.close();
+}
+
+#endif
@@ -0,0 +1,29 @@
+/******************************************************************************
+* Header:
+*   Real
+* Desc:
+*   The scalar type of the geometry, color and intersection math. Compiled
+*   with RT_FLOAT (make float) it is float, which doubles the lanes of every
+*   SIMD kernel and halves the memory the scene and the BVH take; otherwise
+*   it is double. The tolerances that depend on the precision live here.
+******************************************************************************/
+#ifndef REAL_H
+#define REAL_H
+
+#ifdef RT_FLOAT
+typedef float Real;
+#else
+typedef double Real;
+#endif
+
+// a float carries about 7 digits, a double about 16
+const bool singlePrecision = sizeof(Real) < sizeof(double);
+
+// sphere hits are pulled back by this much so the hit point lands outside
+// the surface and its shadow and reflection rays do not hit it again
+const Real sphereBias = singlePrecision ? 0.0001 : 0.000001;
+
+// the default RenderSettings::accuracy, hits closer than this are ignored
+const double defaultAccuracy = singlePrecision ? 0.0001 : 0.00000001;
+
+#endif
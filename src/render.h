@@ -0,0 +1,654 @@
+/******************************************************************************
+* Header:
+*   Render
+* Desc:
+*   Renders a frame: the built in scene, camera rays, renderTile with its
+*   adaptive anti-aliasing, the BandWriter that saves the image a band at a
+*   time and renderFrame, which hands the tiles to the render threads. A
+*   local render, the workers of a distributed render and the render server
+*   all go through these.
+******************************************************************************/
+#ifndef RENDER_H
+#define RENDER_H
+
+/******************************************************************************
+ * BUILD DEFAULT SCENE - three shiny spheres on a checkered floor
+ *****************************************************************************/
+inline void buildDefaultScene(Scene &scene)
+{
+   // standard vectors
+   Vect X (1,0,0);
+   Vect Y (0,1,0);
+   Vect Z (0,0,1);
+   Vect O (0,0,0); // origin
+
+   Vect Pos1 ( 1.75, -0.25, 0);
+   Vect Pos2 (-1.75, -0.25, 0);
+
+   // define camera
+   Vect campos (3, 1.5, -4);
+   scene.setCamera(Camera::lookAt(campos, O));
+
+   // colors
+   Color white  ( 1.0,  1.0,  1.0);
+   Color gray   ( 0.5,  0.5,  0.5);
+   Color black  ( 0.0,  0.0,  0.0);
+   Color maroon ( 0.5, 0.25, 0.25);
+   Color orange (0.94, 0.75, 0.31);
+   Color green  ( 0.5,  1.0,  0.5);
+
+   // materials: reflective ones with a highlight and a checkered floor
+   Material shine;
+   shine.reflectivity = 0.3;
+   shine.specular = 0.3;
+   shine.shininess = 10;
+
+   shine.color = green;
+   int greenShine = scene.addMaterial(shine);
+   shine.color = maroon;
+   int maroonShine = scene.addMaterial(shine);
+   shine.color = orange;
+   int orangeShine = scene.addMaterial(shine);
+
+   Material checker;
+   checker.color = white;
+   checker.second = black;
+   checker.pattern = checkerPattern;
+   int tile = scene.addMaterial(checker);
+
+   // scene objects
+   scene.addObject(new Sphere (   O,    1,  greenShine));
+   scene.addObject(new Sphere (Pos1, 0.75, maroonShine));
+   scene.addObject(new Sphere (Pos2, 0.75, orangeShine));
+   scene.addObject(new Plane (Y, -1, tile));
+   //scene.addObject(new Triangle (Vect(3,0,0), Vect(0,3,0), Vect(0,0,3), orange));
+
+   //scene.addObject(TriangleMesh::makeCube(Vect (1,1,1), Vect (-1,-1,-1), orange));
+
+   // light source (s)
+   Vect lightPos1 (-7,10,-10);
+   //Vect lightPos2 (14,10,-10);
+   scene.addLight(new Light (lightPos1, white));
+   //scene.addLight(new Light (lightPos2, gray));
+}
+
+/******************************************************************************
+ * CAMERA RAY - the ray from the camera through the point (sx, sy) of pixel
+ *    (x, y), where (0.5, 0.5) is the middle of the pixel
+ *****************************************************************************/
+inline Ray cameraRay(const Scene &scene, int x, int y, double sx, double sy)
+{
+   const RenderSettings &settings = scene.getSettings();
+   int width = settings.width;
+   int height = settings.height;
+   double aspectratio = (double)width / (double)height;
+   double xamnt, yamnt; // amounts
+
+   const Camera &camera = scene.getCamera();
+   const Vect &camdir = camera.getCameraDirection();
+   const Vect &camright = camera.getCamRight();
+   const Vect &camdown = camera.getCamDown();
+
+   if (width > height)
+   {
+      // the image is wider than it is tall
+      xamnt = ((x+sx)/width)*aspectratio - (((width - height)/(double)height)/2);
+      yamnt = ((height -y)+sy)/height;
+   }
+   else if (height > width)
+   {
+      // the image is taller than it is wide
+      xamnt = (x + sx)/width;
+      yamnt = (((height-y)+sy)/height)/aspectratio - (((height - width)/(double)width)/2);
+   }
+   else
+   {
+      // the image is square
+      xamnt = (x + sx)/width;
+      yamnt = ((height - y)+ sy)/height;
+   }
+
+   // create rays
+   const Vect &camRayOrg = camera.getCameraPosition();
+   Vect camRayDir = (camdir + (camright * (xamnt - 0.5)).addScaled(camdown, yamnt - 0.5))
+                    .normalize();
+
+   return Ray (camRayOrg, camRayDir);
+}
+
+/******************************************************************************
+ * SHADE SAMPLE - the color a camera ray sees, black if it hit nothing
+ *****************************************************************************/
+inline Color shadeSample(const Scene &scene, const Ray &ray, const Hit *hit)
+{
+   // the hit holds the position and normal at the point of intersection
+   if (hit != NULL && hit->t > scene.getSettings().accuracy)
+      return getColorAt(*hit, ray.getRayDirection(), scene);
+
+   // set the background black
+   return Color (0, 0, 0);
+}
+
+/******************************************************************************
+ * SHADE ORDER - fills order with the rays of a packet sorted by the
+ *    material they hit, misses first, keeping the packet order within a
+ *    material. shading the rays in this order runs each material's code
+ *    for all its hits in a row instead of switching from ray to ray
+ *****************************************************************************/
+inline void shadeOrder(const Hit hits[], const bool found[], int count, int order[])
+{
+   int key[maxPacketRays];
+   for (int r = 0; r < count; r++)
+   {
+      key[r] = found[r] ? hits[r].material : -1;
+
+      // insertion sort, a packet mostly holds long runs of one material
+      int i = r;
+      for (; i > 0 && key[order[i - 1]] > key[r]; i--)
+         order[i] = order[i - 1];
+      order[i] = r;
+   }
+}
+
+/******************************************************************************
+ * AA REFINE DEPTH - how many times a pixel may be split in four. aadepth is
+ *    the finest grid of samples per axis, rounded up to a power of two
+ *****************************************************************************/
+inline int aaRefineDepth(int aadepth)
+{
+   int depth = 0;
+   while ((1 << depth) < aadepth)
+      depth++;
+   return depth;
+}
+
+/******************************************************************************
+ * COLOR DIFFERENCE - the largest difference between two colors in any
+ *    channel, compared against aathreshold
+ *****************************************************************************/
+inline double colorDifference(Color a, Color b)
+{
+   return std::max(std::fabs(a.getColorRed() - b.getColorRed()),
+          std::max(std::fabs(a.getColorGreen() - b.getColorGreen()),
+                   std::fabs(a.getColorBlue() - b.getColorBlue())));
+}
+
+/******************************************************************************
+ * REFINE PIXEL - the color of the square [ox, ox+size) x [oy, oy+size) of
+ *    pixel (x, y). one sample goes in the middle of each quarter of the
+ *    square, quarters are split again while their samples disagree by
+ *    aathreshold or more and depth allows. counts the samples it traces
+ *    and, unless traceSeconds is NULL, adds the time spent finding their
+ *    hits to it
+ *****************************************************************************/
+inline Color refinePixel(const Scene &scene, int x, int y, double ox, double oy,
+                         double size, int depth, long long &samples, double *traceSeconds)
+{
+   const BVH &bvh = scene.getBVH();
+   double half = size / 2;
+
+   Ray rays[4];
+   Hit hits[4];
+   bool found[4];
+   std::chrono::steady_clock::time_point traceStart;
+   if (traceSeconds)
+      traceStart = std::chrono::steady_clock::now();
+   PROFILE(double profileStart = profileClock());
+   for (int q = 0; q < 4; q++)
+   {
+      rays[q] = cameraRay(scene, x, y, ox + half * (q % 2) + half / 2,
+                          oy + half * (q / 2) + half / 2);
+      found[q] = bvh.closestHit(rays[q], hits[q]);
+   }
+   if (traceSeconds)
+      *traceSeconds += secondsSince(traceStart);
+   PROFILE(profileRays(primaryRays, 4, profileStart));
+
+   Color quarter[4];
+   for (int q = 0; q < 4; q++)
+      quarter[q] = shadeSample(scene, rays[q], found[q] ? &hits[q] : NULL);
+   samples += 4;
+
+   if (depth > 1)
+   {
+      double difference = 0;
+      for (int q = 1; q < 4; q++)
+         difference = std::max(difference, colorDifference(quarter[0], quarter[q]));
+      for (int q = 1; q < 3; q++)
+         difference = std::max(difference, colorDifference(quarter[3], quarter[q]));
+
+      if (difference >= scene.getSettings().aathreshold)
+         for (int q = 0; q < 4; q++)
+            quarter[q] = refinePixel(scene, x, y, ox + half * (q % 2), oy + half * (q / 2),
+                                     half, depth - 1, samples, traceSeconds);
+   }
+
+   return quarter[0].colorAdd(quarter[1]).colorAdd(quarter[2]).colorAdd(quarter[3])
+                    .colorScalar(0.25);
+}
+
+/******************************************************************************
+ * RENDER TILE - traces every pixel of a tile and stores its color in the
+ *    frame buffer, along with what the middle of the pixel hit when the
+ *    buffer carries depth, normal or id channels. The first pass traces one
+ *    sample in the middle of every pixel, in 8x8 packets when
+ *    settings.packets is on, and shades each hit as it comes or, with
+ *    settings.wavefront, queues them all for shadeWavefront. With
+ *    anti-aliasing the pass also covers a one pixel border around the
+ *    tile, and any pixel that differs from a neighbour by aathreshold or
+ *    more is refined with refinePixel. firstPass and wave are scratch space
+ *    owned by the calling thread. returns the samples traced and, unless
+ *    traceSeconds is NULL, adds the time spent finding their hits to it.
+ *    reading the clock per packet is not free, so only benchmarks ask
+ *****************************************************************************/
+inline long long renderTile(const Scene &scene, const Tile &tile, FrameBuffer &pixels,
+                            std::vector<Color> &firstPass, Wavefront &wave, double *traceSeconds)
+{
+   const RenderSettings &settings = scene.getSettings();
+   const BVH &bvh = scene.getBVH();
+   int depth = aaRefineDepth(settings.aadepth);
+   int border = depth > 0 ? 1 : 0;
+   bool surfaces = pixels.getChannels() != FrameBuffer::colorChannel;
+
+   // the first pass covers the tile and its border, clipped to the frame.
+   // the border may reach past a crop, so a cropped pixel comes out the same
+   // as in the full frame
+   int ax0 = std::max(tile.x0 - border, 0);
+   int ay0 = std::max(tile.y0 - border, 0);
+   int ax1 = std::min(tile.x1 + border, settings.width);
+   int ay1 = std::min(tile.y1 + border, settings.height);
+   int areaWidth = ax1 - ax0;
+
+   firstPass.resize(areaWidth * (ay1 - ay0));
+   wave.frames.clear();
+
+   RayPacket packet;
+   Hit hits[maxPacketRays];
+   bool found[maxPacketRays];
+
+   for (int by = ay0; by < ay1; by += packetWidth)
+   {
+      for (int bx = ax0; bx < ax1; bx += packetWidth)
+      {
+         int bx1 = std::min(bx + packetWidth, ax1);
+         int by1 = std::min(by + packetWidth, ay1);
+
+         std::chrono::steady_clock::time_point traceStart;
+         if (traceSeconds)
+            traceStart = std::chrono::steady_clock::now();
+         PROFILE(double profileStart = profileClock());
+         packet.count = 0;
+         for (int y = by; y < by1; y++)
+            for (int x = bx; x < bx1; x++)
+               packet.add(cameraRay(scene, x, y, 0.5, 0.5));
+
+         if (settings.packets)
+         {
+            packet.finish();
+            bvh.closestHitPacket(packet, hits, found);
+         }
+         else
+         {
+            for (int r = 0; r < packet.count; r++)
+               found[r] = bvh.closestHit(packet.rays[r], hits[r]);
+         }
+         if (traceSeconds)
+            *traceSeconds += secondsSince(traceStart);
+         PROFILE(profileRays(primaryRays, packet.count, profileStart));
+
+         // every ray of the packet is charged an even share of tracing it
+         PROFILE(double rayShare = (profileClock() - profileStart) / packet.count);
+
+         // shade the packet a material at a time
+         int order[maxPacketRays];
+         shadeOrder(hits, found, packet.count, order);
+         for (int i = 0; i < packet.count; i++)
+         {
+            int r = order[i];
+            int x = bx + r % (bx1 - bx), y = by + r / (bx1 - bx);
+            PROFILE(double shadeStart = profileClock());
+            int sample = (y - ay0) * areaWidth + (x - ax0);
+            if (!settings.wavefront)
+               firstPass[sample] = shadeSample(scene, packet.rays[r], found[r] ? &hits[r] : NULL);
+            else if (found[r] && hits[r].t > settings.accuracy)
+               wave.add(hits[r], packet.rays[r].getRayDirection(), sample, -1, 1);
+            else
+               firstPass[sample] = Color (0, 0, 0);
+
+            // the border belongs to other tiles, its cost is not charged
+            PROFILE(if (x >= tile.x0 && x < tile.x1 && y >= tile.y0 && y < tile.y1)
+                       profileImage().add(x, y, rayShare + profileClock() - shadeStart));
+
+            if (surfaces && x >= tile.x0 && x < tile.x1 && y >= tile.y0 && y < tile.y1)
+            {
+               if (found[r])
+                  pixels.setSurface(pixels.locate(x, y), hits[r].t, hits[r].normal,
+                                    hits[r].index);
+               else
+                  pixels.setSurface(pixels.locate(x, y), 0, Vect(), -1);
+            }
+         }
+      }
+   }
+
+   if (settings.wavefront)
+   {
+      PROFILE(double waveStart = profileClock());
+      shadeWavefront(scene, wave, firstPass);
+
+      // the stages do not keep track of pixels, every pixel of the tile
+      // is charged an even share
+      PROFILE(double share = (profileClock() - waveStart) / ((tile.x1 - tile.x0) * (tile.y1 - tile.y0));
+              for (int y = tile.y0; y < tile.y1; y++)
+                 for (int x = tile.x0; x < tile.x1; x++)
+                    profileImage().add(x, y, share));
+   }
+
+   long long samples = firstPass.size();
+
+   for (int y = tile.y0; y < tile.y1; y++)
+      for (int x = tile.x0; x < tile.x1; x++)
+      {
+         Color color = firstPass[(y - ay0) * areaWidth + (x - ax0)];
+
+         // refine pixels on an edge, judged by their eight neighbours. a
+         // threshold of 0 refines every pixel
+         double difference = 0;
+         for (int ny = std::max(y - border, ay0); ny < std::min(y + border + 1, ay1); ny++)
+            for (int nx = std::max(x - border, ax0); nx < std::min(x + border + 1, ax1); nx++)
+               difference = std::max(difference, colorDifference(color,
+                                     firstPass[(ny - ay0) * areaWidth + (nx - ax0)]));
+
+         if (depth > 0 && difference >= settings.aathreshold)
+         {
+            PROFILE(double refineStart = profileClock());
+            color = refinePixel(scene, x, y, 0, 0, 1, depth, samples, traceSeconds);
+            PROFILE(profileImage().add(x, y, profileClock() - refineStart));
+         }
+
+         pixels.setColor(pixels.locate(x, y), color);
+      }
+
+   return samples;
+}
+
+// the channels that can be written next to the image and their names
+const FrameBuffer::Channel aovChannels[3] =
+   { FrameBuffer::depthChannel, FrameBuffer::normalChannel, FrameBuffer::idChannel };
+const char *const aovNames[3] = { "depth", "normal", "id" };
+
+/******************************************************************************
+ * AOV FILENAME - where an extra channel of image goes: image with
+ *    .name.pfm in place of its extension, e.g. scene.depth.pfm
+ *****************************************************************************/
+inline std::string aovFilename(const std::string &image, const char *name)
+{
+   size_t dot = image.rfind('.');
+   size_t slash = image.rfind('/');
+   std::string stem = image;
+   if (dot != std::string::npos && (slash == std::string::npos || dot > slash))
+      stem = image.substr(0, dot);
+   return stem + "." + name + ".pfm";
+}
+
+/******************************************************************************
+ * BAND WRITER CLASS - writes the bands of a frame to the image and each
+ *    extra channel to its PFM, putting their rows back in scanline order
+ *****************************************************************************/
+class BandWriter
+{
+private:
+   ImageWriter image;
+   PfmWriter channels[3];
+   int aovs;
+   int width;
+   std::vector<RGBType> rows; // a band's colors in scanline order
+   std::vector<float> values; // the same for a channel
+
+public:
+   BandWriter() : aovs(0), width(0) {}
+
+   // creates the files for a w x h frame of bands up to bandHeight rows,
+   // in directory if given. false if one could not be
+   bool open(const char *filename, ImageFormat format, int w, int h, int dpi,
+             int withAovs, int bandHeight, int directory = AT_FDCWD)
+   {
+      aovs = withAovs;
+      width = w;
+      rows.resize(width * bandHeight);
+      if (aovs != 0)
+         values.resize(3 * width * bandHeight);
+
+      if (!image.open(filename, format, width, h, dpi, directory))
+         return false;
+      for (int c = 0; c < 3; c++)
+         if ((aovs & aovChannels[c]) &&
+             !channels[c].open(aovFilename(filename, aovNames[c]).c_str(), width, h,
+                               FrameBuffer::channelWidth(aovChannels[c]), directory))
+            return false;
+      return true;
+   }
+
+   // writes the rows [y0, y1) of pixels
+   bool write(const FrameBuffer &pixels, int y0, int y1)
+   {
+      for (int y = y0; y < y1; y++)
+         pixels.colorRow(y, &rows[(y - y0) * width]);
+      if (!image.writeRows(&rows[0], y1 - y0))
+         return false;
+
+      for (int c = 0; c < 3; c++)
+         if (aovs & aovChannels[c])
+         {
+            int perPixel = FrameBuffer::channelWidth(aovChannels[c]);
+            for (int y = y0; y < y1; y++)
+               pixels.channelRow(aovChannels[c], y, &values[(y - y0) * width * perPixel]);
+            if (!channels[c].writeRows(&values[0], y1 - y0))
+               return false;
+         }
+      return true;
+   }
+
+   bool close()
+   {
+      if (!image.close())
+         return false;
+      for (int c = 0; c < 3; c++)
+         if ((aovs & aovChannels[c]) && !channels[c].close())
+            return false;
+      return true;
+   }
+};
+
+/******************************************************************************
+ * RENDER FRAME - renders the frame with renderTile and writes it to
+ *    filename a band of tile rows at a time, so only one band is ever held
+ *    in memory. The threads fill a tiled FrameBuffer and BandWriter puts
+ *    the band in scanline order only to write it, with the channels in
+ *    options.aovs going to PFM files named by aovFilename, all of them in
+ *    directory if given. fills frame with the timings and counts of the
+ *    render, the trace and shade split only for the benchmark suite
+ *****************************************************************************/
+inline bool renderFrame(const Scene &scene, TileScheduler &scheduler, const Options &options,
+                        const char *filename, ImageFormat format, FrameStats &frame,
+                        int directory = AT_FDCWD)
+{
+   const RenderSettings &settings = scene.getSettings();
+   int threads = scheduler.getThreadCount();
+
+   // the part of the frame rendered, all of it unless cropped
+   int x0, y0, x1, y1;
+   settings.region(x0, y0, x1, y1);
+   int width = x1 - x0;
+
+   // bvh traversal counts, one slot per render thread
+   std::vector<TraversalStats> traceStats (threads);
+
+   // heap allocations made while tracing, one slot per render thread
+   std::vector<long long> traceAllocations (threads, 0);
+
+   // camera samples traced, one slot per render thread
+   std::vector<long long> traceSamples (threads, 0);
+
+   // time spent finding camera ray hits, one slot per render thread
+   std::vector<double> traceSeconds (threads, 0);
+   bool timeTrace = options.bench;
+
+   // hot path counters of a profiling build, one slot per render thread
+   std::vector<ProfileCounters> profile (threads);
+   PROFILE(profileImage().reset(settings.width, settings.height));
+
+   // first pass colors of a tile and its border, one buffer per render
+   // thread, sized up front so the render loop does not allocate
+   std::vector<std::vector<Color> > firstPass (threads);
+   for (int i = 0; i < threads; i++)
+      firstPass[i].reserve((options.tileSize + 2) * (options.tileSize + 2));
+
+   // the queues of the wavefront integrator, one per render thread
+   std::vector<Wavefront> wavefronts (threads);
+   if (settings.wavefront)
+      for (int i = 0; i < threads; i++)
+         wavefronts[i].reserve((options.tileSize + 2) * (options.tileSize + 2));
+
+   // a band holds enough tiles to keep every thread busy, never the whole image
+   int tilesPerRow = (width + options.tileSize - 1) / options.tileSize;
+   int bandTileRows = (8 * threads + tilesPerRow - 1) / tilesPerRow;
+   int bandHeight = std::min(bandTileRows * options.tileSize, y1 - y0);
+   FrameBuffer pixels;
+
+   // render every tile of the band and store the color of each pixel
+   TileScheduler::TileFunc tileFunc = [&](const Tile &tile, int thread)
+   {
+      long long allocationsBefore = threadAllocations();
+
+      traceSamples[thread] += renderTile(scene, tile, pixels, firstPass[thread],
+                                         wavefronts[thread],
+                                         timeTrace ? &traceSeconds[thread] : NULL);
+
+      // move this tile's traversal counts into the thread's slot
+      traceStats[thread].add(traversalStats());
+      traversalStats() = TraversalStats();
+      PROFILE(profile[thread].add(profileCounters()); profileCounters() = ProfileCounters());
+
+      traceAllocations[thread] += threadAllocations() - allocationsBefore;
+   };
+
+   BandWriter writer;
+   if (!writer.open(filename, format, width, y1 - y0, settings.dpi, options.aovs, bandHeight,
+                    directory))
+      return false;
+
+   frame = FrameStats();
+   frame.bandHeight = bandHeight;
+   frame.workers.resize(threads);
+
+   std::chrono::steady_clock::time_point renderStart = std::chrono::steady_clock::now();
+   for (int bandY0 = y0; bandY0 < y1; bandY0 += bandHeight)
+   {
+      int bandY1 = std::min(bandY0 + bandHeight, y1);
+      std::vector<Tile> tiles = makeTiles(x0, bandY0, x1, bandY1, options.tileSize);
+      pixels.reset(x0, bandY0, x1, bandY1, options.tileSize,
+                   FrameBuffer::colorChannel | options.aovs);
+      std::vector<WorkerStats> bandStats;
+      scheduler.run(tiles, tileFunc, bandStats);
+
+      frame.tiles += tiles.size();
+      frame.bands++;
+      for (int i = 0; i < (int)bandStats.size(); i++)
+      {
+         frame.workers[i].busySeconds += bandStats[i].busySeconds;
+         frame.workers[i].tilesRendered += bandStats[i].tilesRendered;
+         frame.workers[i].tilesStolen += bandStats[i].tilesStolen;
+      }
+
+      // save the band's pixels to the image
+      std::chrono::steady_clock::time_point writeStart = std::chrono::steady_clock::now();
+      if (!writer.write(pixels, bandY0, bandY1))
+         return false;
+      frame.writeSeconds += secondsSince(writeStart);
+   }
+   if (!writer.close())
+      return false;
+   frame.renderSeconds = secondsSince(renderStart);
+
+   double busy = 0, tracing = 0;
+   for (int i = 0; i < threads; i++)
+   {
+      busy += frame.workers[i].busySeconds;
+      tracing += traceSeconds[i];
+      frame.traversal.add(traceStats[i]);
+      frame.profile.add(profile[i]);
+      frame.samples += traceSamples[i];
+      frame.allocations += traceAllocations[i];
+   }
+
+   // share the time the threads were rendering between the two phases
+   if (timeTrace)
+   {
+      double rendering = frame.renderSeconds - frame.writeSeconds;
+      frame.traceSeconds = busy > 0 ? rendering * std::min(tracing / busy, 1.0) : 0;
+      frame.shadeSeconds = rendering - frame.traceSeconds;
+   }
+   return true;
+}
+
+/******************************************************************************
+ * APPLY OPTIONS - overrides the scene's settings and camera with the ones
+ *    given on the command line. false, with the problem printed, if the
+ *    crop does not fit the frame
+ *****************************************************************************/
+inline bool applyOptions(const Options &options, Scene &scene)
+{
+   RenderSettings &settings = scene.getSettings();
+   settings.packets = options.packets;
+   settings.wavefront = options.wavefront;
+   if (options.width > 0)
+   {
+      settings.width = options.width;
+      settings.height = options.height;
+   }
+   if (options.dpi > 0)
+      settings.dpi = options.dpi;
+   if (options.ambient >= 0)
+      settings.ambientlight = options.ambient;
+   if (options.aadepth > 0)
+      settings.aadepth = options.aadepth;
+   if (options.aathreshold >= 0)
+      settings.aathreshold = options.aathreshold;
+   if (options.bounces >= 0)
+      settings.maxBounces = options.bounces;
+   if (options.cutoff >= 0)
+      settings.minThroughput = options.cutoff;
+   if (options.cropWidth > 0)
+   {
+      settings.cropX = options.cropX;
+      settings.cropY = options.cropY;
+      settings.cropWidth = options.cropWidth;
+      settings.cropHeight = options.cropHeight;
+   }
+   if (options.camera)
+      scene.setCamera(Camera::lookAt(options.cameraPosition, options.cameraFocus));
+
+   if (!settings.cropFits())
+   {
+      std::cerr << "the crop " << settings.cropWidth << "x" << settings.cropHeight << " at "
+                << settings.cropX << " " << settings.cropY << " does not fit the "
+                << settings.width << "x" << settings.height << " frame" << std::endl;
+      return false;
+   }
+   return true;
+}
+
+/******************************************************************************
+ * STOP REQUESTED - set by SIGINT and SIGTERM so a progressive render can
+ *    save its progress, and the render server finish its jobs, before
+ *    they exit
+ *****************************************************************************/
+inline volatile sig_atomic_t stopRequested = 0;
+
+inline void requestStop(int signal)
+{
+   stopRequested = 1;
+}
+
+#endif
@@ -0,0 +1,164 @@
+/******************************************************************************
+* Header:
+*   Scene
+* Desc:
+*   Contains the Scene class. A scene owns everything needed to render a
+*   frame: the objects, their materials, the lights, the camera, the render
+*   settings and the BVH over the objects. It is built once and then only
+*   read, so every render thread shares the same copy by const reference. A
+*   scene loaded from the binary cache also owns the mapping its arrays
+*   point into. A scene can also share another's objects, lights and BVH
+*   while having its own camera and settings, so one loaded scene serves
+*   renders from different views.
+******************************************************************************/
+#ifndef SCENE_H
+#define SCENE_H
+
+// the most reflections a ray can follow, whatever maxBounces says
+const int maxBounceLimit = 32;
+
+// the widest and tallest image a frame may be, so pixel counts stay well
+// inside an int
+const int maxImageSize = 16384;
+
+/******************************************************************************
+ * RENDER SETTINGS STRUCT - image size and shading constants
+ *****************************************************************************/
+struct RenderSettings
+{
+   int dpi;
+   int width;
+   int height;
+   int aadepth;         // most samples per axis an anti-aliased pixel gets
+   double accuracy;     // intersections closer than this are ignored
+   double ambientlight;
+   double aathreshold;  // color difference that makes a pixel get refined
+   bool packets;        // trace camera rays in 8x8 packets
+   bool wavefront;      // shade the first pass with shadeWavefront
+   int maxBounces;      // most reflections followed from a camera ray's hit
+   double minThroughput; // reflections carrying less of the light are dropped
+   int cropX, cropY;    // top left corner of the part of the frame rendered
+   int cropWidth;       // size of that part, 0 renders the whole frame
+   int cropHeight;
+
+   RenderSettings() : dpi(72), width(640), height(480), aadepth(1)
+                    , accuracy(defaultAccuracy), ambientlight(0.2), aathreshold(0.1)
+                    , packets(true), wavefront(false), maxBounces(8), minThroughput(0.001)
+                    , cropX(0), cropY(0), cropWidth(0), cropHeight(0) {}
+
+   bool cropped() const { return cropWidth > 0; }
+
+   // whether a scene file could have given these, for settings read back
+   // from a scene cache that may be damaged or come from a coordinator.
+   // the crop is checked against the frame only once options are applied
+   bool isValid() const
+   {
+      return width >= 1 && height >= 1 && width <= maxImageSize && height <= maxImageSize &&
+             dpi >= 1 && aadepth >= 1 && maxBounces >= 0 && maxBounces <= maxBounceLimit &&
+             cropX >= 0 && cropY >= 0 && cropWidth >= 0 && cropHeight >= 0;
+   }
+
+   // false if the crop does not lie inside the frame
+   bool cropFits() const
+   {
+      return !cropped() || (cropX >= 0 && cropY >= 0 && cropHeight > 0 &&
+                            cropX + cropWidth <= width && cropY + cropHeight <= height);
+   }
+
+   // the pixels rendered, [x0, x1) x [y0, y1). y counts up from the bottom
+   // row like the renderer does, while the crop counts down from the top
+   void region(int &x0, int &y0, int &x1, int &y1) const
+   {
+      if (!cropped())
+      {
+         x0 = y0 = 0;
+         x1 = width;
+         y1 = height;
+         return;
+      }
+      x0 = cropX;
+      x1 = cropX + cropWidth;
+      y0 = height - (cropY + cropHeight);
+      y1 = height - cropY;
+   }
+};
+
+/******************************************************************************
+ * SCENE CLASS - owns the objects, lights, camera and settings of a frame
+ *****************************************************************************/
+class Scene
+{
+private:
+   MappedFile storage;           // the scene cache, when loaded from one
+   std::vector<Object*> objects;
+   std::vector<Source*> lights;
+   MaterialTable materials;
+   Camera camera;
+   RenderSettings settings;
+   BVH bvh;
+   bool shared; // the objects and lights belong to another scene
+
+public:
+   Scene() : shared(false) {}
+   ~Scene() { clear(); }
+
+   // back to an empty scene with default settings
+   void clear()
+   {
+      for (int i = 0; !shared && i < (int)objects.size(); i++)
+         delete objects[i];
+      for (int i = 0; !shared && i < (int)lights.size(); i++)
+         delete lights[i];
+      shared = false;
+      objects.clear();
+      lights.clear();
+      materials.clear();
+      camera = Camera();
+      settings = RenderSettings();
+      bvh = BVH();
+      storage.close();
+   }
+
+   // the scene owns its objects, copying it would delete them twice
+   Scene(const Scene &) = delete;
+   Scene &operator = (const Scene &) = delete;
+
+   // the scene takes ownership of anything added
+   void addObject(Object *object) { objects.push_back(object); }
+   void addLight(Source *light)   { lights.push_back(light);   }
+   void setCamera(Camera c)       { camera = c;                }
+
+   // returns the index objects refer to the material by
+   int addMaterial(const Material &m)              { return materials.add(m);     }
+   void setMaterials(const Material *m, int count) { materials.assign(m, count); }
+
+   RenderSettings &getSettings()  { return settings;           }
+   BVH &getBVH()                  { return bvh;                }
+   MappedFile &getStorage()       { return storage;            }
+
+   // call once after every object has been added
+   void build() { bvh.build(objects); }
+
+   // render base's objects and lights through its BVH, starting from its
+   // camera and settings. base must outlive this scene
+   void share(const Scene &base)
+   {
+      clear();
+      objects = base.objects;
+      lights = base.lights;
+      materials = base.materials;
+      camera = base.camera;
+      settings = base.settings;
+      bvh.borrow(base.bvh);
+      shared = true;
+   }
+
+   const std::vector<Object*> &getObjects() const { return objects;   }
+   const std::vector<Source*> &getLights()  const { return lights;    }
+   const MaterialTable &getMaterials()      const { return materials; }
+   const RenderSettings &getSettings()      const { return settings;  }
+   const Camera &getCamera()                const { return camera;    }
+   const BVH &getBVH()                      const { return bvh;       }
+};
+
+#endif
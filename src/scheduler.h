@@ -0,0 +1,254 @@
+/******************************************************************************
+* Header:
+*   Scheduler
+* Desc:
+*   Contains the TileScheduler class. The image is split into tiles which are
+*   handed to a pool of worker threads. Every worker owns a queue of tiles and
+*   steals from the back of the other queues once its own runs dry, so slow
+*   tiles never leave a core idle.
+******************************************************************************/
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+/******************************************************************************
+ * TILE STRUCT - a rectangle of pixels [x0,x1) x [y0,y1)
+ *****************************************************************************/
+struct Tile
+{
+   int x0, y0; // top left corner (inclusive)
+   int x1, y1; // bottom right corner (exclusive)
+};
+
+/******************************************************************************
+ * WORKER STATS STRUCT - how much work one thread did during a run
+ *****************************************************************************/
+struct WorkerStats
+{
+   double busySeconds; // time spent inside the tile function
+   int tilesRendered;  // tiles this thread rendered
+   int tilesStolen;    // tiles it took from another thread's queue
+
+   WorkerStats() : busySeconds(0), tilesRendered(0), tilesStolen(0) {}
+};
+
+/******************************************************************************
+ * MAKE TILES - splits the rectangle [x0, x1) x [y0, y1) of an image into
+ *    tiles in scanline order
+ *****************************************************************************/
+inline std::vector<Tile> makeTiles(int x0, int y0, int x1, int y1, int tileSize)
+{
+   std::vector<Tile> tiles;
+
+   for (int y = y0; y < y1; y += tileSize)
+      for (int x = x0; x < x1; x += tileSize)
+      {
+         Tile tile;
+         tile.x0 = x;
+         tile.y0 = y;
+         tile.x1 = std::min(x + tileSize, x1);
+         tile.y1 = std::min(y + tileSize, y1);
+         tiles.push_back(tile);
+      }
+
+   return tiles;
+}
+
+// the tiles of the rows [y0, y1) of a width wide image
+inline std::vector<Tile> makeTiles(int width, int y0, int y1, int tileSize)
+{
+   return makeTiles(0, y0, width, y1, tileSize);
+}
+
+// the tiles of a whole width x height image
+inline std::vector<Tile> makeTiles(int width, int height, int tileSize)
+{
+   return makeTiles(width, 0, height, tileSize);
+}
+
+/******************************************************************************
+ * TILE SCHEDULER CLASS - a persistent pool of work stealing render threads
+ *****************************************************************************/
+class TileScheduler
+{
+public:
+   typedef std::function<void (const Tile &tile, int thread)> TileFunc;
+
+private:
+   // one run() call
+   struct Job
+   {
+      const std::vector<Tile> *tiles;
+      TileFunc *func;
+      std::vector<WorkerStats> *stats;
+      int remaining; // tiles not yet finished, guarded by doneMutex
+      std::mutex doneMutex;
+      std::condition_variable done;
+   };
+
+   // one tile waiting in a queue
+   struct Task
+   {
+      Job *job;
+      int tile;
+   };
+
+   // a worker's queue. owner pops the front, thieves take the back
+   struct Queue
+   {
+      std::mutex mutex;
+      std::deque<Task> tasks;
+   };
+
+   std::vector<std::thread> threads;
+   std::vector<Queue*> queues;
+
+   std::mutex wakeMutex;
+   std::condition_variable wake;
+   int queued; // tasks sitting in any queue, guarded by wakeMutex
+   bool stop;
+
+   // pop from our own queue first, then try to steal from the others
+   bool takeTask(int self, Task &task, bool &stolen)
+   {
+      int nQueues = queues.size();
+
+      for (int i = 0; i < nQueues; i++)
+      {
+         Queue *queue = queues[(self + i) % nQueues];
+         std::lock_guard<std::mutex> lock(queue->mutex);
+
+         if (!queue->tasks.empty())
+         {
+            if (i == 0)
+            {
+               task = queue->tasks.front();
+               queue->tasks.pop_front();
+            }
+            else
+            {
+               task = queue->tasks.back();
+               queue->tasks.pop_back();
+            }
+            stolen = (i != 0);
+            return true;
+         }
+      }
+
+      return false;
+   }
+
+   void workerLoop(int self)
+   {
+      while (true)
+      {
+         {
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wake.wait(lock, [this] { return stop || queued > 0; });
+            if (stop && queued == 0)
+               return;
+         }
+
+         Task task;
+         bool stolen = false;
+         if (!takeTask(self, task, stolen))
+            continue; // somebody else got there first
+
+         {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            queued--;
+         }
+
+         Job *job = task.job;
+         std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+         (*job->func)((*job->tiles)[task.tile], self);
+
+         std::chrono::duration<double> busy = std::chrono::steady_clock::now() - start;
+
+         // every worker only touches its own stats slot
+         WorkerStats &stats = (*job->stats)[self];
+         stats.busySeconds += busy.count();
+         stats.tilesRendered++;
+         if (stolen)
+            stats.tilesStolen++;
+
+         std::lock_guard<std::mutex> lock(job->doneMutex);
+         if (--job->remaining == 0)
+            job->done.notify_all();
+      }
+   }
+
+public:
+   TileScheduler(int nThreads) : queued(0), stop(false)
+   {
+      if (nThreads < 1)
+         nThreads = 1;
+
+      for (int i = 0; i < nThreads; i++)
+         queues.push_back(new Queue);
+      for (int i = 0; i < nThreads; i++)
+         threads.push_back(std::thread(&TileScheduler::workerLoop, this, i));
+   }
+
+   ~TileScheduler()
+   {
+      {
+         std::lock_guard<std::mutex> lock(wakeMutex);
+         stop = true;
+      }
+      wake.notify_all();
+
+      for (int i = 0; i < (int)threads.size(); i++)
+         threads[i].join();
+      for (int i = 0; i < (int)queues.size(); i++)
+         delete queues[i];
+   }
+
+   int getThreadCount() { return threads.size(); }
+
+   // renders every tile and blocks until they are all done. stats receives
+   // one entry per worker thread. safe to call from several threads at once
+   void run(const std::vector<Tile> &tiles, TileFunc func,
+            std::vector<WorkerStats> &stats)
+   {
+      int nTiles = tiles.size();
+      int nQueues = queues.size();
+
+      stats.assign(nQueues, WorkerStats());
+      if (nTiles == 0)
+         return;
+
+      Job job;
+      job.tiles = &tiles;
+      job.func = &func;
+      job.stats = &stats;
+      job.remaining = nTiles;
+
+      // deal out contiguous runs of tiles so neighbours stay on one thread
+      for (int q = 0; q < nQueues; q++)
+      {
+         int first = (int)((long long)nTiles * q / nQueues);
+         int last  = (int)((long long)nTiles * (q + 1) / nQueues);
+
+         std::lock_guard<std::mutex> lock(queues[q]->mutex);
+         for (int i = first; i < last; i++)
+         {
+            Task task;
+            task.job = &job;
+            task.tile = i;
+            queues[q]->tasks.push_back(task);
+         }
+      }
+
+      {
+         std::lock_guard<std::mutex> lock(wakeMutex);
+         queued += nTiles;
+      }
+      wake.notify_all();
+
+      std::unique_lock<std::mutex> lock(job.doneMutex);
+      job.done.wait(lock, [&job] { return job.remaining == 0; });
+   }
+};
+
+#endif
@@ -0,0 +1,740 @@
+/******************************************************************************
+* Header:
+*   Server
+* Desc:
+*   The render server. runServer takes jobs from clients, and submitJob is
+*   the client that sends one. Between jobs the server keeps the SceneStore,
+*   which holds loaded scenes and their BVHs warm. The RenderSlots bound how
+*   many jobs render at once, and the LatencyLog is where the server's
+*   metrics come from.
+******************************************************************************/
+#ifndef SERVER_H
+#define SERVER_H
+
+// jobs the latency percentiles are taken over
+const int latencyLogSize = 1024;
+
+// clients connected at once, each has a thread. more are closed at once
+const int maxClients = 64;
+
+// the most anti-aliasing a job may ask for, and the most camera samples:
+// its pixels times aadepth squared, what a pixel takes at worst. that is
+// about a 3840x2160 frame at 128 samples a pixel
+const int maxJobAadepth = 32;
+const double maxJobSamples = 1 << 30;
+
+/******************************************************************************
+ * SCENE BYTES - roughly the memory a loaded scene holds: the arrays of its
+ *    BVH and meshes, which are most of it, plus its objects
+ *****************************************************************************/
+inline size_t sceneBytes(Scene &scene)
+{
+   size_t bytes = 0;
+   auto add = [&bytes](auto &column) { bytes += sizeof(*column.data()) * (size_t)column.size(); };
+
+   scene.getBVH().forEachColumn(add);
+   const std::vector<Object*> &objects = scene.getObjects();
+   for (int i = 0; i < (int)objects.size(); i++)
+   {
+      bytes += sizeof(Triangle); // the largest of the simple objects
+      if (TriangleMesh *mesh = dynamic_cast<TriangleMesh*>(objects[i]))
+         mesh->forEachColumn(add);
+   }
+   return bytes;
+}
+
+/******************************************************************************
+ * SCENE STORE CLASS - loaded scenes, BVH included, kept by the hash of
+ *    their text so a job on a scene already seen skips loading it. The
+ *    least recently used scenes are dropped to stay under the memory cap;
+ *    a job still rendering a dropped scene keeps it until it finishes
+ *****************************************************************************/
+class SceneStore
+{
+private:
+   struct Entry
+   {
+      unsigned long long hash;
+      std::shared_ptr<Scene> scene;
+      size_t bytes;
+   };
+
+   std::mutex mutex;
+   std::list<Entry> entries; // the most recently used first
+   size_t capacity;
+   size_t used;
+   long long hits, misses, evictions;
+
+public:
+   SceneStore(size_t bytes) : capacity(bytes), used(0), hits(0), misses(0), evictions(0) {}
+
+   // the scene made from the text with hash, or NULL if none is kept
+   std::shared_ptr<Scene> find(unsigned long long hash)
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (std::list<Entry>::iterator e = entries.begin(); e != entries.end(); ++e)
+         if (e->hash == hash)
+         {
+            entries.splice(entries.begin(), entries, e);
+            hits++;
+            return e->scene;
+         }
+      misses++;
+      return std::shared_ptr<Scene>();
+   }
+
+   // keeps a scene that was just loaded and returns the one kept for hash,
+   // an earlier one if another job loaded the same scene meanwhile. a
+   // scene larger than the whole cap is not kept
+   std::shared_ptr<Scene> add(unsigned long long hash, std::shared_ptr<Scene> scene, size_t bytes)
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (std::list<Entry>::iterator e = entries.begin(); e != entries.end(); ++e)
+         if (e->hash == hash)
+            return e->scene;
+
+      Entry entry;
+      entry.hash = hash;
+      entry.scene = scene;
+      entry.bytes = bytes;
+      entries.push_front(entry);
+      used += bytes;
+
+      while (used > capacity && !entries.empty())
+      {
+         used -= entries.back().bytes;
+         entries.pop_back();
+         evictions++;
+      }
+      return scene;
+   }
+
+   void report(std::ostream &out)
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      out << "scenes: " << entries.size() << " kept, " << used / 1048576.0 << " of "
+          << capacity / 1048576.0 << " MB, " << hits << " hits, " << misses << " misses, "
+          << evictions << " dropped" << std::endl;
+   }
+};
+
+/******************************************************************************
+ * RENDER SLOTS CLASS - lets at most a fixed number of jobs render at once.
+ *    the rest wait their turn, while all of them share one thread pool
+ *****************************************************************************/
+class RenderSlots
+{
+private:
+   std::mutex mutex;
+   std::condition_variable freed;
+   int free;
+   int waiting;
+
+public:
+   RenderSlots(int slots) : free(slots), waiting(0) {}
+
+   void acquire()
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+      waiting++;
+      freed.wait(lock, [this] { return free > 0; });
+      waiting--;
+      free--;
+   }
+
+   void release()
+   {
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         free++;
+      }
+      freed.notify_one();
+   }
+
+   // jobs waiting for a slot
+   int getWaiting()
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      return waiting;
+   }
+};
+
+/******************************************************************************
+ * LATENCY LOG CLASS - counts the jobs and keeps the times of the last
+ *    latencyLogSize of them for percentiles
+ *****************************************************************************/
+class LatencyLog
+{
+private:
+   std::mutex mutex;
+   std::vector<JobTimes> recent; // a ring, next is the oldest once full
+   int next;
+   long long done, failed, warm;
+
+   // the p-th percentile of one field of the recent jobs
+   double percentile(double JobTimes::*field, double p) const
+   {
+      std::vector<double> values;
+      for (int i = 0; i < (int)recent.size(); i++)
+         values.push_back(recent[i].*field);
+      std::sort(values.begin(), values.end());
+      // the nearest rank: the smallest value with p percent at or below it
+      int at = (int)std::ceil(p / 100 * values.size()) - 1;
+      return values[std::max(at, 0)];
+   }
+
+public:
+   LatencyLog() : next(0), done(0), failed(0), warm(0) {}
+
+   void add(const ResultBody &result)
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!result.ok)
+      {
+         failed++;
+         return;
+      }
+      done++;
+      warm += result.warm;
+      if (recent.size() < latencyLogSize)
+         recent.push_back(result.times);
+      else
+         recent[next] = result.times;
+      next = (next + 1) % latencyLogSize;
+   }
+
+   // the job counts and, in milliseconds, the 50th, 95th and 99th
+   // percentile and the worst of each part of a job's time
+   void report(std::ostream &out)
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      out << "jobs: " << done << " rendered (" << warm << " on a kept scene), "
+          << failed << " failed" << std::endl;
+      if (recent.empty())
+         return;
+
+      const char *names[5] = { "queue", "load", "render", "write", "total" };
+      double JobTimes::*fields[5] = { &JobTimes::queue, &JobTimes::load, &JobTimes::render,
+                                      &JobTimes::write, &JobTimes::total };
+      out << "latency of the last " << recent.size() << " jobs in ms (p50 p95 p99 max):"
+          << std::endl;
+      for (int f = 0; f < 5; f++)
+         out << "   " << names[f] << ": " << percentile(fields[f], 50) * 1000 << " "
+             << percentile(fields[f], 95) * 1000 << " " << percentile(fields[f], 99) * 1000
+             << " " << percentile(fields[f], 100) * 1000 << std::endl;
+   }
+};
+
+/******************************************************************************
+ * RENDER SERVER STRUCT - what the jobs of a render server share
+ *****************************************************************************/
+struct RenderServer
+{
+   const Options &options; // the server's own, the defaults of every job
+   const IntersectKernels *kernels;
+   std::string root;       // the real path of the directory jobs may use
+   int rootDirectory;      // the same directory, opened
+   TileScheduler scheduler;
+   SceneStore scenes;
+   RenderSlots slots;
+   LatencyLog latency;
+   std::mutex outputMutex; // one job's log line at a time
+   int jobCount;           // jobs answered, guarded by outputMutex
+
+   RenderServer(const Options &o, const IntersectKernels *k, const std::string &r, int d)
+      : options(o), kernels(k), root(r), rootDirectory(d), scheduler(o.threads)
+      , scenes((size_t)o.cacheMegabytes << 20)
+      , slots(profiling ? 1 : o.jobs), jobCount(0) {}
+   ~RenderServer() { close(rootDirectory); }
+
+   RenderServer(const RenderServer &) = delete;
+   RenderServer &operator = (const RenderServer &) = delete;
+};
+
+/******************************************************************************
+ * SERVED PATH - the real path of a file a job names, or empty unless it is
+ *    inside the directory root. An output need not exist yet but its
+ *    directory must, and if it exists it must be a plain file and not a
+ *    link. The path is only checked here, the files are opened in a
+ *    ServedDirectory so a link swapped in after can not be followed
+ *****************************************************************************/
+inline std::string servedPath(const std::string &root, const std::string &path, bool output)
+{
+   std::string resolved;
+   char real[PATH_MAX];
+   if (!output)
+   {
+      if (realpath(path.c_str(), real) != NULL)
+         resolved = real;
+   }
+   else
+   {
+      size_t slash = path.rfind('/');
+      std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+      std::string directory = slash == std::string::npos ? "." : path.substr(0, slash + 1);
+      struct stat info;
+      if (name != "" && name != "." && name != ".." &&
+          realpath(directory.c_str(), real) != NULL)
+         resolved = std::string(real) + (real[1] != '\0' ? "/" : "") + name;
+      if (lstat(resolved.c_str(), &info) == 0 && !S_ISREG(info.st_mode))
+         resolved.clear();
+   }
+
+   bool inside = root == "/" || (resolved.compare(0, root.size(), root) == 0 &&
+                                 resolved.size() > root.size() && resolved[root.size()] == '/');
+   return inside ? resolved : std::string();
+}
+
+/******************************************************************************
+ * SERVED DIRECTORY CLASS - the directory of a path servedPath gave, opened
+ *    by walking down from the served root a name at a time without
+ *    following links. Opening a file in it with openIn then can not leave
+ *    root, whatever is renamed or linked after servedPath looked
+ *****************************************************************************/
+class ServedDirectory
+{
+private:
+   int fd;
+   std::string name; // the file's own name, the last part of the path
+
+public:
+   ServedDirectory(const RenderServer &server, const std::string &path) : fd(-1)
+   {
+      if (path.empty())
+         return;
+      size_t from = server.root == "/" ? 1 : server.root.size() + 1;
+      size_t slash = path.rfind('/');
+      name = path.substr(slash + 1);
+
+      fd = openat(server.rootDirectory, ".", O_RDONLY | O_DIRECTORY);
+      while (fd >= 0 && from <= slash)
+      {
+         size_t end = path.find('/', from);
+         int next = openat(fd, path.substr(from, end - from).c_str(),
+                           O_RDONLY | O_DIRECTORY | O_NOFOLLOW);
+         ::close(fd);
+         fd = next;
+         from = end + 1;
+      }
+   }
+   ~ServedDirectory()
+   {
+      if (fd >= 0)
+         ::close(fd);
+   }
+
+   ServedDirectory(const ServedDirectory &) = delete;
+   ServedDirectory &operator = (const ServedDirectory &) = delete;
+
+   bool isOpen() const                { return fd >= 0; }
+   int getDirectory() const           { return fd;      }
+   const std::string &getName() const { return name;    }
+};
+
+/******************************************************************************
+ * VALID JOB - whether the overrides of a job are ones the command line
+ *    takes, within the server's caps. submitJob only sends those, but the
+ *    server can not count on every client being submitJob
+ *****************************************************************************/
+inline bool validJob(const JobBody &job)
+{
+   bool sized = (job.width == 0 && job.height == 0) ||
+                (job.width >= 1 && job.width <= maxImageSize &&
+                 job.height >= 1 && job.height <= maxImageSize);
+   bool sampled = job.aadepth >= 0 && job.aadepth <= maxJobAadepth;
+
+   bool viewed = job.camera == 0 ||
+                 (job.camera == 1 &&
+                  Camera::canLookAt(Vect(job.position[0], job.position[1], job.position[2]),
+                                    Vect(job.focus[0], job.focus[1], job.focus[2])));
+   return sized && sampled && viewed;
+}
+
+/******************************************************************************
+ * RENDER JOB - renders one job on a slot of the server, with the scene
+ *    from the server's store when it is kept there. The scene is known by
+ *    the hash of its text, so the same file edited is a new scene while
+ *    two copies of one file share it. Fills result, or error when it
+ *    fails
+ *****************************************************************************/
+inline bool renderJob(RenderServer &server, const JobBody &job, const std::string &sceneName,
+                      const std::string &outputName, ResultBody &result, std::string &error)
+{
+   // a job only reads and writes files inside the served directory
+   std::string sceneFile = sceneName.empty() ? sceneName
+                                             : servedPath(server.root, sceneName, false);
+   std::string output = servedPath(server.root, outputName, true);
+   std::string refused = sceneFile.empty() != sceneName.empty() ? sceneName
+                       : output.empty()                         ? outputName : "";
+   int aovs = job.aovs & (FrameBuffer::depthChannel | FrameBuffer::normalChannel |
+                          FrameBuffer::idChannel);
+   for (int k = 0; k < 3 && refused.empty(); k++)
+      if ((aovs & aovChannels[k]) &&
+          servedPath(server.root, aovFilename(output, aovNames[k]), true).empty())
+         refused = aovFilename(outputName, aovNames[k]);
+   if (!refused.empty())
+   {
+      error = refused + " is not a file in " + server.root;
+      return false;
+   }
+   ServedDirectory sceneDirectory (server, sceneFile);
+   ServedDirectory outputDirectory (server, output);
+   if ((!sceneFile.empty() && !sceneDirectory.isOpen()) || !outputDirectory.isOpen())
+   {
+      error = "could not open the directory of " + (outputDirectory.isOpen() ? sceneFile : output);
+      return false;
+   }
+
+   std::chrono::steady_clock::time_point loadStart = std::chrono::steady_clock::now();
+   SceneLoader loader;
+   unsigned long long hash = sceneHash(NULL, 0);
+   if (!sceneFile.empty())
+   {
+      if (!loader.read(sceneDirectory.getName().c_str(), sceneDirectory.getDirectory()))
+      {
+         error = "could not read " + sceneFile;
+         return false;
+      }
+      hash = sceneHash(loader.getText(), loader.getTextSize());
+   }
+
+   // a scene not kept is loaded like a plain render would: from its cache
+   // if that matches, otherwise parsed and built. the server leaves
+   // writing caches to plain renders, two jobs could write one at once
+   std::shared_ptr<Scene> base = server.scenes.find(hash);
+   result.warm = base != NULL;
+   if (base == NULL)
+   {
+      base = std::make_shared<Scene>();
+      bool fromCache = false;
+      if (sceneFile.empty())
+         buildDefaultScene(*base);
+      else
+      {
+         fromCache = server.options.cache &&
+                     loadSceneCache(sceneDirectory.getName() + ".cache", hash, *base,
+                                    sceneDirectory.getDirectory());
+         if (!fromCache && !loader.parse(*base))
+         {
+            error = "could not load " + sceneFile;
+            return false;
+         }
+      }
+      if (server.kernels != NULL)
+         base->getBVH().setKernels(server.kernels);
+      if (!fromCache)
+         base->build();
+      base = server.scenes.add(hash, base, sceneBytes(*base));
+   }
+   result.times.load = secondsSince(loadStart);
+
+   // the job's view of the kept scene, with the server's options and the
+   // job's overrides on top
+   Scene scene;
+   scene.share(*base);
+   Options options = server.options;
+   options.width = job.width;
+   options.height = job.height;
+   options.aadepth = job.aadepth;
+   options.camera = job.camera;
+   options.cameraPosition = Vect(job.position[0], job.position[1], job.position[2]);
+   options.cameraFocus = Vect(job.focus[0], job.focus[1], job.focus[2]);
+   options.aovs = aovs;
+   if (!applyOptions(options, scene))
+   {
+      error = "the job's settings do not fit the scene";
+      return false;
+   }
+
+   // the scene may give the size and aadepth too, so the budget is checked
+   // on what is about to render
+   const RenderSettings &settings = scene.getSettings();
+   double pixels = settings.cropped() ? (double)settings.cropWidth * settings.cropHeight
+                                      : (double)settings.width * settings.height;
+   if (pixels * settings.aadepth * settings.aadepth > maxJobSamples)
+   {
+      error = "the job takes more than the server's " + std::to_string((long long)maxJobSamples) +
+              " samples";
+      return false;
+   }
+
+   FrameStats frame;
+   if (!renderFrame(scene, server.scheduler, options, outputDirectory.getName().c_str(),
+                    job.format == ppmFormat ? ppmFormat : bmpFormat, frame,
+                    outputDirectory.getDirectory()))
+   {
+      error = "could not write " + output;
+      return false;
+   }
+   result.samples = frame.samples;
+   result.times.render = frame.renderSeconds - frame.writeSeconds;
+   result.times.write = frame.writeSeconds;
+   return true;
+}
+
+/******************************************************************************
+ * SERVE CLIENT - answers the jobs and metrics requests of one client
+ *    connection until the client closes it
+ *****************************************************************************/
+inline void serveClient(RenderServer &server, int socket)
+{
+   Connection client (socket);
+   Message message;
+   while (client.wait(message))
+   {
+      if (message.type == statsMessage)
+      {
+         std::ostringstream text;
+         text << "jobs waiting for a slot: " << server.slots.getWaiting() << std::endl;
+         server.latency.report(text);
+         server.scenes.report(text);
+         std::string reply = text.str();
+         if (!client.send(statsMessage, reply.data(), reply.size()))
+            return;
+         continue;
+      }
+
+      std::chrono::steady_clock::time_point arrived = std::chrono::steady_clock::now();
+      ResultBody result;
+      memset(&result, 0, sizeof(result));
+      std::string error;
+
+      JobBody job;
+      size_t tailBytes = 0;
+      const char *tail = NULL;
+      if (message.type == jobMessage)
+         tail = message.split(job, tailBytes);
+      std::string files = tail != NULL ? std::string(tail, tailBytes) : std::string();
+      size_t split = files.find('\0');
+
+      if (tail == NULL || split == std::string::npos)
+         error = "not a job";
+      else if (job.version != clusterProtocolVersion || job.build != sceneHash(NULL, 0))
+         error = "the client is another build";
+      else if (!validJob(job))
+         error = "not a job";
+      else
+      {
+         server.slots.acquire();
+         result.times.queue = secondsSince(arrived);
+         result.ok = renderJob(server, job, files.substr(0, split), files.substr(split + 1),
+                               result, error);
+         server.slots.release();
+      }
+      result.times.total = secondsSince(arrived);
+      server.latency.add(result);
+
+      {
+         std::lock_guard<std::mutex> lock(server.outputMutex);
+         std::cout << "job " << ++server.jobCount << ": ";
+         if (result.ok)
+            std::cout << files.substr(split + 1) << " in " << result.times.total * 1000
+                      << " ms (queue " << result.times.queue * 1000 << ", load "
+                      << result.times.load * 1000 << (result.warm ? " kept" : "") << ", render "
+                      << result.times.render * 1000 << ", write " << result.times.write * 1000
+                      << ")" << std::endl;
+         else
+            std::cout << "failed, " << error << std::endl;
+      }
+
+      if (!client.send(resultMessage, &result, sizeof(result), error.data(), error.size()))
+         return;
+   }
+}
+
+/******************************************************************************
+ * RUN SERVER - takes render jobs on options.serve until SIGINT or SIGTERM.
+ *    Every client connection gets a thread of its own and may send any
+ *    number of jobs, and past maxClients connections more are closed. Up
+ *    to options.jobs jobs render at once, all on one pool of render
+ *    threads, and the loaded scenes are kept in a SceneStore of
+ *    options.cacheMegabytes. In a profiling build jobs render one at a
+ *    time, as they share the profile counters
+ *****************************************************************************/
+inline bool runServer(const Options &options, const IntersectKernels *kernels)
+{
+   // jobs only read and write files inside the served directory
+   std::string served = options.serveDir.empty() ? "." : options.serveDir;
+   char root[PATH_MAX];
+   if (realpath(served.c_str(), root) == NULL)
+   {
+      std::cerr << "could not serve " << served << ": " << strerror(errno) << std::endl;
+      return false;
+   }
+
+   // the socket is made for this user alone, no other may send jobs. the
+   // server has no threads yet, so the umask changes nothing else
+   mode_t mask = umask(S_IRWXG | S_IRWXO);
+   int socket = openSocket(options.serve, true);
+   umask(mask);
+   if (socket < 0)
+   {
+      std::cerr << "could not listen on " << options.serve << ": " << strerror(errno) << std::endl;
+      return false;
+   }
+   Connection listener (socket);
+   int rootDirectory = open(root, O_RDONLY | O_DIRECTORY);
+   if (rootDirectory < 0)
+   {
+      std::cerr << "could not serve " << root << ": " << strerror(errno) << std::endl;
+      return false;
+   }
+   RenderServer server (options, kernels, root, rootDirectory);
+
+   signal(SIGINT, requestStop);
+   signal(SIGTERM, requestStop);
+   std::cout << "serving " << root << " on " << options.serve << " with "
+             << server.scheduler.getThreadCount() << " render threads, "
+             << (profiling ? 1 : options.jobs) << " jobs at once and " << options.cacheMegabytes
+             << " MB for scenes" << std::endl;
+
+   // a client's thread, its socket and whether it has finished
+   struct Session
+   {
+      std::thread worker;
+      int socket;
+      std::atomic<bool> finished;
+   };
+   std::list<Session> sessions;
+
+   while (!stopRequested)
+   {
+      for (std::list<Session>::iterator s = sessions.begin(); s != sessions.end(); )
+         if (s->finished)
+         {
+            s->worker.join();
+            s = sessions.erase(s);
+         }
+         else
+            ++s;
+
+      pollfd polled;
+      polled.fd = listener.getSocket();
+      polled.events = POLLIN;
+      if (poll(&polled, 1, 200) > 0 && (polled.revents & POLLIN))
+      {
+         int fd = accept(listener.getSocket(), NULL, NULL);
+         if (fd >= 0 && (int)sessions.size() >= maxClients)
+         {
+            // the client sees the connection closed, as if the server had gone
+            close(fd);
+            std::lock_guard<std::mutex> lock(server.outputMutex);
+            std::cout << "refused a client, " << maxClients << " are connected" << std::endl;
+         }
+         else if (fd >= 0)
+         {
+            sessions.emplace_back();
+            Session &session = sessions.back();
+            session.socket = fd;
+            session.finished = false;
+            session.worker = std::thread([&server, &session, fd]
+            {
+               serveClient(server, fd);
+               session.finished = true;
+            });
+         }
+      }
+   }
+
+   // stop reading from the clients, a job being rendered still gets its
+   // reply
+   std::cout << "stopping, " << sessions.size() << " clients connected" << std::endl;
+   for (Session &session : sessions)
+      shutdown(session.socket, SHUT_RD);
+   for (Session &session : sessions)
+      session.worker.join();
+   listener.close();
+   unlink(options.serve.c_str() + 5);
+
+   server.latency.report(std::cout);
+   server.scenes.report(std::cout);
+   return true;
+}
+
+/******************************************************************************
+ * ABSOLUTE PATH - path as seen from anywhere, for sending to a server
+ *    running in another directory
+ *****************************************************************************/
+inline std::string absolutePath(const std::string &path)
+{
+   char here[4096];
+   if (path.empty() || path[0] == '/' || getcwd(here, sizeof(here)) == NULL)
+      return path;
+   return std::string(here) + "/" + path;
+}
+
+/******************************************************************************
+ * SUBMIT JOB - sends the render the options describe to the server at
+ *    options.submit and prints how long each part took, or prints the
+ *    metrics of the server at options.serverStats
+ *****************************************************************************/
+inline bool submitJob(const Options &options)
+{
+   std::string address = options.submit.empty() ? options.serverStats : options.submit;
+   int socket = connectSocket(address, 2);
+   if (socket < 0)
+   {
+      std::cerr << "could not connect to " << address << ": " << strerror(errno) << std::endl;
+      return false;
+   }
+   Connection server (socket);
+   Message message;
+
+   if (options.submit.empty())
+   {
+      if (!server.send(statsMessage, NULL, 0) || !server.wait(message) ||
+          message.type != statsMessage)
+      {
+         std::cerr << "the server at " << address << " did not answer" << std::endl;
+         return false;
+      }
+      std::cout << std::string(message.body.begin(), message.body.end());
+      return true;
+   }
+
+   JobBody job;
+   memset(&job, 0, sizeof(job));
+   job.version = clusterProtocolVersion;
+   job.build = sceneHash(NULL, 0);
+   job.width = options.width;
+   job.height = options.height;
+   job.aadepth = options.aadepth;
+   job.camera = options.camera;
+   job.position[0] = options.cameraPosition.getVectX();
+   job.position[1] = options.cameraPosition.getVectY();
+   job.position[2] = options.cameraPosition.getVectZ();
+   job.focus[0] = options.cameraFocus.getVectX();
+   job.focus[1] = options.cameraFocus.getVectY();
+   job.focus[2] = options.cameraFocus.getVectZ();
+   job.format = options.format;
+   job.aovs = options.aovs;
+   std::string output = absolutePath(options.output);
+   std::string files = absolutePath(options.scene) + '\0' + output;
+
+   ResultBody result;
+   size_t tailBytes = 0;
+   const char *tail = NULL;
+   if (server.send(jobMessage, &job, sizeof(job), files.data(), files.size()) &&
+       server.wait(message) && message.type == resultMessage)
+      tail = message.split(result, tailBytes);
+   if (tail == NULL)
+   {
+      std::cerr << "the server at " << address << " did not answer" << std::endl;
+      return false;
+   }
+   if (!result.ok)
+   {
+      std::cerr << "the server could not render the job: " << std::string(tail, tailBytes)
+                << std::endl;
+      return false;
+   }
+
+   std::cout << "image written to " << output << " in " << result.times.total * 1000
+             << " ms: queued " << result.times.queue * 1000 << ", scene "
+             << (result.warm ? "kept, " : "loaded in ") << result.times.load * 1000
+             << ", render " << result.times.render * 1000 << ", write "
+             << result.times.write * 1000 << std::endl;
+   return true;
+}
+
+#endif
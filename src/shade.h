@@ -0,0 +1,410 @@
+/******************************************************************************
+* Header:
+*   Shade
+* Desc:
+*   The integrators, which work out the color a camera ray sees. getColorAt
+*   follows a chain of reflections on a fixed stack and lights it from the
+*   last surface back. shadeWavefront does the same for every camera hit of
+*   a tile at once, tracing each wave of reflection and shadow rays as one
+*   queue.
+******************************************************************************/
+#ifndef SHADE_H
+#define SHADE_H
+
+/******************************************************************************
+ * SHADE FRAME STRUCT - one surface on a chain of reflections
+ *****************************************************************************/
+struct ShadeFrame
+{
+   Hit hit;
+   Vect dir;                 // direction of the ray that hit it
+   const Material *material; // the hit object's material
+   Color color;              // the surface color at the hit, patterns resolved
+};
+
+/******************************************************************************
+ * REFLECT DIRECTION - a ray travelling along intDir mirrored about a
+ *    surface with normal iWinNorm
+ *****************************************************************************/
+inline Vect reflectDirection(const Vect &iWinNorm, const Vect &intDir)
+{
+   Real dot1 = iWinNorm.dotProduct(-intDir);
+   Vect add1 = intDir.addScaled(iWinNorm, dot1);
+   return (-intDir).addScaled(add1, 2).normalize();
+}
+
+/******************************************************************************
+ * TOWARDS LIGHT - the direction and distance from a surface to a light.
+ *    returns the cosine of the angle the light falls in at, the light only
+ *    reaches the surface when it is above 0
+ *****************************************************************************/
+inline float towardsLight(Source *light, const Hit &hit, Vect &lightDir, Real &lightDistance)
+{
+   Vect lightOffset = light->getLightPosition() - hit.position;
+   lightDistance = lightOffset.magnitude();
+   lightDir = lightOffset.normalize();
+   return hit.normal.dotProduct(lightDir);
+}
+
+/******************************************************************************
+ * ADD LIGHT - adds the light of one source that reaches a surface, from
+ *    lightDir at cosAngle, to finalColor, with the material's highlight
+ *****************************************************************************/
+inline Color addLight(const ShadeFrame &frame, Source *light, const Vect &lightDir, float cosAngle,
+                      Color finalColor)
+{
+   Color iWinColor = frame.color;
+   const Material &material = *frame.material;
+
+   finalColor = finalColor.colorAdd(iWinColor.colorMultiply(light->getLightColor()).colorScalar(cosAngle));
+
+   // shinines, a Phong highlight
+   if (material.specular > 0)
+   {
+      Vect refDir = reflectDirection(frame.hit.normal, frame.dir);
+
+      Real specular = refDir.dotProduct(lightDir);
+      if (specular > 0)
+      {
+         specular = pow(specular, material.shininess);
+         finalColor = finalColor.colorAdd(light->getLightColor().colorScalar(specular*material.specular));
+      }
+   }
+
+   return finalColor;
+}
+
+/******************************************************************************
+ * ADD DIRECT LIGHT - adds the light every source casts on a surface, with
+ *    shadows and highlights, to finalColor
+ *****************************************************************************/
+inline Color addDirectLight(const Scene &scene, const ShadeFrame &frame, Color finalColor)
+{
+   const BVH &bvh = scene.getBVH();
+   const std::vector<Source*> &lSources = scene.getLights();
+   double accuracy = scene.getSettings().accuracy;
+
+   const Vect &intPos = frame.hit.position;
+
+   for (int iLight = 0; iLight < (int)lSources.size(); iLight++)
+   {
+      Vect lightDir;
+      Real lightDistance;
+      float cosAngle = towardsLight(lSources[iLight], frame.hit, lightDir, lightDistance);
+
+      if (cosAngle > 0)
+      {
+         // test for shadows
+         bool shadowed = false;
+
+         Ray shadowRay (intPos, lightDir);
+
+         // anything between the point and the light blocks it, the search
+         // stops at the first blocker found
+         PROFILE(double shadowStart = profileClock());
+         shadowed = bvh.anyHit(shadowRay, accuracy, lightDistance);
+         PROFILE(profileRays(shadowRays, 1, shadowStart));
+
+         if (shadowed == false)
+            finalColor = addLight(frame, lSources[iLight], lightDir, cosAngle, finalColor);
+      }
+   }
+
+   return finalColor;
+}
+
+/******************************************************************************
+ * GET COLOR AT - returns the color determained by ray intersections. the
+ *    chain of reflections from the hit is followed first, recording every
+ *    surface on a fixed stack, until a surface does not reflect, the ray
+ *    escapes, maxBounces is reached or the share of light still carried
+ *    back to the camera falls below minThroughput. the surfaces are then
+ *    lit from the last one back to the first, each taking in the color
+ *    reflected into it, so the work per sample has a fixed bound
+ *****************************************************************************/
+inline Color getColorAt(const Hit &hit, Vect intDir, const Scene &scene)
+{
+   const BVH &bvh = scene.getBVH();
+   const RenderSettings &settings = scene.getSettings();
+   const MaterialTable &materials = scene.getMaterials();
+
+   ShadeFrame stack[maxBounceLimit + 1];
+   int top = 0;
+   stack[0].hit = hit;
+   stack[0].dir = intDir;
+   double throughput = 1;
+
+   // follow the reflections down
+   while (true)
+   {
+      ShadeFrame &frame = stack[top];
+      frame.material = &materials[frame.hit.material];
+      frame.color = frame.material->colorAt(frame.hit.position);
+      PROFILE(profileCounters().shadeDepth[std::min(top, profileDepths - 1)]++);
+
+      // reflection from reflective materials
+      double reflectivity = frame.material->reflectivity;
+      if (reflectivity <= 0 || top >= settings.maxBounces)
+         break;
+      throughput *= reflectivity;
+      if (throughput < settings.minThroughput)
+         break;
+
+      Vect refDir = reflectDirection(frame.hit.normal, frame.dir);
+      Ray reflectRay (frame.hit.position, refDir);
+
+      // determine what the ray intersects with first
+      Hit reflectHit;
+      PROFILE(double reflectStart = profileClock());
+      bool reflected = bvh.closestHit(reflectRay, reflectHit);
+      PROFILE(profileRays(reflectionRays, 1, reflectStart));
+
+      // the ray only affects the color if it reflected off something
+      if (!reflected || reflectHit.t <= settings.accuracy)
+         break;
+
+      stack[top + 1].hit = reflectHit;
+      stack[top + 1].dir = refDir;
+      top++;
+   }
+
+   // then light them back up to the first
+   Color reflectedColor;
+   for (int level = top; level >= 0; level--)
+   {
+      ShadeFrame &frame = stack[level];
+      Color finalColor = frame.color.colorScalar(settings.ambientlight);
+
+      if (level < top)
+         finalColor = finalColor.colorAdd(reflectedColor.colorScalar(frame.material->reflectivity));
+
+      reflectedColor = addDirectLight(scene, frame, finalColor).clip();
+   }
+
+   return reflectedColor;
+}
+
+/******************************************************************************
+ * WAVE FRAME STRUCT - a surface on the path of a camera sample, as the
+ *    wavefront integrator keeps it
+ *****************************************************************************/
+struct WaveFrame
+{
+   ShadeFrame surface;
+   int sample;        // the camera sample whose path it is on
+   int parent;        // the frame whose reflection ray hit it, -1 for none
+   int child;         // the frame its own reflection ray hit, -1 for none
+   double throughput; // share of its light carried back to the camera
+};
+
+/******************************************************************************
+ * WAVE RAY STRUCT - a reflection ray queued for the next wave
+ *****************************************************************************/
+struct WaveRay
+{
+   Ray ray;
+   int parent;        // the frame it leaves from
+   double throughput; // of the surface it will hit
+};
+
+/******************************************************************************
+ * SHADOW RAY STRUCT - a ray from a frame towards the light being traced
+ *****************************************************************************/
+struct ShadowRay
+{
+   Ray ray;
+   Real distance;  // to the light
+   float cosAngle; // the light falls in at
+   int frame;
+};
+
+/******************************************************************************
+ * WAVEFRONT STRUCT - the queues of the wavefront integrator. every render
+ *    thread keeps its own, so once they have grown nothing is allocated
+ *****************************************************************************/
+struct Wavefront
+{
+   std::vector<WaveFrame> frames;  // every surface hit, one wave after another
+   std::vector<int> waves;         // first frame of every wave, then the end
+   std::vector<WaveFrame> sorted;  // a wave while it is sorted
+   std::vector<int> materialStart; // where each material goes in sorted
+   std::vector<WaveRay> rays;      // reflection rays of the next wave
+   std::vector<ShadowRay> shadows; // shadow rays of a wave towards one light
+   std::vector<Color> colors;      // the shaded color of every frame
+
+   // room for n camera samples, most of them hit once or twice
+   void reserve(int n)
+   {
+      frames.reserve(2 * n);
+      sorted.reserve(n);
+      rays.reserve(n);
+      shadows.reserve(2 * n);
+      colors.reserve(2 * n);
+   }
+
+   void add(const Hit &hit, const Vect &dir, int sample, int parent, double throughput)
+   {
+      frames.push_back(WaveFrame());
+      WaveFrame &frame = frames.back();
+      frame.surface.hit = hit;
+      frame.surface.dir = dir;
+      frame.sample = sample;
+      frame.parent = parent;
+      frame.child = -1;
+      frame.throughput = throughput;
+   }
+};
+
+/******************************************************************************
+ * SORT WAVE - sorts frames [start, end) by material, keeping the queue
+ *    order within a material, and points every parent at the new place of
+ *    its frame. a counting sort: one pass counts, one places
+ *****************************************************************************/
+inline void sortWave(Wavefront &wave, int start, int end, int materials)
+{
+   std::vector<WaveFrame> &frames = wave.frames;
+   std::vector<int> &first = wave.materialStart;
+
+   first.assign(materials + 1, 0);
+   for (int i = start; i < end; i++)
+      first[frames[i].surface.hit.material + 1]++;
+   for (int m = 1; m <= materials; m++)
+      first[m] += first[m - 1];
+
+   wave.sorted.resize(end - start);
+   for (int i = start; i < end; i++)
+      wave.sorted[first[frames[i].surface.hit.material]++] = frames[i];
+
+   for (int i = start; i < end; i++)
+   {
+      frames[i] = wave.sorted[i - start];
+      if (frames[i].parent >= 0)
+         frames[frames[i].parent].child = i;
+   }
+}
+
+/******************************************************************************
+ * SHADE WAVEFRONT - the wavefront integrator. shades the camera hits queued
+ *    in wave.frames and stores the color of each in colors[sample]. every
+ *    stage runs over its whole queue before the next one starts:
+ *    1. a wave of hits is sorted by material and each hit gets its surface
+ *       color. the reflective ones queue a reflection ray
+ *    2. the reflection queue is traced and its hits are the next wave. 1
+ *       and 2 repeat until no ray is left, with the limits of getColorAt
+ *    3. the waves are lit from the last back to the first. every surface
+ *       takes in the color its reflection ray brought back, then a light
+ *       at a time, the surfaces facing the light queue a shadow ray, the
+ *       queue is traced and the light added to the surfaces it reaches
+ *    the colors come out the same as getColorAt's, the light added in the
+ *    same order
+ *****************************************************************************/
+inline void shadeWavefront(const Scene &scene, Wavefront &wave, std::vector<Color> &colors)
+{
+   const BVH &bvh = scene.getBVH();
+   const RenderSettings &settings = scene.getSettings();
+   const MaterialTable &materials = scene.getMaterials();
+   const std::vector<Source*> &lights = scene.getLights();
+   std::vector<WaveFrame> &frames = wave.frames;
+   if (frames.empty())
+      return;
+
+   // 1 and 2, a wave at a time
+   wave.waves.assign(1, 0);
+   for (int depth = 0; wave.waves.back() < (int)frames.size(); depth++)
+   {
+      int start = wave.waves.back(), end = frames.size();
+      wave.waves.push_back(end);
+      sortWave(wave, start, end, materials.size());
+
+      wave.rays.clear();
+      for (int i = start; i < end; i++)
+      {
+         ShadeFrame &surface = frames[i].surface;
+         surface.material = &materials[surface.hit.material];
+         surface.color = surface.material->colorAt(surface.hit.position);
+         PROFILE(profileCounters().shadeDepth[std::min(depth, profileDepths - 1)]++);
+
+         double reflectivity = surface.material->reflectivity;
+         if (reflectivity <= 0 || depth >= settings.maxBounces)
+            continue;
+         double throughput = frames[i].throughput * reflectivity;
+         if (throughput < settings.minThroughput)
+            continue;
+
+         WaveRay ray;
+         ray.ray = Ray(surface.hit.position, reflectDirection(surface.hit.normal, surface.dir));
+         ray.parent = i;
+         ray.throughput = throughput;
+         wave.rays.push_back(ray);
+      }
+
+      PROFILE(double reflectStart = profileClock());
+      for (int r = 0; r < (int)wave.rays.size(); r++)
+      {
+         const WaveRay &ray = wave.rays[r];
+         Hit hit;
+         if (bvh.closestHit(ray.ray, hit) && hit.t > settings.accuracy)
+            wave.add(hit, ray.ray.getRayDirection(), frames[ray.parent].sample, ray.parent,
+                     ray.throughput);
+      }
+      PROFILE(profileRays(reflectionRays, wave.rays.size(), reflectStart));
+   }
+
+   // 3, back up the waves
+   std::vector<Color> &color = wave.colors;
+   color.resize(frames.size());
+   for (int w = wave.waves.size() - 2; w >= 0; w--)
+   {
+      int start = wave.waves[w], end = wave.waves[w + 1];
+      for (int i = start; i < end; i++)
+      {
+         ShadeFrame &surface = frames[i].surface;
+         color[i] = surface.color.colorScalar(settings.ambientlight);
+         if (frames[i].child >= 0)
+            color[i] = color[i].colorAdd(color[frames[i].child]
+                                         .colorScalar(surface.material->reflectivity));
+      }
+
+      for (int l = 0; l < (int)lights.size(); l++)
+      {
+         wave.shadows.clear();
+         for (int i = start; i < end; i++)
+         {
+            ShadowRay shadow;
+            Vect lightDir;
+            shadow.cosAngle = towardsLight(lights[l], frames[i].surface.hit, lightDir,
+                                           shadow.distance);
+            if (shadow.cosAngle > 0)
+            {
+               shadow.ray = Ray(frames[i].surface.hit.position, lightDir);
+               shadow.frame = i;
+               wave.shadows.push_back(shadow);
+            }
+         }
+
+         // a blocked ray drops out of the queue
+         PROFILE(double shadowStart = profileClock());
+         int lit = 0;
+         for (int q = 0; q < (int)wave.shadows.size(); q++)
+            if (!bvh.anyHit(wave.shadows[q].ray, settings.accuracy, wave.shadows[q].distance))
+               wave.shadows[lit++] = wave.shadows[q];
+         PROFILE(profileRays(shadowRays, wave.shadows.size(), shadowStart));
+
+         for (int q = 0; q < lit; q++)
+         {
+            const ShadowRay &shadow = wave.shadows[q];
+            color[shadow.frame] = addLight(frames[shadow.frame].surface, lights[l],
+                                           shadow.ray.getRayDirection(), shadow.cosAngle,
+                                           color[shadow.frame]);
+         }
+      }
+
+      for (int i = start; i < end; i++)
+         color[i] = color[i].clip();
+   }
+
+   for (int i = 0; i < wave.waves[1]; i++)
+      colors[frames[i].sample] = color[i];
+}
+
+#endif
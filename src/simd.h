@@ -0,0 +1,271 @@
+/******************************************************************************
+* Header:
+*   SIMD
+* Desc:
+*   Picks the intersection kernels for the BVH leaves. kernels.h is compiled
+*   once for SSE2 and once for AVX2, a scalar version is written out below,
+*   and the best one the CPU supports is chosen at runtime through CPUID.
+******************************************************************************/
+#ifndef SIMD_H
+#define SIMD_H
+
+/******************************************************************************
+ * SCALAR KERNELS - the fallback, one primitive at a time
+ *****************************************************************************/
+namespace scalar
+{
+   inline Real sphereT(const SoARay &ray, const SphereSoA &s, int i)
+   {
+      Real ocx = ray.ox - s.cx[i];
+      Real ocy = ray.oy - s.cy[i];
+      Real ocz = ray.oz - s.cz[i];
+      Real r = s.radius[i];
+
+      Real b = (2 * ocx * ray.dx) + (2 * ocy * ray.dy) + (2 * ocz * ray.dz);
+      Real c = ocx*ocx + ocy*ocy + ocz*ocz - (r*r);
+      Real discriminant = b*b - 4*c;
+
+      if (discriminant > 0)
+      {
+         Real root1 = ((-1*b - std::sqrt(discriminant)) / 2) - sphereBias;
+         if (root1 > 0)
+            return root1;
+         return ((std::sqrt(discriminant) - b) / 2) - sphereBias;
+      }
+      return -1;
+   }
+
+   inline Real triangleT(const SoARay &ray, const TriangleSoA &s, int i)
+   {
+      Real nx = s.nx[i], ny = s.ny[i], nz = s.nz[i];
+      Real d = s.distance[i];
+
+      Real a = ray.dx*nx + ray.dy*ny + ray.dz*nz;
+      if (a == 0)
+         return -1;
+
+      Real b = nx*(ray.ox + -(nx*d)) + ny*(ray.oy + -(ny*d)) + nz*(ray.oz + -(nz*d));
+      Real distToPlane = -1*b/a;
+
+      Real qx = ray.dx*distToPlane + ray.ox;
+      Real qy = ray.dy*distToPlane + ray.oy;
+      Real qz = ray.dz*distToPlane + ray.oz;
+
+      Real ex = s.cax[i], ey = s.cay[i], ez = s.caz[i];
+      Real px = qx - s.ax[i], py = qy - s.ay[i], pz = qz - s.az[i];
+      Real test1 = (ey*pz - ez*py)*nx + (ez*px - ex*pz)*ny + (ex*py - ey*px)*nz;
+
+      ex = s.bcx[i]; ey = s.bcy[i]; ez = s.bcz[i];
+      px = qx - s.cx[i]; py = qy - s.cy[i]; pz = qz - s.cz[i];
+      Real test2 = (ey*pz - ez*py)*nx + (ez*px - ex*pz)*ny + (ex*py - ey*px)*nz;
+
+      ex = s.abx[i]; ey = s.aby[i]; ez = s.abz[i];
+      px = qx - s.bx[i]; py = qy - s.by[i]; pz = qz - s.bz[i];
+      Real test3 = (ey*pz - ez*py)*nx + (ez*px - ex*pz)*ny + (ex*py - ey*px)*nz;
+
+      if ((test1 >= 0) && (test2 >= 0) && (test3 >= 0))
+         return distToPlane;
+      return -1;
+   }
+
+   inline Real meshT(const SoARay &ray, const MeshSoA &s, int i)
+   {
+      Real e1x = s.e1x[i], e1y = s.e1y[i], e1z = s.e1z[i];
+      Real e2x = s.e2x[i], e2y = s.e2y[i], e2z = s.e2z[i];
+
+      Real px = ray.dy*e2z - ray.dz*e2y;
+      Real py = ray.dz*e2x - ray.dx*e2z;
+      Real pz = ray.dx*e2y - ray.dy*e2x;
+      Real det = e1x*px + e1y*py + e1z*pz;
+      if (det == 0)
+         return -1;
+
+      Real invDet = 1 / det;
+      Real tx = ray.ox - s.vx[i], ty = ray.oy - s.vy[i], tz = ray.oz - s.vz[i];
+      Real u = (tx*px + ty*py + tz*pz) * invDet;
+      if (u < 0 || u > 1)
+         return -1;
+
+      Real qx = ty*e1z - tz*e1y;
+      Real qy = tz*e1x - tx*e1z;
+      Real qz = tx*e1y - ty*e1x;
+      Real v = (ray.dx*qx + ray.dy*qy + ray.dz*qz) * invDet;
+      if (v < 0 || u + v > 1)
+         return -1;
+
+      return (e2x*qx + e2y*qy + e2z*qz) * invDet;
+   }
+
+   inline void sphereClosest(const SoARay &ray, const SphereSoA &s, int first, int count,
+                             Real &tBest, int &best)
+   {
+      for (int i = first; i < first + count; i++)
+      {
+         Real t = sphereT(ray, s, i);
+         if (t > 0 && t < tBest)
+         {
+            tBest = t;
+            best = i;
+         }
+      }
+   }
+
+   inline bool sphereAny(const SoARay &ray, const SphereSoA &s, int first, int count,
+                         Real tMin, Real tMax)
+   {
+      for (int i = first; i < first + count; i++)
+      {
+         Real t = sphereT(ray, s, i);
+         if (t > tMin && t <= tMax)
+            return true;
+      }
+      return false;
+   }
+
+   inline void triangleClosest(const SoARay &ray, const TriangleSoA &s, int first, int count,
+                               Real &tBest, int &best)
+   {
+      for (int i = first; i < first + count; i++)
+      {
+         Real t = triangleT(ray, s, i);
+         if (t > 0 && t < tBest)
+         {
+            tBest = t;
+            best = i;
+         }
+      }
+   }
+
+   inline bool triangleAny(const SoARay &ray, const TriangleSoA &s, int first, int count,
+                           Real tMin, Real tMax)
+   {
+      for (int i = first; i < first + count; i++)
+      {
+         Real t = triangleT(ray, s, i);
+         if (t > tMin && t <= tMax)
+            return true;
+      }
+      return false;
+   }
+
+   inline void meshClosest(const SoARay &ray, const MeshSoA &s, int first, int count,
+                           Real &tBest, int &best)
+   {
+      for (int i = first; i < first + count; i++)
+      {
+         Real t = meshT(ray, s, i);
+         if (t > 0 && t < tBest)
+         {
+            tBest = t;
+            best = i;
+         }
+      }
+   }
+
+   inline bool meshAny(const SoARay &ray, const MeshSoA &s, int first, int count,
+                       Real tMin, Real tMax)
+   {
+      for (int i = first; i < first + count; i++)
+      {
+         Real t = meshT(ray, s, i);
+         if (t > tMin && t <= tMax)
+            return true;
+      }
+      return false;
+   }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// SSE2: 16 byte registers, two doubles or four floats
+#pragma GCC push_options
+#pragma GCC target("sse2")
+#define KERNEL_NS sse2
+#define KERNEL_LANES (16 / (int)sizeof(Real))
+#ifdef RT_FLOAT
+#define KERNEL_SQRT _mm_sqrt_ps
+#else
+#define KERNEL_SQRT _mm_sqrt_pd
+#endif
+#include "kernels.h"
+#undef KERNEL_NS
+#undef KERNEL_LANES
+#undef KERNEL_SQRT
+#pragma GCC pop_options
+
+// AVX2: 32 byte registers, four doubles or eight floats
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#define KERNEL_NS avx2
+#define KERNEL_LANES (32 / (int)sizeof(Real))
+#ifdef RT_FLOAT
+#define KERNEL_SQRT _mm256_sqrt_ps
+#else
+#define KERNEL_SQRT _mm256_sqrt_pd
+#endif
+#include "kernels.h"
+#undef KERNEL_NS
+#undef KERNEL_LANES
+#undef KERNEL_SQRT
+#pragma GCC pop_options
+
+#endif
+
+/******************************************************************************
+ * INTERSECT KERNELS STRUCT - one instruction set's kernels
+ *****************************************************************************/
+struct IntersectKernels
+{
+   const char *name;
+   void (*sphereClosest)(const SoARay &, const SphereSoA &, int, int, Real &, int &);
+   bool (*sphereAny)(const SoARay &, const SphereSoA &, int, int, Real, Real);
+   void (*triangleClosest)(const SoARay &, const TriangleSoA &, int, int, Real &, int &);
+   bool (*triangleAny)(const SoARay &, const TriangleSoA &, int, int, Real, Real);
+   void (*meshClosest)(const SoARay &, const MeshSoA &, int, int, Real &, int &);
+   bool (*meshAny)(const SoARay &, const MeshSoA &, int, int, Real, Real);
+};
+
+const IntersectKernels scalarKernels = { "scalar", scalar::sphereClosest, scalar::sphereAny,
+                                         scalar::triangleClosest, scalar::triangleAny,
+                                         scalar::meshClosest, scalar::meshAny };
+#if defined(__x86_64__) || defined(__i386__)
+const IntersectKernels sse2Kernels   = { "sse2", sse2::sphereClosest, sse2::sphereAny,
+                                         sse2::triangleClosest, sse2::triangleAny,
+                                         sse2::meshClosest, sse2::meshAny };
+const IntersectKernels avx2Kernels   = { "avx2", avx2::sphereClosest, avx2::sphereAny,
+                                         avx2::triangleClosest, avx2::triangleAny,
+                                         avx2::meshClosest, avx2::meshAny };
+#endif
+
+/******************************************************************************
+ * FIND KERNELS - the kernels with the given name if this CPU can run them
+ *****************************************************************************/
+inline const IntersectKernels *findKernels(const std::string &name)
+{
+#if defined(__x86_64__) || defined(__i386__)
+   __builtin_cpu_init();
+
+   if (name == "avx2" && __builtin_cpu_supports("avx2"))
+      return &avx2Kernels;
+   if (name == "sse2" && __builtin_cpu_supports("sse2"))
+      return &sse2Kernels;
+#endif
+   if (name == "scalar")
+      return &scalarKernels;
+   return NULL;
+}
+
+/******************************************************************************
+ * BEST KERNELS - the widest kernels this CPU supports
+ *****************************************************************************/
+inline const IntersectKernels *bestKernels()
+{
+   // a function static is only initialized once, even with several threads
+   static const IntersectKernels *best =
+      findKernels("avx2") ? findKernels("avx2") :
+      findKernels("sse2") ? findKernels("sse2") : &scalarKernels;
+
+   return best;
+}
+
+#endif
@@ -0,0 +1,219 @@
+/******************************************************************************
+* Header:
+*   SoA
+* Desc:
+*   Structure of arrays storage for the BVH leaves. Spheres, triangles and
+*   mesh triangles are copied out of their objects into flat per-field arrays
+*   so the intersection kernels can test one ray against several primitives
+*   with SIMD loads.
+*   Every leaf's run is padded to a multiple of soaBlock with NaN primitives
+*   that can never be hit, so the kernels never need a tail loop.
+******************************************************************************/
+#ifndef SOA_H
+#define SOA_H
+
+// primitives per padded block, the widest kernel's lane count: four
+// doubles or eight floats
+const int soaBlock = 32 / sizeof(Real);
+
+/******************************************************************************
+ * SOA RAY STRUCT - a ray split into scalars for the kernels
+ *****************************************************************************/
+struct SoARay
+{
+   Real ox, oy, oz; // origin
+   Real dx, dy, dz; // direction
+
+   SoARay() {}
+   SoARay(const Ray &ray)
+   {
+      const Vect &o = ray.getRayOrigin();
+      const Vect &d = ray.getRayDirection();
+      ox = o.getVectX();
+      oy = o.getVectY();
+      oz = o.getVectZ();
+      dx = d.getVectX();
+      dy = d.getVectY();
+      dz = d.getVectZ();
+   }
+};
+
+/******************************************************************************
+ * SPHERE SOA STRUCT - centers and radii of every sphere in the BVH
+ *****************************************************************************/
+struct SphereSoA
+{
+   Column<Real> cx, cy, cz, radius;
+   Column<int> object; // scene index of each sphere, -1 for padding
+
+   int size() const { return object.size(); }
+
+   void clear()
+   {
+      cx.clear(); cy.clear(); cz.clear(); radius.clear();
+      object.clear();
+   }
+
+   // calls f on every column, always in the same order
+   template <class F> void forEachColumn(F f)
+   {
+      f(cx); f(cy); f(cz); f(radius);
+      f(object);
+   }
+
+   void push(Real x, Real y, Real z, Real r, int index)
+   {
+      cx.push_back(x);
+      cy.push_back(y);
+      cz.push_back(z);
+      radius.push_back(r);
+      object.push_back(index);
+   }
+
+   void add(Sphere *sphere, int index)
+   {
+      Vect c = sphere->getSphereCenter();
+      push(c.getVectX(), c.getVectY(), c.getVectZ(), sphere->getSphereRadius(), index);
+   }
+
+   // a NaN center makes the discriminant NaN, which never counts as a hit
+   void pad()
+   {
+      Real nan = std::numeric_limits<Real>::quiet_NaN();
+      while (size() % soaBlock != 0)
+         push(nan, nan, nan, 0, -1);
+   }
+};
+
+/******************************************************************************
+ * TRIANGLE SOA STRUCT - vertices, edges, normals and plane distances
+ *****************************************************************************/
+struct TriangleSoA
+{
+   Column<Real> ax, ay, az;    // vertex A
+   Column<Real> bx, by, bz;    // vertex B
+   Column<Real> cx, cy, cz;    // vertex C
+   Column<Real> cax, cay, caz; // edge C - A
+   Column<Real> bcx, bcy, bcz; // edge B - C
+   Column<Real> abx, aby, abz; // edge A - B
+   Column<Real> nx, ny, nz;    // normal
+   Column<Real> distance;      // normal . A
+   Column<int> object;         // scene index, -1 for padding
+
+   int size() const { return object.size(); }
+
+   void clear()
+   {
+      Column<Real> *fields[] = { &ax, &ay, &az, &bx, &by, &bz, &cx, &cy, &cz,
+                                        &cax, &cay, &caz, &bcx, &bcy, &bcz,
+                                        &abx, &aby, &abz, &nx, &ny, &nz, &distance };
+      for (int i = 0; i < (int)(sizeof(fields) / sizeof(fields[0])); i++)
+         fields[i]->clear();
+      object.clear();
+   }
+
+   // calls f on every column, always in the same order
+   template <class F> void forEachColumn(F f)
+   {
+      f(ax); f(ay); f(az); f(bx); f(by); f(bz); f(cx); f(cy); f(cz);
+      f(cax); f(cay); f(caz); f(bcx); f(bcy); f(bcz); f(abx); f(aby); f(abz);
+      f(nx); f(ny); f(nz); f(distance);
+      f(object);
+   }
+
+   void push(Vect A, Vect B, Vect C, Vect normal, Real d, int index)
+   {
+      ax.push_back(A.getVectX()); ay.push_back(A.getVectY()); az.push_back(A.getVectZ());
+      bx.push_back(B.getVectX()); by.push_back(B.getVectY()); bz.push_back(B.getVectZ());
+      cx.push_back(C.getVectX()); cy.push_back(C.getVectY()); cz.push_back(C.getVectZ());
+
+      // the same subtractions Triangle::findIntersection makes per ray
+      cax.push_back(C.getVectX() - A.getVectX());
+      cay.push_back(C.getVectY() - A.getVectY());
+      caz.push_back(C.getVectZ() - A.getVectZ());
+      bcx.push_back(B.getVectX() - C.getVectX());
+      bcy.push_back(B.getVectY() - C.getVectY());
+      bcz.push_back(B.getVectZ() - C.getVectZ());
+      abx.push_back(A.getVectX() - B.getVectX());
+      aby.push_back(A.getVectY() - B.getVectY());
+      abz.push_back(A.getVectZ() - B.getVectZ());
+
+      nx.push_back(normal.getVectX());
+      ny.push_back(normal.getVectY());
+      nz.push_back(normal.getVectZ());
+      distance.push_back(d);
+      object.push_back(index);
+   }
+
+   void add(Triangle *triangle, int index)
+   {
+      Vect normal = triangle->getTriangleNormal();
+      push(triangle->getTriangleA(), triangle->getTriangleB(), triangle->getTriangleC(),
+           normal, normal.dotProduct(triangle->getTriangleA()), index);
+   }
+
+   // a NaN normal fails every inside test
+   void pad()
+   {
+      Real nan = std::numeric_limits<Real>::quiet_NaN();
+      Vect N (nan, nan, nan);
+      while (size() % soaBlock != 0)
+         push(N, N, N, N, nan, -1);
+   }
+};
+
+/******************************************************************************
+ * MESH SOA STRUCT - one vertex and two edges of every mesh triangle, all
+ *    Moller-Trumbore needs
+ *****************************************************************************/
+struct MeshSoA
+{
+   Column<Real> vx, vy, vz;    // vertex 0
+   Column<Real> e1x, e1y, e1z; // edge v1 - v0
+   Column<Real> e2x, e2y, e2z; // edge v2 - v0
+   Column<int> object;         // scene index, -1 for padding
+   Column<int> prim;           // triangle within the mesh
+
+   int size() const { return object.size(); }
+
+   void clear()
+   {
+      Column<Real> *fields[] = { &vx, &vy, &vz, &e1x, &e1y, &e1z, &e2x, &e2y, &e2z };
+      for (int i = 0; i < (int)(sizeof(fields) / sizeof(fields[0])); i++)
+         fields[i]->clear();
+      object.clear();
+      prim.clear();
+   }
+
+   // calls f on every column, always in the same order
+   template <class F> void forEachColumn(F f)
+   {
+      f(vx); f(vy); f(vz); f(e1x); f(e1y); f(e1z); f(e2x); f(e2y); f(e2z);
+      f(object); f(prim);
+   }
+
+   void push(Vect v0, Vect e1, Vect e2, int index, int tri)
+   {
+      vx.push_back(v0.getVectX());  vy.push_back(v0.getVectY());  vz.push_back(v0.getVectZ());
+      e1x.push_back(e1.getVectX()); e1y.push_back(e1.getVectY()); e1z.push_back(e1.getVectZ());
+      e2x.push_back(e2.getVectX()); e2y.push_back(e2.getVectY()); e2z.push_back(e2.getVectZ());
+      object.push_back(index);
+      prim.push_back(tri);
+   }
+
+   void add(TriangleMesh *mesh, int tri, int index)
+   {
+      push(mesh->getVertex(tri, 0), mesh->getEdge1(tri), mesh->getEdge2(tri), index, tri);
+   }
+
+   // NaN edges make the determinant NaN, which fails every test
+   void pad()
+   {
+      Real nan = std::numeric_limits<Real>::quiet_NaN();
+      Vect N (nan, nan, nan);
+      while (size() % soaBlock != 0)
+         push(N, N, N, -1, -1);
+   }
+};
+
+#endif
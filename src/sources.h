@@ -14,8 +14,10 @@
 class Source
 {
 public:
+   virtual ~Source() {}
+
    virtual Vect getLightPosition() { return Vect (0, 0, 0);  }
-   virtual Color getLightColor()   { return Color (1,1,1,0); }
+   virtual Color getLightColor()   { return Color (1,1,1); }
 };
 
 /******************************************************************************
@@ -31,7 +33,7 @@ public:
    Light() // default constructor
    {
       position = Vect(0,0,0);
-      color = Color(1,1,1,0);
+      color = Color(1,1,1);
    }
 
    Light(Vect p, Color c) // secondary constructor
@@ -2,70 +2,97 @@
 * Header:
 *   Vect
 * Desc:
-*   This file contains the Vect class.
+*   The vector math of the raytracer: the Vect class and the Ray class.
+*   Everything is const, takes its arguments by reference and is inline,
+*   most of it constexpr, so the compiler can keep whole expressions in
+*   registers instead of copying vectors through getters. Operators do the
+*   arithmetic; addScaled is the a + b*s the shading code uses most.
 ******************************************************************************/
 #ifndef VECT_H
 #define VECT_H
 
 /******************************************************************************
- * VECT CLASS - 
+ * VECT CLASS - a point or direction in xyz space
  *****************************************************************************/
 class Vect
 {
 private:
-   double x, y, z; // cordinates in the xyz space
+   Real x, y, z; // cordinates in the xyz space
 
 public:
-   Vect() : x(0), y(0), z(0) {}                             // default const
-   Vect(double i, double j, double k) : x(i), y(j), z(k) {} // secondary const
+   constexpr Vect() : x(0), y(0), z(0) {}                       // default const
+   constexpr Vect(Real i, Real j, Real k) : x(i), y(j), z(k) {} // secondary const
 
-   double getVectX()   { return x; }
-   double getVectY()   { return y; }
-   double getVectZ()   { return z; }
+   constexpr Real getVectX() const { return x; }
+   constexpr Real getVectY() const { return y; }
+   constexpr Real getVectZ() const { return z; }
 
-   double magnitude()      { return sqrt((x*x) + (y*y) + (z*z)); }
+   Real magnitude() const { return std::sqrt((x*x) + (y*y) + (z*z)); }
 
-   double dotProduct(Vect v) 
+   Vect normalize() const
    {
-      return x*v.getVectX() + y*v.getVectY() + z*v.getVectZ();
+      Real length = magnitude();
+      return Vect (x / length, y / length, z / length);
    }
 
-   Vect crossProduct (Vect v)
+   constexpr Real dotProduct(const Vect &v) const
    {
-      return Vect ( y*v.getVectZ() - z*v.getVectY()
-                  , z*v.getVectX() - x*v.getVectZ()
-                  , x*v.getVectY() - y*v.getVectX() );
+      return x*v.x + y*v.y + z*v.z;
    }
 
-   Vect negative()         { return Vect( -x,  -y,  -z); }
-   Vect vectMult(double s) { return Vect(x*s, y*s, z*s); } // s=scalar
-   Vect vectAdd (Vect v)
+   constexpr Vect crossProduct(const Vect &v) const
    {
-      return Vect (x + v.getVectX(), y + v.getVectY(), z + v.getVectZ());
+      return Vect ( y*v.z - z*v.y
+                  , z*v.x - x*v.z
+                  , x*v.y - y*v.x );
    }
 
-   Vect normalize()
+   constexpr Vect operator-() const                { return Vect(-x, -y, -z); }
+   constexpr Vect operator+(const Vect &v) const   { return Vect(x + v.x, y + v.y, z + v.z); }
+   constexpr Vect operator-(const Vect &v) const   { return Vect(x - v.x, y - v.y, z - v.z); }
+   constexpr Vect operator*(Real s) const          { return Vect(x*s, y*s, z*s); } // s=scalar
+
+   // this + v*s in one step, e.g. a point along a ray
+   constexpr Vect addScaled(const Vect &v, Real s) const
+   {
+      return Vect(x + v.x*s, y + v.y*s, z + v.z*s);
+   }
+
+   Vect &operator+=(const Vect &v)
    {
-      double maginitude = sqrt((x*x) + (y*y) + (z*z));
-      return Vect ( x / maginitude
-                  , y / maginitude
-                  , z / maginitude );
+      x += v.x;
+      y += v.y;
+      z += v.z;
+      return *this;
    }
 };
 
+constexpr Vect operator*(Real s, const Vect &v) { return v * s; }
+
 /******************************************************************************
- * RAY CLASS - The rays trace the pixels to the respecive intersections
+ * RAY CLASS - The rays trace the pixels to the respecive intersections. The
+ *    reciprocal of the direction is worked out once, when the ray is made,
+ *    for the slab tests against bounding boxes
  *****************************************************************************/
 class Ray
 {
 private:
    Vect origin, direction;
+   Vect invDirection; // 1 / direction, infinite along an axis it is flat in
 
 public:
-   Ray() : origin(Vect(0,0,0)), direction(Vect(1,0,0)) {} // default const
-   Ray(Vect o, Vect d) : origin(o), direction(d) {}       // secondary const
-   Vect getRayOrigin()    { return origin;    }
-   Vect getRayDirection() { return direction; }
+   Ray() : origin(Vect(0,0,0)), direction(Vect(1,0,0))
+         , invDirection(Vect(1, 1 / Real(0), 1 / Real(0))) {} // default const
+   Ray(const Vect &o, const Vect &d)
+      : origin(o), direction(d)
+      , invDirection(1 / d.getVectX(), 1 / d.getVectY(), 1 / d.getVectZ()) {} // secondary const
+
+   const Vect &getRayOrigin() const       { return origin;       }
+   const Vect &getRayDirection() const    { return direction;    }
+   const Vect &getRayInvDirection() const { return invDirection; }
+
+   // the point t along the ray
+   constexpr Vect at(Real t) const { return origin.addScaled(direction, t); }
 };
 
 #endif